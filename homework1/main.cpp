@@ -22,6 +22,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "frame_arena.hpp"
+
 std::string to_string(std::string_view str)
 {
   return std::string(str.begin(), str.end());
@@ -337,6 +339,8 @@ try
   bool running = true;
   auto last_frame_start = std::chrono::high_resolution_clock::now();
   std::unordered_map<SDL_Scancode, bool> key_down;
+  // Per-frame buffers, allocated without touching the heap
+  frame_arena arena;
   while (running)
   {
     for (SDL_Event event; SDL_PollEvent(&event);)
@@ -382,8 +386,10 @@ try
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBindVertexArray(vao);
 
-    std::vector<std::array<uint8_t, 4>> colors;
-    for (auto v : vertices)
+    frame_vector<std::array<uint8_t, 4>> colors{
+        arena_allocator<std::array<uint8_t, 4>>{arena}};
+    colors.reserve(vertices.size());
+    for (auto const &v : vertices)
       colors.emplace_back(v.color);
 
     glBufferSubData(GL_ARRAY_BUFFER, (sizeof(glm::vec3) * vertices.size()),
@@ -393,6 +399,13 @@ try
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void *)0);
 
     SDL_GL_SwapWindow(window);
+    arena.next_frame();
+    // The arena grows on its own, this shows up only while it does
+    if (arena.last_frame.heap_allocations > 0)
+      std::cout << "arena allocations:\t" << arena.last_frame.allocations
+                << " (" << arena.last_frame.bytes << " bytes), on the heap:\t"
+                << arena.last_frame.heap_allocations << " ("
+                << arena.last_frame.heap_bytes << " bytes)" << std::endl;
   }
 
   SDL_GL_DeleteContext(gl_context);
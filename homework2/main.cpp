@@ -36,6 +36,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 
 #include "obj_parser.hpp"
+#include "profiler.hpp"
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 
@@ -747,8 +748,13 @@ try
   auto z = 130.f;
   glm::vec3 point_light_position{-1350.f, 80.f, -460.f};
   bool running = true;
+  auto profiler = frame_profiler{};
+  std::size_t frame_count = 0;
+
   while (running)
   {
+    profiler.begin_frame();
+
     for (SDL_Event event; SDL_PollEvent(&event);)
       switch (event.type)
       {
@@ -886,6 +892,7 @@ try
                     point_light_position + glm::vec3(0.0f, 0.0f, -1.0f),
                     glm::vec3(0.0f, -1.0f, 0.0f)));
 
+    profiler.push("point shadow");
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthMapFBO);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, shadow_map_size, shadow_map_size);
@@ -907,7 +914,9 @@ try
     }
     glBindVertexArray(scene_vao);
     draw_scene(true);
+    profiler.pop();
 
+    profiler.push("sun shadow");
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_fbo);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, shadow_map_size, shadow_map_size);
@@ -950,7 +959,9 @@ try
 
     glBindVertexArray(scene_vao);
     draw_scene(true);
+    profiler.pop();
 
+    profiler.push("scene");
     glViewport(0, 0, width, height);
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
     glClearColor(0.8f, 0.8f, 0.9f, 0.f);
@@ -991,13 +1002,19 @@ try
 
     glBindVertexArray(scene_vao);
     draw_scene(false);
+    profiler.pop();
 
+    profiler.push("shadow map view");
     glUseProgram(rectangle_program);
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(rectangle_vao);
     glBindTexture(GL_TEXTURE_2D, shadow_map_texture);
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    profiler.pop();
     SDL_GL_SwapWindow(window);
+    profiler.end_frame();
+
+    if (++frame_count % 60 == 0) profiler.print(std::cout);
   }
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
@@ -35,8 +35,10 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 
+#include "benchmark.hpp"
 #include "gltf_loader.hpp"
 #include "obj_parser.hpp"
+#include "profiler.hpp"
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 
@@ -510,7 +512,10 @@ void load_textures(const std::string &materials_dir, const auto &materials,
   }
 }
 
-int main() try {
+int main(int argc, char **argv) try {
+  auto const options = parse_benchmark_options(argc, argv);
+  prepare_headless(options);
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0) sdl2_fail("SDL_Init: ");
 
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -524,7 +529,10 @@ int main() try {
 
   SDL_Window *window = SDL_CreateWindow(
       "Sponza observer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800,
-      600, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
+      600,
+      SDL_WINDOW_OPENGL | (options.track
+                               ? SDL_WINDOW_HIDDEN
+                               : SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED));
 
   if (!window) sdl2_fail("SDL_CreateWindow: ");
 
@@ -540,6 +548,20 @@ int main() try {
   if (!GLEW_VERSION_3_3)
     throw std::runtime_error("OpenGL 3.3 is not supported");
 
+  // With --benchmark the camera follows the track into an offscreen
+  // framebuffer, with --record the interactive camera is saved as a track
+  auto bench = benchmark{options, "homework3"};
+  if (options.track) {
+    width = options.width;
+    height = options.height;
+  }
+  auto recorder =
+      track_recorder{options, {"x", "y", "z", "pitch", "yaw"}};
+  float recorded_time = 0.f;
+
+  auto profiler = frame_profiler{};
+  std::size_t frame_count = 0;
+
   glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
   auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
@@ -874,6 +896,8 @@ int main() try {
   bool paused = false;
   bool running = true;
   while (running) {
+    profiler.begin_frame();
+
     for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type) {
         case SDL_QUIT:
           running = false;
@@ -902,6 +926,13 @@ int main() try {
                    now - last_frame_start)
                    .count();
     last_frame_start = now;
+
+    if (options.track) {
+      if (!bench.next_frame()) break;
+      bench.begin_frame();
+      dt = options.timestep;
+    }
+
     if (!paused) time += dt;
 
     //    if (button_down[SDLK_r])
@@ -935,6 +966,20 @@ int main() try {
     camera_position +=
         y * glm::vec3(std::cos(camera_yaw), 0.f, std::sin(camera_yaw));
     camera_position += z * glm::vec3(0.f, 1.f, 0.f);
+
+    if (options.track) {
+      auto const camera = bench.camera();
+      camera_position = {camera[0], camera[1], camera[2]};
+      camera_pitch = camera[3];
+      camera_yaw = camera[4];
+      time = bench.time();
+    } else {
+      recorded_time += dt;
+      recorder.add(recorded_time, {camera_position.x, camera_position.y,
+                                   camera_position.z, camera_pitch,
+                                   camera_yaw});
+    }
+
     glm::mat4 view(1.f);
     view = glm::rotate(view, camera_pitch, {1.f, 0.f, 0.f});
     view = glm::rotate(view, camera_yaw, {0.f, 1.f, 0.f});
@@ -948,6 +993,7 @@ int main() try {
                 << camera_yaw << std::endl;
     }
 
+    profiler.push("shadow");
     glm::mat4 model(1.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1005,10 +1051,12 @@ int main() try {
     glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     draw_scene(true);
+    profiler.pop();
 
+    profiler.push("scene");
     glViewport(0, 0, width, height);
     // glEnable(GL_FRAMEBUFFER_SRGB);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bench.framebuffer);
     glClearColor(0.8f, 0.8f, 0.9f, 0.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1075,14 +1123,27 @@ int main() try {
 
     glBindVertexArray(scene_vao);
     draw_scene(false);
+    profiler.pop();
 
+    profiler.push("shadow map view");
     glUseProgram(rectangle_program);
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(rectangle_vao);
     glBindTexture(GL_TEXTURE_2D, shadow_map_texture);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    SDL_GL_SwapWindow(window);
+    profiler.pop();
+
+    if (options.track)
+      bench.end_frame();
+    else
+      SDL_GL_SwapWindow(window);
+    profiler.end_frame();
+
+    if (!options.track && ++frame_count % 60 == 0) profiler.print(std::cout);
   }
+  if (options.track) bench.finish();
+  if (options.trace) profiler.write_trace(*options.trace);
+
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
 } catch (std::exception const &e) {
@@ -0,0 +1,218 @@
+#include "depth_sort.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+
+    // Three passes of 11 bits, the histograms still fit in L1
+    constexpr int digit_bits = 11;
+    constexpr std::size_t digit_count = 1 << digit_bits;
+    constexpr int pass_count = (32 + digit_bits - 1) / digit_bits;
+
+    // Each radix pass splits the keys into this many tiles, sized for a few per thread
+    constexpr std::size_t tile_size = 1 << 15;
+
+    // Unsigned integers that sort in the same order as the floats, largest float first
+    std::uint32_t descending_key(float depth)
+    {
+        std::uint32_t const bits = std::bit_cast<std::uint32_t>(depth);
+        std::uint32_t const ascending = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+        return ~ascending;
+    }
+
+    std::size_t digit(std::uint32_t key, int pass)
+    {
+        return (key >> (pass * digit_bits)) & (digit_count - 1);
+    }
+
+}
+
+void depth_sorter::sort(effect_system const & effects, glm::vec3 const & camera_position, glm::vec3 const & forward,
+    thread_pool & pool)
+{
+    std::size_t const sources = effects.effects.size();
+    counts.resize(sources, 0);
+
+    // Start from the previous order. Removing a particle moves the last one of
+    // its effect into the hole, so the entries past the new count are dropped
+    // and the particles spawned since the last sort go last.
+    kept.resize(sources);
+    for (std::size_t e = 0; e < sources; ++e)
+        kept[e] = std::min(counts[e], effects.effects[e].particles.particle_count());
+
+    std::size_t count = 0;
+    for (std::uint32_t index : order)
+    {
+        std::size_t const e = std::upper_bound(effects.offsets.begin(), effects.offsets.end(), index)
+            - effects.offsets.begin() - 1;
+        if (index - effects.offsets[e] < kept[e])
+            order[count++] = index;
+    }
+    order.resize(count);
+
+    for (std::size_t e = 0; e < sources; ++e)
+    {
+        counts[e] = effects.effects[e].particles.particle_count();
+        for (std::size_t i = kept[e]; i < counts[e]; ++i)
+            order.push_back(effects.offsets[e] + i);
+    }
+    count = order.size();
+    keys.resize(count);
+
+    // Keys are computed in particle order, which vectorizes, and then gathered
+    // into the previous frame's order
+    float const offset = glm::dot(camera_position, forward);
+    depths.resize(effects.capacity());
+    for (std::size_t e = 0; e < sources; ++e)
+    {
+        particle_system const & particles = effects.effects[e].particles;
+        std::uint32_t * const out = depths.data() + effects.offsets[e];
+        pool.parallel_for(counts[e], tile_size, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                float const depth = particles.position_x[i] * forward.x + particles.position_y[i] * forward.y
+                    + particles.position_z[i] * forward.z - offset;
+                out[i] = descending_key(depth);
+            }
+        });
+    }
+    pool.parallel_for(count, tile_size, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+            keys[i] = depths[order[i]];
+    });
+
+    // Allowing a few moves per particle keeps the fix-up well under a radix sort.
+    // After a frame that needed the radix sort only a short attempt is made,
+    // while the particles keep moving it rarely pays off.
+    std::size_t const max_moves = stats.coherent ? 2 * count : count / 16;
+    stats.coherent = insertion_sort(max_moves);
+    stats.passes = 0;
+    if (!stats.coherent)
+        radix_sort(pool);
+}
+
+bool depth_sorter::insertion_sort(std::size_t max_moves)
+{
+    // Keys and indices move together, so giving up halfway still leaves valid
+    // input for the radix sort
+    std::size_t moves = 0;
+    for (std::size_t i = 1; i < keys.size(); ++i)
+    {
+        std::uint32_t const key = keys[i];
+        if (keys[i - 1] <= key)
+            continue;
+
+        std::uint32_t const index = order[i];
+        std::size_t j = i;
+        for (; j > 0 && keys[j - 1] > key; --j)
+        {
+            keys[j] = keys[j - 1];
+            order[j] = order[j - 1];
+        }
+        keys[j] = key;
+        order[j] = index;
+
+        moves += i - j;
+        if (moves > max_moves)
+            return false;
+    }
+    return true;
+}
+
+void depth_sorter::radix_sort(thread_pool & pool)
+{
+    std::size_t const count = keys.size();
+    std::size_t const tiles = (count + tile_size - 1) / tile_size;
+    scratch_keys.resize(count);
+    scratch_order.resize(count);
+
+    // Digits that are the same for every key, typically the exponent's top byte,
+    // do not change the order and their passes are skipped
+    std::array<bool, pass_count> needed{};
+    {
+        histograms.assign(tiles * pass_count * digit_count, 0);
+        pool.parallel_for(tiles, 1, [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t tile = first; tile < last; ++tile)
+            {
+                std::uint32_t * const h = histograms.data() + tile * pass_count * digit_count;
+                std::size_t const end = std::min(count, (tile + 1) * tile_size);
+                for (std::size_t i = tile * tile_size; i < end; ++i)
+                    for (int pass = 0; pass < pass_count; ++pass)
+                        ++h[pass * digit_count + digit(keys[i], pass)];
+            }
+        });
+
+        for (int pass = 0; pass < pass_count; ++pass)
+            for (std::size_t d = 0; d < digit_count; ++d)
+            {
+                std::size_t total = 0;
+                for (std::size_t tile = 0; tile < tiles; ++tile)
+                    total += histograms[(tile * pass_count + pass) * digit_count + d];
+                if (total != 0 && total != count)
+                    needed[pass] = true;
+            }
+    }
+
+    histograms.resize(tiles * digit_count);
+    for (int pass = 0; pass < pass_count; ++pass)
+    {
+        if (!needed[pass])
+            continue;
+        ++stats.passes;
+
+        std::fill(histograms.begin(), histograms.end(), 0);
+        pool.parallel_for(tiles, 1, [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t tile = first; tile < last; ++tile)
+            {
+                std::uint32_t * const h = histograms.data() + tile * digit_count;
+                std::size_t const end = std::min(count, (tile + 1) * tile_size);
+                for (std::size_t i = tile * tile_size; i < end; ++i)
+                    ++h[digit(keys[i], pass)];
+            }
+        });
+
+        // Exclusive prefix sum in digit-major order gives every tile its write
+        // position for every digit, keeping the sort stable
+        std::uint32_t sum = 0;
+        for (std::size_t d = 0; d < digit_count; ++d)
+            for (std::size_t tile = 0; tile < tiles; ++tile)
+            {
+                std::uint32_t & h = histograms[tile * digit_count + d];
+                std::uint32_t const n = h;
+                h = sum;
+                sum += n;
+            }
+
+        pool.parallel_for(tiles, 1, [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t tile = first; tile < last; ++tile)
+            {
+                // A local copy of the write positions, which the compiler can
+                // not keep apart from the keys otherwise
+                std::array<std::uint32_t, digit_count> position;
+                std::copy_n(histograms.data() + tile * digit_count, digit_count, position.begin());
+
+                std::size_t const end = std::min(count, (tile + 1) * tile_size);
+                for (std::size_t i = tile * tile_size; i < end; ++i)
+                {
+                    std::uint32_t const key = keys[i];
+                    std::uint32_t const target = position[digit(key, pass)]++;
+                    scratch_keys[target] = key;
+                    scratch_order[target] = order[i];
+                }
+            }
+        });
+
+        keys.swap(scratch_keys);
+        order.swap(scratch_order);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "particle_effect.hpp"
+#include "thread_pool.hpp"
+
+// Back-to-front order of the particles of all effects for alpha blending. The
+// particles are not moved: the result is an index buffer into the packed
+// particles that effect_system writes.
+//
+// View-space depths are turned into 32-bit keys that sort like the floats and
+// sorted with a parallel LSD radix sort. When the camera and the particles
+// barely move, the previous frame's order is nearly right already, so an
+// insertion sort of it is tried first and given up when it gets expensive.
+struct depth_sorter
+{
+    struct statistics
+    {
+        // Whether the last sort got away with fixing up the previous order
+        bool coherent = false;
+        // Radix passes run, passes where all keys share a digit are skipped
+        int passes = 0;
+    };
+
+    // Fills `order` with packed particle indices, farthest along `forward` first
+    void sort(effect_system const & effects, glm::vec3 const & camera_position, glm::vec3 const & forward,
+        thread_pool & pool);
+
+    std::vector<std::uint32_t> order;
+    statistics stats;
+
+private:
+    // Keys of all packed particles, in particle order
+    std::vector<std::uint32_t> depths;
+    std::vector<std::uint32_t> keys;
+    std::vector<std::uint32_t> scratch_keys;
+    std::vector<std::uint32_t> scratch_order;
+    std::vector<std::uint32_t> histograms;
+    // Particles per effect at the last sort
+    std::vector<std::size_t> counts;
+    // Particles per effect that are still in the previous order
+    std::vector<std::size_t> kept;
+
+    bool insertion_sort(std::size_t max_moves);
+    void radix_sort(thread_pool & pool);
+};
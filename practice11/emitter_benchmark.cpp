@@ -0,0 +1,233 @@
+#include "emitter_benchmark.hpp"
+
+#include "emitter_random.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+    constexpr double pi = 3.14159265358979323846;
+
+    struct distribution_result
+    {
+        std::string name;
+        // Kolmogorov-Smirnov statistic and the largest one allowed for the sample count
+        double statistic = 0.0;
+        double critical = 0.0;
+        bool passed = false;
+    };
+
+    struct throughput_result
+    {
+        std::string name;
+        double samples_per_second = 0.0;
+    };
+
+    // Largest distance between the empirical distribution of `values` and `cdf`.
+    // Sorts `values`.
+    double kolmogorov_smirnov(std::vector<double> & values, std::function<double(double)> const & cdf)
+    {
+        std::sort(values.begin(), values.end());
+        double const n = values.size();
+        double result = 0.0;
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            double const f = cdf(values[i]);
+            result = std::max({result, f - i / n, (i + 1) / n - f});
+        }
+        return result;
+    }
+
+    template <typename F>
+    double seconds(F && f)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+}
+
+emitter_benchmark_options parse_emitter_benchmark_options(int argc, char ** argv)
+{
+    emitter_benchmark_options result;
+    if (argc < 2 || std::string(argv[1]) != "--emitter-bench")
+        return result;
+    result.enabled = true;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--samples")
+            result.samples = std::stoul(value());
+        else if (arg == "--repeats")
+            result.repeats = std::stoi(value());
+        else if (arg == "--seed")
+            result.seed = std::stoull(value());
+        else if (arg == "--output")
+            result.output = value();
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (result.samples == 0)
+        throw std::runtime_error("--samples must be positive");
+    if (result.repeats <= 0)
+        throw std::runtime_error("--repeats must be positive");
+
+    return result;
+}
+
+bool run_emitter_benchmark(emitter_benchmark_options const & options)
+{
+    std::size_t const n = options.samples;
+    // The statistic a correct generator exceeds with probability 0.001
+    double const critical = 1.949 / std::sqrt(double(n));
+
+    std::vector<distribution_result> distributions;
+    auto check = [&](std::string name, std::vector<double> & values, std::function<double(double)> const & cdf)
+    {
+        auto & r = distributions.emplace_back();
+        r.name = std::move(name);
+        r.statistic = kolmogorov_smirnov(values, cdf);
+        r.critical = critical;
+        r.passed = r.statistic <= critical;
+    };
+
+    std::vector<float> x(n), y(n), z(n);
+    std::vector<double> values(n);
+
+    // The bulk path has to give exactly the values of the one-at-a-time one
+    std::size_t mismatches = 0;
+    {
+        float const min = -3.f, max = 5.f;
+        philox_stream bulk(options.seed, 0), single(options.seed, 0);
+        fill_uniform(bulk, x, min, max);
+        for (std::size_t i = 0; i < n; ++i)
+            mismatches += x[i] != single.uniform(min, max);
+
+        for (std::size_t i = 0; i < n; ++i)
+            values[i] = x[i];
+        check("uniform [-3, 5]", values, [&](double v) { return std::clamp((v - min) / (max - min), 0.0, 1.0); });
+    }
+
+    {
+        float const mean = 2.f, deviation = 0.5f;
+        philox_stream stream(options.seed, 1);
+        fill_normal(stream, x, mean, deviation);
+        for (std::size_t i = 0; i < n; ++i)
+            values[i] = x[i];
+        check("normal (2, 0.5)", values,
+            [&](double v) { return 0.5 * std::erfc(-(v - mean) / (deviation * std::sqrt(2.0))); });
+    }
+
+    // Uniform over a cap: the cosine of the angle to the axis is uniform between
+    // cos(max_angle) and 1, and so is the azimuth around the axis. Directions
+    // that are not unit length or leave the cap fail the test outright.
+    std::size_t outside = 0;
+    std::uint32_t id = 2;
+    for (float const max_angle : {0.5f, float(pi)})
+    {
+        glm::vec3 const axis = glm::normalize(glm::vec3(1.f, 2.f, -2.f));
+        philox_stream stream(options.seed, id++);
+        fill_cone(stream, axis, max_angle, x, y, z);
+
+        glm::vec3 const u = glm::normalize(glm::cross(axis, glm::vec3(0.f, 0.f, 1.f)));
+        glm::vec3 const v = glm::cross(axis, u);
+        double const min_cos = std::cos(double(max_angle));
+        std::vector<double> azimuth(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            glm::vec3 const d(x[i], y[i], z[i]);
+            values[i] = glm::dot(d, axis);
+            azimuth[i] = std::atan2(glm::dot(d, v), glm::dot(d, u));
+            outside += std::abs(glm::length(d) - 1.f) > 1e-5f || values[i] < min_cos - 1e-5;
+        }
+
+        std::string const name = max_angle == float(pi) ? "sphere" : "cone 0.5 rad";
+        check(name + " cosine", values,
+            [&](double c) { return std::clamp((c - min_cos) / (1.0 - min_cos), 0.0, 1.0); });
+        check(name + " azimuth", azimuth, [](double a) { return std::clamp((a + pi) / (2.0 * pi), 0.0, 1.0); });
+    }
+
+    std::vector<throughput_result> throughputs;
+    auto time = [&](std::string name, auto && f)
+    {
+        double const t = seconds([&]
+        {
+            for (int repeat = 0; repeat < options.repeats; ++repeat)
+                f();
+        });
+        throughputs.push_back({std::move(name), double(n) * options.repeats / t});
+    };
+
+    philox_stream stream(options.seed, id);
+    time("philox_stream::uniform", [&]
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            x[i] = stream.uniform(0.f, 1.f);
+    });
+    time("fill_uniform", [&] { fill_uniform(stream, x, 0.f, 1.f); });
+    time("fill_normal", [&] { fill_normal(stream, x, 0.f, 1.f); });
+    time("fill_cone", [&] { fill_cone(stream, {0.f, 1.f, 0.f}, 0.5f, x, y, z); });
+
+    bool passed = mismatches == 0 && outside == 0;
+    for (auto const & r : distributions)
+        passed = passed && r.passed;
+
+    std::cout << std::fixed << std::setprecision(5);
+    std::cout << n << " samples per test, seed " << options.seed << ", critical KS statistic " << critical << '\n';
+    std::cout << "fill_uniform values differing from philox_stream::uniform\t" << mismatches << '\n';
+    std::cout << "cone directions off the unit sphere or outside the cap\t" << outside << '\n';
+    for (auto const & r : distributions)
+        std::cout << r.name << "\tKS " << r.statistic << (r.passed ? "" : "\tFAILED") << '\n';
+    std::cout << std::setprecision(1);
+    for (auto const & r : throughputs)
+        std::cout << r.name << "\t" << r.samples_per_second * 1e-6 << " M samples/s\n";
+    std::cout << (passed ? "passed" : "FAILED") << '\n';
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (options.output)
+    {
+        std::ofstream out(*options.output);
+        out << std::setprecision(6);
+        out << "{\n";
+        out << "\"samples\": " << n << ",\n";
+        out << "\"seed\": " << options.seed << ",\n";
+        out << "\"passed\": " << (passed ? "true" : "false") << ",\n";
+        out << "\"uniform_mismatches\": " << mismatches << ",\n";
+        out << "\"cone_outside\": " << outside << ",\n";
+        out << "\"critical\": " << critical << ",\n";
+        out << "\"distributions\": [";
+        for (std::size_t i = 0; i < distributions.size(); ++i)
+            out << (i ? ",\n" : "\n") << "{\"name\": \"" << distributions[i].name << "\", \"statistic\": "
+                << distributions[i].statistic << "}";
+        out << "\n],\n";
+        out << "\"samples_per_second\": {";
+        for (std::size_t i = 0; i < throughputs.size(); ++i)
+            out << (i ? ", " : "") << "\"" << throughputs[i].name << "\": " << throughputs[i].samples_per_second;
+        out << "}\n}\n";
+    }
+
+    return passed;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+struct emitter_benchmark_options
+{
+    // Set by --emitter-bench, which has to be the first argument
+    bool enabled = false;
+    std::optional<std::filesystem::path> output;
+
+    // Samples per distribution test and per timed batch
+    std::size_t samples = 1 << 20;
+    int repeats = 20;
+    std::uint64_t seed = 1;
+};
+
+// --emitter-bench [--samples <n>] [--repeats <n>] [--seed <n>] [--output <json>]
+// Anything else leaves the options disabled without looking at the arguments.
+emitter_benchmark_options parse_emitter_benchmark_options(int argc, char ** argv);
+
+// Checks the batched emitter samples without a window: fill_uniform against
+// philox_stream::uniform, and the distributions of fill_uniform, fill_normal
+// and fill_cone with Kolmogorov-Smirnov tests. Then prints the samples per
+// second of each. Returns false if a check failed.
+bool run_emitter_benchmark(emitter_benchmark_options const & options);
@@ -0,0 +1,254 @@
+#include "emitter_random.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/geometric.hpp>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+    constexpr float pi = 3.14159265358979f;
+
+    constexpr std::size_t group = 8;
+
+    // Calls f(offset, count, bits) for every group of up to eight samples, where
+    // `bits` holds `Words` random words per sample laid out as bits[word * 8 + lane].
+    // The random words are generated a few hundred samples at a time.
+    template <std::size_t Words, typename F>
+    void for_each_group(philox_stream & stream, std::size_t n, F && f)
+    {
+        constexpr std::size_t block = 256;
+        std::uint32_t bits[block * Words];
+
+        for (std::size_t begin = 0; begin < n; begin += block)
+        {
+            std::size_t const size = std::min(block, n - begin);
+            std::size_t const groups = (size + group - 1) / group;
+            stream.fill(bits, groups * group * Words);
+            for (std::size_t g = 0; g < groups; ++g)
+                f(begin + g * group, std::min(group, size - g * group), bits + g * group * Words);
+        }
+    }
+
+    // Orthonormal vectors perpendicular to a unit axis
+    void basis(glm::vec3 const & axis, glm::vec3 & u, glm::vec3 & v)
+    {
+        glm::vec3 const helper = std::abs(axis.x) < 0.9f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+        u = glm::normalize(glm::cross(helper, axis));
+        v = glm::cross(axis, u);
+    }
+
+#ifdef __AVX2__
+
+    __m256 to_unit(__m256i bits)
+    {
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)), _mm256_set1_ps(0x1p-24f));
+    }
+
+    __m256i load(std::uint32_t const * bits)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(bits));
+    }
+
+    void store(float * out, __m256 value, std::size_t count)
+    {
+        if (count == group)
+        {
+            _mm256_storeu_ps(out, value);
+            return;
+        }
+
+        alignas(32) float lanes[group];
+        _mm256_store_ps(lanes, value);
+        std::copy_n(lanes, count, out);
+    }
+
+    // Natural logarithm of normal positive floats, the polynomial is from Cephes' logf
+    __m256 log8(__m256 x)
+    {
+        __m256i const bits = _mm256_castps_si256(x);
+        __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+        __m256 mantissa = _mm256_castsi256_ps(_mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+
+        // Keep the mantissa in [sqrt(1/2), sqrt(2)) so the polynomial argument stays small
+        __m256 const large = _mm256_cmp_ps(mantissa, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+        mantissa = _mm256_blendv_ps(mantissa, _mm256_mul_ps(mantissa, _mm256_set1_ps(0.5f)), large);
+        exponent = _mm256_add_ps(exponent, _mm256_and_ps(large, _mm256_set1_ps(1.f)));
+
+        __m256 const f = _mm256_sub_ps(mantissa, _mm256_set1_ps(1.f));
+        __m256 const f2 = _mm256_mul_ps(f, f);
+
+        __m256 p = _mm256_set1_ps(7.0376836292e-2f);
+        for (float c : {-1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f,
+            -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f})
+            p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(c));
+
+        __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, f), f2);
+        y = _mm256_fmadd_ps(exponent, _mm256_set1_ps(-2.12194440e-4f), y);
+        y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), f2, y);
+        return _mm256_fmadd_ps(exponent, _mm256_set1_ps(0.693359375f), _mm256_add_ps(f, y));
+    }
+
+    // Sine and cosine of angles in [-pi, pi]
+    void sincos8(__m256 x, __m256 & sin, __m256 & cos)
+    {
+        __m256 const sign_mask = _mm256_set1_ps(-0.f);
+        __m256 const sign = _mm256_and_ps(x, sign_mask);
+        __m256 r = _mm256_andnot_ps(sign_mask, x);
+
+        // sin(x) = sin(pi - x) and cos(x) = -cos(pi - x) fold the range to [0, pi/2]
+        __m256 const far = _mm256_cmp_ps(r, _mm256_set1_ps(pi / 2.f), _CMP_GT_OQ);
+        r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(pi), r), far);
+        __m256 const r2 = _mm256_mul_ps(r, r);
+
+        __m256 s = _mm256_set1_ps(-1.f / 39916800.f);
+        for (float c : {1.f / 362880.f, -1.f / 5040.f, 1.f / 120.f, -1.f / 6.f, 1.f})
+            s = _mm256_fmadd_ps(s, r2, _mm256_set1_ps(c));
+        s = _mm256_mul_ps(s, r);
+
+        __m256 c = _mm256_set1_ps(1.f / 479001600.f);
+        for (float k : {-1.f / 3628800.f, 1.f / 40320.f, -1.f / 720.f, 1.f / 24.f, -1.f / 2.f, 1.f})
+            c = _mm256_fmadd_ps(c, r2, _mm256_set1_ps(k));
+
+        sin = _mm256_xor_ps(s, sign);
+        cos = _mm256_xor_ps(c, _mm256_and_ps(far, sign_mask));
+    }
+
+    // Box-Muller radius sqrt(-2 ln u) for u in (0, 1]
+    __m256 gaussian_radius(__m256i bits)
+    {
+        __m256 const u = _mm256_add_ps(to_unit(bits), _mm256_set1_ps(0x1p-24f));
+        return _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(-2.f), log8(u)));
+    }
+
+    __m256 angle(__m256i bits)
+    {
+        return _mm256_fmsub_ps(to_unit(bits), _mm256_set1_ps(2.f * pi), _mm256_set1_ps(pi));
+    }
+
+#else
+
+    float to_unit(std::uint32_t bits)
+    {
+        return (bits >> 8) * 0x1p-24f;
+    }
+
+    float gaussian_radius(std::uint32_t bits)
+    {
+        return std::sqrt(-2.f * std::log(to_unit(bits) + 0x1p-24f));
+    }
+
+    float angle(std::uint32_t bits)
+    {
+        return to_unit(bits) * (2.f * pi) - pi;
+    }
+
+#endif
+
+}
+
+void fill_uniform(philox_stream & stream, std::span<float> out, float min, float max)
+{
+    for_each_group<1>(stream, out.size(), [&](std::size_t offset, std::size_t count, std::uint32_t const * bits)
+    {
+#ifdef __AVX2__
+        // Multiply then add, like philox_stream::to_uniform
+        __m256 const value = _mm256_add_ps(_mm256_set1_ps(min),
+            _mm256_mul_ps(_mm256_set1_ps(max - min), to_unit(load(bits))));
+        store(out.data() + offset, value, count);
+#else
+        for (std::size_t i = 0; i < count; ++i)
+            out[offset + i] = philox_stream::to_uniform(bits[i], min, max);
+#endif
+    });
+}
+
+void fill_normal(philox_stream & stream, std::span<float> out, float mean, float deviation)
+{
+    // Every Box-Muller pair gives two samples: the cosines fill the first half of
+    // a group's outputs and the sines the second
+    std::size_t const pairs = (out.size() + 1) / 2;
+    for_each_group<2>(stream, pairs, [&](std::size_t offset, std::size_t count, std::uint32_t const * bits)
+    {
+        std::size_t const first = 2 * offset;
+        std::size_t const cos_count = std::min(count, out.size() - first);
+        std::size_t const sin_count = std::min(count, out.size() - first - cos_count);
+
+#ifdef __AVX2__
+        __m256 const radius = _mm256_mul_ps(gaussian_radius(load(bits)), _mm256_set1_ps(deviation));
+        __m256 sin, cos;
+        sincos8(angle(load(bits + group)), sin, cos);
+        store(out.data() + first, _mm256_fmadd_ps(radius, cos, _mm256_set1_ps(mean)), cos_count);
+        store(out.data() + first + cos_count, _mm256_fmadd_ps(radius, sin, _mm256_set1_ps(mean)), sin_count);
+#else
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            float const radius = gaussian_radius(bits[i]) * deviation;
+            float const a = angle(bits[group + i]);
+            if (i < cos_count)
+                out[first + i] = mean + radius * std::cos(a);
+            if (i < sin_count)
+                out[first + cos_count + i] = mean + radius * std::sin(a);
+        }
+#endif
+    });
+}
+
+void fill_unit_sphere(philox_stream & stream, std::span<float> x, std::span<float> y, std::span<float> z)
+{
+    // Archimedes: z is uniform in [-1, 1] for a uniform point on the sphere
+    fill_cone(stream, {0.f, 0.f, 1.f}, pi, x, y, z);
+}
+
+void fill_cone(philox_stream & stream, glm::vec3 const & axis, float max_angle,
+    std::span<float> x, std::span<float> y, std::span<float> z)
+{
+    glm::vec3 const w = glm::normalize(axis);
+    glm::vec3 u, v;
+    basis(w, u, v);
+
+    // The cosine of the angle to the axis is uniform over a spherical cap
+    float const min_cos = std::cos(std::min(max_angle, pi));
+
+    for_each_group<2>(stream, x.size(), [&](std::size_t offset, std::size_t count, std::uint32_t const * bits)
+    {
+#ifdef __AVX2__
+        __m256 const cos_theta = _mm256_add_ps(_mm256_set1_ps(min_cos),
+            _mm256_mul_ps(_mm256_set1_ps(1.f - min_cos), to_unit(load(bits))));
+        __m256 const sin_theta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(),
+            _mm256_fnmadd_ps(cos_theta, cos_theta, _mm256_set1_ps(1.f))));
+
+        __m256 sin_phi, cos_phi;
+        sincos8(angle(load(bits + group)), sin_phi, cos_phi);
+        __m256 const a = _mm256_mul_ps(sin_theta, cos_phi);
+        __m256 const b = _mm256_mul_ps(sin_theta, sin_phi);
+
+        auto component = [&](int i)
+        {
+            return _mm256_fmadd_ps(a, _mm256_set1_ps(u[i]),
+                _mm256_fmadd_ps(b, _mm256_set1_ps(v[i]), _mm256_mul_ps(cos_theta, _mm256_set1_ps(w[i]))));
+        };
+        store(x.data() + offset, component(0), count);
+        store(y.data() + offset, component(1), count);
+        store(z.data() + offset, component(2), count);
+#else
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            float const cos_theta = min_cos + (1.f - min_cos) * to_unit(bits[i]);
+            float const sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+            float const phi = angle(bits[group + i]);
+            glm::vec3 const d = sin_theta * std::cos(phi) * u + sin_theta * std::sin(phi) * v + cos_theta * w;
+            x[offset + i] = d.x;
+            y[offset + i] = d.y;
+            z[offset + i] = d.z;
+        }
+#endif
+    });
+}
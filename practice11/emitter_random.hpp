@@ -0,0 +1,22 @@
+#pragma once
+
+#include <span>
+
+#include <glm/vec3.hpp>
+
+#include "philox.hpp"
+
+// Batches of random samples for emitters. Every function draws its random bits
+// in bulk from the stream and converts eight samples at a time with AVX2.
+// Vector outputs are split per component to match particle_system's streams.
+
+void fill_uniform(philox_stream & stream, std::span<float> out, float min, float max);
+
+void fill_normal(philox_stream & stream, std::span<float> out, float mean, float deviation);
+
+// Directions uniformly distributed over the unit sphere
+void fill_unit_sphere(philox_stream & stream, std::span<float> x, std::span<float> y, std::span<float> z);
+
+// Directions at most `max_angle` radians away from `axis`, uniform over that cap
+void fill_cone(philox_stream & stream, glm::vec3 const & axis, float max_angle,
+    std::span<float> x, std::span<float> y, std::span<float> z);
@@ -0,0 +1,124 @@
+#include "fluid_benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+fluid_benchmark_options parse_fluid_benchmark_options(int argc, char ** argv)
+{
+    fluid_benchmark_options result;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--fluid")
+        {
+            std::string const mode = value();
+            if (mode == "sph")
+                result.simulation = particle_fluid::mode::sph;
+            else if (mode == "boids")
+                result.simulation = particle_fluid::mode::boids;
+            else
+                throw std::runtime_error("Expected --fluid sph or --fluid boids");
+        }
+        else if (arg == "--particles")
+            result.particles = std::stoul(value());
+        else if (arg == "--steps")
+            result.steps = std::stoi(value());
+        else if (arg == "--timestep")
+            result.timestep = std::stof(value());
+        else if (arg == "--threads")
+            result.threads = std::stoul(value());
+        else if (arg == "--output")
+            result.output = value();
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (!(result.timestep > 0.f))
+        throw std::runtime_error("--timestep must be positive");
+    if (result.steps <= 0)
+        throw std::runtime_error("--steps must be positive");
+
+    return result;
+}
+
+void run_fluid_benchmark(fluid_benchmark_options const & options)
+{
+    thread_pool pool(options.threads ? options.threads : std::thread::hardware_concurrency());
+    particle_fluid fluid(*options.simulation, options.particles);
+
+    std::vector<double> step_ms;
+    for (int step = 0; step < options.steps; ++step)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        fluid.step(options.timestep, pool);
+        step_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // A summary of the final state, so that runs with different thread counts
+    // or builds can be checked against each other
+    double speed = 0.0;
+    double density = 0.0;
+    for (std::size_t i = 0; i < fluid.particle_count(); ++i)
+    {
+        speed += std::sqrt(fluid.velocity_x[i] * fluid.velocity_x[i] + fluid.velocity_y[i] * fluid.velocity_y[i]
+            + fluid.velocity_z[i] * fluid.velocity_z[i]);
+        density += fluid.density[i];
+    }
+    speed /= fluid.particle_count();
+    density /= fluid.particle_count();
+
+    std::vector<double> sorted = step_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0.0;
+    for (double ms : sorted)
+        mean += ms;
+    mean /= sorted.size();
+    double const median = sorted[sorted.size() / 2];
+
+    char const * const name = *options.simulation == particle_fluid::mode::sph ? "sph" : "boids";
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << name << ": " << fluid.particle_count() << " particles, " << step_ms.size() << " steps of "
+        << options.timestep << " s on " << pool.size() << " threads\n";
+    std::cout << "ms per step\tmean " << mean << "\tp50 " << median << "\tmin " << sorted.front() << "\tmax "
+        << sorted.back() << '\n';
+    std::cout << "particle steps per second\t" << std::setprecision(0) << fluid.particle_count() / mean * 1e3 << '\n';
+    std::cout << std::setprecision(6) << "mean speed\t" << speed << "\nmean density\t" << density << '\n';
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (!options.output)
+        return;
+
+    std::ofstream out(*options.output);
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "\"mode\": \"" << name << "\",\n";
+    out << "\"particles\": " << fluid.particle_count() << ",\n";
+    out << "\"threads\": " << pool.size() << ",\n";
+    out << "\"timestep\": " << options.timestep << ",\n";
+    out << "\"steps\": " << step_ms.size() << ",\n";
+    out << "\"mean_ms\": " << mean << ",\n";
+    out << "\"p50_ms\": " << median << ",\n";
+    out << "\"mean_speed\": " << speed << ",\n";
+    out << "\"mean_density\": " << density << ",\n";
+    out << "\"step_ms\": [";
+    for (std::size_t i = 0; i < step_ms.size(); ++i)
+        out << (i ? ", " : "") << step_ms[i];
+    out << "]\n}\n";
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+#include "particle_fluid.hpp"
+
+struct fluid_benchmark_options
+{
+    // Runs the headless benchmark instead of the viewer when given
+    std::optional<particle_fluid::mode> simulation;
+    std::optional<std::filesystem::path> output;
+    std::size_t particles = 100000;
+    int steps = 200;
+    float timestep = 1.f / 500.f;
+    // All hardware threads by default
+    std::size_t threads = 0;
+};
+
+// --fluid <sph|boids> [--particles <n>] [--steps <n>] [--timestep <s>] [--threads <n>] [--output <json>]
+fluid_benchmark_options parse_fluid_benchmark_options(int argc, char ** argv);
+
+// Runs the simulation for a fixed number of fixed timesteps without a window,
+// then prints the step times and writes them to options.output if given
+void run_fluid_benchmark(fluid_benchmark_options const & options);
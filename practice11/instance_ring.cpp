@@ -0,0 +1,82 @@
+#include "instance_ring.hpp"
+
+#include <stdexcept>
+
+instance_ring::instance_ring(std::size_t region_size)
+    : region_size(region_size)
+    , persistent(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)
+{
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    if (persistent)
+    {
+        GLbitfield const flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, region_size * region_count, nullptr, flags);
+        mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, region_size * region_count, flags);
+        if (!mapping)
+            throw std::runtime_error("Failed to map the instance buffer");
+    }
+    else
+        glBufferData(GL_ARRAY_BUFFER, region_size * region_count, nullptr, GL_STREAM_DRAW);
+}
+
+instance_ring::~instance_ring()
+{
+    for (auto fence : fences)
+        if (fence)
+            glDeleteSync(fence);
+
+    if (persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+void * instance_ring::begin_frame()
+{
+    if (persistent)
+    {
+        // Everything reading the current region was issued in the previous frame
+        if (used)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        used = true;
+        region = (region + 1) % region_count;
+
+        // The GPU is at most region_count - 1 frames behind, so this rarely blocks
+        if (GLsync & fence = fences[region])
+        {
+            GLbitfield flags = 0;
+            while (glClientWaitSync(fence, flags, 1'000'000) == GL_TIMEOUT_EXPIRED)
+                flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        return static_cast<char *>(mapping) + offset();
+    }
+
+    region = (region + 1) % region_count;
+
+    // The regions only matter for the offsets here: orphaning gives fresh storage
+    // while the GPU keeps reading the old one
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, region_size * region_count, nullptr, GL_STREAM_DRAW);
+    return glMapBufferRange(GL_ARRAY_BUFFER, offset(), region_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void instance_ring::end_frame()
+{
+    if (persistent)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+std::size_t instance_ring::offset() const
+{
+    return region * region_size;
+}
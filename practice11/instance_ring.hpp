@@ -0,0 +1,43 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstddef>
+
+// Streaming buffer for per-instance data, split into regions that are written
+// in turn so the CPU never waits for the GPU to finish reading the region it
+// is about to fill. With GL 4.4 or ARB_buffer_storage the whole buffer stays
+// mapped and every region is guarded by a fence; otherwise the buffer is
+// orphaned and mapped again every frame, leaving the synchronization to the
+// driver.
+struct instance_ring
+{
+    static constexpr int region_count = 3;
+
+    // region_size is the largest number of bytes written in one frame
+    explicit instance_ring(std::size_t region_size);
+    ~instance_ring();
+
+    instance_ring(instance_ring const &) = delete;
+    instance_ring & operator = (instance_ring const &) = delete;
+
+    // Returns the memory of the next region, valid until end_frame(). The draw
+    // calls reading the previous region must have been issued by then.
+    void * begin_frame();
+    // Makes the written data visible to the draw calls that follow
+    void end_frame();
+
+    // Byte offset of the current region in buffer
+    std::size_t offset() const;
+
+    GLuint buffer = 0;
+    std::size_t region_size;
+    bool persistent;
+
+private:
+    int region = 0;
+    bool used = false;
+    void * mapping = nullptr;
+    std::array<GLsync, region_count> fences{};
+};
@@ -7,11 +7,11 @@
 
 #include <GL/glew.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <iostream>
 #include <map>
-#include <random>
 #include <stdexcept>
 #include <string_view>
 #include <vector>
@@ -27,7 +27,13 @@
 #include <glm/vec3.hpp>
 
 #include "obj_parser.hpp"
+#include "depth_sort.hpp"
+#include "emitter_benchmark.hpp"
+#include "fluid_benchmark.hpp"
+#include "instance_ring.hpp"
+#include "particle_effect.hpp"
 #include "stb_image.h"
+#include "thread_pool.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -48,17 +54,19 @@ void glew_fail(std::string_view message, GLenum error)
 const char vertex_shader_source[] =
     R"(#version 330 core
 
+uniform float max_size;
+
 layout (location = 0) in vec3 in_position;
-layout (location = 1) in float in_size;
-layout (location = 2) in float in_rotation;
+// Fractions of max_size and of a full turn
+layout (location = 1) in vec2 in_size_rotation;
 
 out float size;
 out float rotation;
 
 void main()
 {
-    size = in_size;
-    rotation = in_rotation;
+    size = in_size_rotation.x * max_size;
+    rotation = in_size_rotation.y * 6.28318530718;
     gl_Position = vec4(in_position, 1.0);
 }
 )";
@@ -206,32 +214,22 @@ GLuint load_texture(std::string const &path)
   return result;
 }
 
-struct particle
+int main(int argc, char **argv)
+try
 {
-  glm::vec3 position;
-  glm::vec3 velocity{1.f, 1.f, 1.f};
-  float size{.2f};
-  float rotation{.0f};
-  float angular_velocity{2.2f};
-  float ceiling_height;
-
-  particle(std::default_random_engine &engine)
+  // --emitter-bench checks and times the emitter samples headless and exits
+  auto const emitter_options = parse_emitter_benchmark_options(argc, argv);
+  if (emitter_options.enabled)
+    return run_emitter_benchmark(emitter_options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  // --fluid runs the interacting particles headless and exits
+  auto const fluid_options = parse_fluid_benchmark_options(argc, argv);
+  if (fluid_options.simulation)
   {
-    position.x = std::uniform_real_distribution<float>{-10.f, 10.f}(engine);
-    position.y = -1.f;
-    position.z = std::uniform_real_distribution<float>{-10.f, 10.f}(engine);
-    size = std::uniform_real_distribution<float>{0.1, 0.5}(engine);
-    velocity.x = std::uniform_real_distribution<float>{-1.2, 1.2}(engine);
-    velocity.y = std::uniform_real_distribution<float>{0.3, 4}(engine);
-    velocity.z = std::uniform_real_distribution<float>{-1.2, 1.2}(engine);
-    angular_velocity = std::uniform_real_distribution<float>{0.1, 2.0}(engine);
-    ceiling_height = std::uniform_real_distribution<float>{5, 15}(engine);
+    run_fluid_benchmark(fluid_options);
+    return EXIT_SUCCESS;
   }
-};
 
-int main()
-try
-{
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     sdl2_fail("SDL_Init: ");
 
@@ -282,30 +280,40 @@ try
       glGetUniformLocation(program, "camera_position");
   GLuint sampler_location = glGetUniformLocation(program, "sampler");
   GLuint sampler1d_location = glGetUniformLocation(program, "sampler1d");
+  GLuint max_size_location = glGetUniformLocation(program, "max_size");
+
+  thread_pool pool;
+
+  const std::string project_root = PROJECT_ROOT;
+
+  auto const library = load_effects(project_root + "/effects/fountain.json");
+  effect_system effects(library);
+  if (library.collider)
+    effects.collider = bake_collider(*library.collider, pool);
 
-  std::default_random_engine rng;
+  // Particles are drawn back to front through the sorted indices
+  depth_sorter sorter;
 
-  const auto particle_count = 256000;
-  std::vector<particle> particles;
+  // The simulation writes the packed particles straight into the next region of
+  // the vertex ring, the sorted indices go through a ring of their own
+  auto vertices =
+      instance_ring{effects.capacity() * sizeof(packed_particle)};
+  auto indices = instance_ring{effects.capacity() * sizeof(std::uint32_t)};
 
-  GLuint vao, vbo;
+  GLuint vao;
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
 
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
+  glBindBuffer(GL_ARRAY_BUFFER, vertices.buffer);
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle),
-                        (void *)offsetof(particle, position));
+  glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(packed_particle),
+                        (void *)offsetof(packed_particle, position));
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle),
-                        (void *)offsetof(particle, size));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle),
-                        (void *)offsetof(particle, rotation));
+  glVertexAttribPointer(1, 2, GL_UNSIGNED_BYTE, GL_TRUE,
+                        sizeof(packed_particle),
+                        (void *)offsetof(packed_particle, size));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
 
-  const std::string project_root = PROJECT_ROOT;
   const std::string particle_texture_path = project_root + "/particle.png";
 
   GLuint particle_texture = load_texture(particle_texture_path);
@@ -338,10 +346,6 @@ try
 
   float camera_rotation = 0.f;
 
-  const auto A = 0.2f;
-  const auto C = 0.1f;
-  const auto D = 0.001f;
-
   bool paused = false;
   bool running = true;
   while (running)
@@ -394,8 +398,8 @@ try
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glDisable(GL_DEPTH_TEST);
-    //    glEnable(GL_BLEND);
-    //    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     float near = 0.1f;
     float far = 100.f;
@@ -412,30 +416,24 @@ try
 
     glm::vec3 camera_position =
         (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
+    glm::vec3 camera_forward =
+        (glm::inverse(view) * glm::vec4(0.f, 0.f, -1.f, 0.f)).xyz();
 
+    // Every effect spawns within the budget first, so that the update packs the
+    // new particles as well
+    auto packed = static_cast<packed_particle *>(vertices.begin_frame());
     if (!paused)
-    {
-      for (auto &p : particles)
-      {
-        p.velocity.y += dt * A;
-        p.position += dt * p.velocity;
-        p.velocity *= exp(-C * dt);
-        p.size *= exp(-D * dt);
-        p.rotation += dt * p.angular_velocity;
-
-        if (p.position.y > p.ceiling_height)
-          p = particle{rng};
-      }
-
-      if (particles.size() < particle_count)
-        //        for (int i = 0; i < 100; i++)
-        particles.emplace_back(particle{rng});
-    }
+      effects.update(dt, pool, packed);
+    else
+      effects.pack(packed, pool);
+    vertices.end_frame();
     if (paused)
-      std::cout << particles.size() << std::endl;
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle),
-                 particles.data(), GL_STATIC_DRAW);
+      std::cout << effects.particle_count() << std::endl;
+
+    sorter.sort(effects, camera_position, camera_forward, pool);
+    std::copy(sorter.order.begin(), sorter.order.end(),
+              static_cast<std::uint32_t *>(indices.begin_frame()));
+    indices.end_frame();
 
     glUseProgram(program);
 
@@ -450,6 +448,7 @@ try
 
     glUniform1i(sampler_location, 0);
     glUniform1i(sampler1d_location, 1);
+    glUniform1f(max_size_location, packed_particle::max_size);
 
     glBindVertexArray(vao);
 
@@ -458,7 +457,9 @@ try
     glBindTexture(GL_TEXTURE_1D, texture);
     glActiveTexture(GL_TEXTURE0);
 
-    glDrawArrays(GL_POINTS, 0, particles.size());
+    glDrawElementsBaseVertex(GL_POINTS, sorter.order.size(), GL_UNSIGNED_INT,
+                             (void *)indices.offset(),
+                             vertices.offset() / sizeof(packed_particle));
 
     SDL_GL_SwapWindow(window);
   }
@@ -0,0 +1,155 @@
+#include "neighbor_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    // Particles are counted and scattered in tiles of at least this size, one
+    // histogram per tile. Every histogram has a counter per bucket and there are
+    // as many buckets as particles, so there are never more tiles than threads.
+    constexpr std::size_t min_tile_size = 1 << 14;
+
+    // Buckets per task of the prefix sum
+    constexpr std::size_t block_size = 1 << 12;
+
+    std::int32_t cell_coordinate(float x, float inverse_cell_size)
+    {
+        return std::int32_t(std::floor(x * inverse_cell_size));
+    }
+
+}
+
+neighbor_grid::neighbor_grid(float cell_size)
+    : cell_size(cell_size)
+    , inverse_cell_size(1.f / cell_size)
+{}
+
+std::uint32_t neighbor_grid::bucket(std::int32_t x, std::int32_t y, std::int32_t z) const
+{
+    // The primes of Teschner et al., "Optimized Spatial Hashing for Collision
+    // Detection of Deformable Objects"
+    return ((std::uint32_t(x) * 73856093u) ^ (std::uint32_t(y) * 19349663u) ^ (std::uint32_t(z) * 83492791u))
+        & bucket_mask;
+}
+
+void neighbor_grid::build(std::span<float const> x, std::span<float const> y, std::span<float const> z,
+    thread_pool & pool)
+{
+    std::size_t const count = x.size();
+
+    // At least as many buckets as particles keeps unrelated cells from sharing
+    // a bucket most of the time
+    std::size_t buckets = 1024;
+    while (buckets < count)
+        buckets *= 2;
+    bucket_mask = buckets - 1;
+
+    std::size_t const tiles = std::max<std::size_t>(1, std::min(pool.size(), count / min_tile_size));
+    std::size_t const tile_size = (count + tiles - 1) / tiles;
+    particle_bucket.resize(count);
+    order.resize(count);
+    bucket_start.resize(buckets + 1);
+    histograms.resize(tiles * buckets);
+
+    pool.parallel_for(tiles, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t tile = first; tile < last; ++tile)
+        {
+            std::uint32_t * const h = histograms.data() + tile * buckets;
+            std::fill_n(h, buckets, 0);
+
+            std::size_t const end = std::min(count, (tile + 1) * tile_size);
+            for (std::size_t i = tile * tile_size; i < end; ++i)
+            {
+                auto const [cx, cy, cz] = cell(x[i], y[i], z[i]);
+                std::uint32_t const b = bucket(cx, cy, cz);
+                particle_bucket[i] = b;
+                ++h[b];
+            }
+        }
+    });
+
+    // Exclusive prefix sum in bucket-major order gives every tile its write
+    // position for every bucket, which keeps the sort stable. Blocks of buckets
+    // are summed in parallel, then offset by the totals of the blocks before them.
+    std::size_t const blocks = (buckets + block_size - 1) / block_size;
+    block_start.resize(blocks);
+    pool.parallel_for(blocks, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t block = first; block < last; ++block)
+        {
+            std::uint32_t sum = 0;
+            for (std::size_t tile = 0; tile < tiles; ++tile)
+            {
+                std::uint32_t const * const h = histograms.data() + tile * buckets;
+                for (std::size_t b = block * block_size; b < std::min(buckets, (block + 1) * block_size); ++b)
+                    sum += h[b];
+            }
+            block_start[block] = sum;
+        }
+    });
+
+    std::uint32_t total = 0;
+    for (auto & start : block_start)
+    {
+        std::uint32_t const n = start;
+        start = total;
+        total += n;
+    }
+
+    pool.parallel_for(blocks, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t block = first; block < last; ++block)
+        {
+            std::uint32_t sum = block_start[block];
+            for (std::size_t b = block * block_size; b < std::min(buckets, (block + 1) * block_size); ++b)
+            {
+                bucket_start[b] = sum;
+                for (std::size_t tile = 0; tile < tiles; ++tile)
+                {
+                    std::uint32_t & h = histograms[tile * buckets + b];
+                    std::uint32_t const n = h;
+                    h = sum;
+                    sum += n;
+                }
+            }
+        }
+    });
+    bucket_start[buckets] = count;
+
+    pool.parallel_for(tiles, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t tile = first; tile < last; ++tile)
+        {
+            std::uint32_t * const position = histograms.data() + tile * buckets;
+            std::size_t const end = std::min(count, (tile + 1) * tile_size);
+            for (std::size_t i = tile * tile_size; i < end; ++i)
+                order[position[particle_bucket[i]]++] = i;
+        }
+    });
+}
+
+neighbor_grid::cell_index neighbor_grid::cell(float x, float y, float z) const
+{
+    return {cell_coordinate(x, inverse_cell_size), cell_coordinate(y, inverse_cell_size),
+        cell_coordinate(z, inverse_cell_size)};
+}
+
+neighbor_grid::neighborhood neighbor_grid::around(cell_index const & cell) const
+{
+    auto const [cx, cy, cz] = cell;
+
+    neighborhood result;
+    for (std::int32_t dz = -1; dz <= 1; ++dz)
+        for (std::int32_t dy = -1; dy <= 1; ++dy)
+            for (std::int32_t dx = -1; dx <= 1; ++dx)
+            {
+                std::uint32_t const b = bucket(cx + dx, cy + dy, cz + dz);
+                if (std::find(result.buckets.begin(), result.buckets.begin() + result.count, b)
+                    == result.buckets.begin() + result.count)
+                    result.buckets[result.count++] = b;
+            }
+    return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// Neighbour search over a uniform grid of cubic cells, stored as a spatial hash
+// so that the particles need no bounding box. Every step the particles are
+// counting-sorted by the bucket of their cell; the particles of a bucket are
+// then one contiguous range of `order`.
+//
+// The sort is stable and the same for any thread count, so a simulation that
+// reorders its particles by `order` stays deterministic.
+struct neighbor_grid
+{
+    using cell_index = std::array<std::int32_t, 3>;
+
+    // At most 27 buckets around a cell, repeated buckets listed once
+    struct neighborhood
+    {
+        std::array<std::uint32_t, 27> buckets;
+        int count = 0;
+    };
+
+    explicit neighbor_grid(float cell_size = 1.f);
+
+    void build(std::span<float const> x, std::span<float const> y, std::span<float const> z, thread_pool & pool);
+
+    cell_index cell(float x, float y, float z) const;
+
+    // Buckets of a cell and of its 26 neighbours, which hold every particle
+    // within `cell_size` of any point in the cell, and possibly others
+    neighborhood around(cell_index const & cell) const;
+
+    std::uint32_t begin(std::uint32_t bucket) const { return bucket_start[bucket]; }
+    std::uint32_t end(std::uint32_t bucket) const { return bucket_start[bucket + 1]; }
+
+    float cell_size;
+
+    // Particle indices sorted by bucket
+    std::vector<std::uint32_t> order;
+    // First position in `order` of every bucket, with the particle count appended
+    std::vector<std::uint32_t> bucket_start;
+
+private:
+    float inverse_cell_size;
+    std::uint32_t bucket_mask = 0;
+
+    std::vector<std::uint32_t> particle_bucket;
+    std::vector<std::uint32_t> histograms;
+    std::vector<std::uint32_t> block_start;
+
+    std::uint32_t bucket(std::int32_t x, std::int32_t y, std::int32_t z) const;
+};
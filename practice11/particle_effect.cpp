@@ -0,0 +1,302 @@
+#include "particle_effect.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+
+#include "emitter_random.hpp"
+
+namespace
+{
+
+    float read_float(rapidjson::Value const & object, char const * name, float fallback)
+    {
+        return object.HasMember(name) ? object[name].GetFloat() : fallback;
+    }
+
+    glm::vec3 read_vec3(rapidjson::Value const & value)
+    {
+        if (!value.IsArray() || value.Size() != 3)
+            throw std::runtime_error("Expected an array of three numbers in the effect file");
+        return {value[0].GetFloat(), value[1].GetFloat(), value[2].GetFloat()};
+    }
+
+    // Either a single number or [min, max]
+    value_range read_range(rapidjson::Value const & object, char const * name, value_range fallback)
+    {
+        if (!object.HasMember(name))
+            return fallback;
+
+        auto const & value = object[name];
+        if (value.IsNumber())
+            return {value.GetFloat(), value.GetFloat()};
+        if (!value.IsArray() || value.Size() != 2)
+            throw std::runtime_error(std::string("Expected a number or [min, max] for ") + name);
+        return {value[0].GetFloat(), value[1].GetFloat()};
+    }
+
+    // Either a single number or an array of [age, value] points
+    particle_curve read_curve(rapidjson::Value const & object, char const * name)
+    {
+        if (!object.HasMember(name))
+            return {};
+
+        auto const & value = object[name];
+        if (value.IsNumber())
+            return {value.GetFloat()};
+
+        std::vector<std::pair<float, float>> points;
+        for (auto const & point : value.GetArray())
+            points.emplace_back(point[0].GetFloat(), point[1].GetFloat());
+        if (points.empty())
+            throw std::runtime_error(std::string("Empty curve ") + name);
+        std::sort(points.begin(), points.end());
+        return particle_curve{points};
+    }
+
+    emitter_description read_emitter(rapidjson::Value const & object)
+    {
+        emitter_description result;
+        result.name = object.HasMember("name") ? object["name"].GetString() : "";
+        result.rate = read_float(object, "rate", 0.f);
+
+        if (object.HasMember("position"))
+        {
+            auto const & position = object["position"];
+            result.position_min = read_vec3(position["min"]);
+            result.position_max = read_vec3(position["max"]);
+        }
+
+        if (object.HasMember("velocity"))
+        {
+            auto const & velocity = object["velocity"];
+            if (velocity.HasMember("cone"))
+            {
+                auto const & cone = velocity["cone"];
+                result.velocity = emitter_description::velocity_shape::cone;
+                result.cone_axis = read_vec3(cone["axis"]);
+                result.cone_angle = read_float(cone, "angle", 0.f);
+                result.speed = read_range(cone, "speed", {});
+            }
+            else
+            {
+                result.velocity_min = read_vec3(velocity["min"]);
+                result.velocity_max = read_vec3(velocity["max"]);
+            }
+        }
+
+        result.lifetime = read_range(object, "lifetime", result.lifetime);
+        result.size = read_range(object, "size", result.size);
+        result.angular_velocity = read_range(object, "angular_velocity", result.angular_velocity);
+        result.ceiling = read_range(object, "ceiling", result.ceiling);
+
+        result.parameters.lift = read_float(object, "lift", 0.f);
+        result.parameters.drag = read_float(object, "drag", 0.f);
+        result.parameters.bounce = read_float(object, "bounce", result.parameters.bounce);
+        result.parameters.size = read_curve(object, "size_curve");
+
+        if (result.lifetime.min <= 0.f)
+            throw std::runtime_error("Emitter " + result.name + " needs a positive lifetime");
+
+        return result;
+    }
+
+}
+
+effect_library load_effects(std::filesystem::path const & path)
+{
+    rapidjson::Document document;
+
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input)
+            throw std::runtime_error("Failed to open effects " + path.string());
+        rapidjson::IStreamWrapper stream(input);
+        document.ParseStream(stream);
+    }
+
+    if (document.HasParseError())
+        throw std::runtime_error("Failed to parse effects " + path.string());
+
+    effect_library result;
+    for (auto const & effect : document["effects"].GetArray())
+    {
+        auto & description = result.effects.emplace_back();
+        description.name = effect["name"].GetString();
+        description.capacity = effect["capacity"].GetUint();
+        for (auto const & emitter : effect["emitters"].GetArray())
+            description.emitters.push_back(read_emitter(emitter));
+    }
+
+    if (document.HasMember("budget"))
+        result.budget = document["budget"].GetUint();
+
+    if (document.HasMember("collider"))
+    {
+        auto const & collider = document["collider"];
+        auto & description = result.collider.emplace();
+        description.mesh = path.parent_path() / collider["mesh"].GetString();
+        description.resolution = collider.HasMember("resolution") ? collider["resolution"].GetInt() : 64;
+        description.scale = read_float(collider, "scale", 1.f);
+        if (collider.HasMember("offset"))
+            description.offset = read_vec3(collider["offset"]);
+    }
+
+    return result;
+}
+
+signed_distance_field bake_collider(collider_description const & description, thread_pool & pool)
+{
+    obj_data mesh = parse_obj(description.mesh);
+    for (auto & vertex : mesh.vertices)
+        for (int c = 0; c < 3; ++c)
+            vertex.position[c] = vertex.position[c] * description.scale + description.offset[c];
+    return bake_sdf(mesh, description.resolution, pool);
+}
+
+particle_effect::particle_effect(effect_description description, std::uint64_t seed)
+    : description(std::move(description))
+    , particles(this->description.capacity)
+{
+    for (std::size_t i = 0; i < this->description.emitters.size(); ++i)
+    {
+        parameters.push_back(this->description.emitters[i].parameters);
+        random.emplace_back(seed, i);
+    }
+    accumulated.assign(parameters.size(), 0.f);
+    requests.assign(parameters.size(), 0);
+}
+
+std::size_t particle_effect::requested(float dt)
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < requests.size(); ++i)
+    {
+        accumulated[i] += description.emitters[i].rate * dt;
+        requests[i] = accumulated[i];
+        accumulated[i] -= requests[i];
+        total += requests[i];
+    }
+    return total;
+}
+
+void particle_effect::spawn(std::size_t allowed)
+{
+    std::size_t total = 0;
+    for (auto n : requests)
+        total += n;
+
+    // Particles that were denied are dropped rather than queued, so an effect
+    // over budget does not burst once there is room again
+    for (std::size_t i = 0; i < requests.size(); ++i)
+        emit(i, allowed >= total ? requests[i] : requests[i] * allowed / total);
+}
+
+void particle_effect::emit(std::size_t index, std::size_t n)
+{
+    emitter_description const & e = description.emitters[index];
+    std::size_t const first = particles.allocate(n, index);
+    if (n == 0)
+        return;
+
+    philox_stream & stream = random[index];
+    auto range = [&](particle_stream & s){ return std::span<float>(s.data() + first, n); };
+
+    fill_uniform(stream, range(particles.position_x), e.position_min.x, e.position_max.x);
+    fill_uniform(stream, range(particles.position_y), e.position_min.y, e.position_max.y);
+    fill_uniform(stream, range(particles.position_z), e.position_min.z, e.position_max.z);
+
+    if (e.velocity == emitter_description::velocity_shape::cone)
+    {
+        fill_cone(stream, e.cone_axis, e.cone_angle,
+            range(particles.velocity_x), range(particles.velocity_y), range(particles.velocity_z));
+
+        // The size stream is recomputed by the next update, until then it holds the speeds
+        auto const speed = range(particles.size);
+        fill_uniform(stream, speed, e.speed.min, e.speed.max);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            particles.velocity_x[first + i] *= speed[i];
+            particles.velocity_y[first + i] *= speed[i];
+            particles.velocity_z[first + i] *= speed[i];
+        }
+    }
+    else
+    {
+        fill_uniform(stream, range(particles.velocity_x), e.velocity_min.x, e.velocity_max.x);
+        fill_uniform(stream, range(particles.velocity_y), e.velocity_min.y, e.velocity_max.y);
+        fill_uniform(stream, range(particles.velocity_z), e.velocity_min.z, e.velocity_max.z);
+    }
+
+    fill_uniform(stream, range(particles.base_size), e.size.min, e.size.max);
+    fill_uniform(stream, range(particles.angular_velocity), e.angular_velocity.min, e.angular_velocity.max);
+    fill_uniform(stream, range(particles.lifetime), e.lifetime.min, e.lifetime.max);
+    fill_uniform(stream, range(particles.ceiling_height), e.ceiling.min, e.ceiling.max);
+
+    float const initial_size = e.parameters.size(0.f);
+    for (std::size_t i = first; i < first + n; ++i)
+        particles.size[i] = particles.base_size[i] * initial_size;
+}
+
+effect_system::effect_system(effect_library library, std::uint64_t seed)
+{
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < library.effects.size(); ++i)
+    {
+        // Every effect gets its own Philox key
+        effects.emplace_back(std::move(library.effects[i]), seed + i * 0x9E3779B97F4A7C15ull);
+        offsets.push_back(offset);
+        offset += effects.back().particles.capacity();
+    }
+
+    // Pools are rounded up to whole batches, the default budget covers all of them
+    budget = library.budget.value_or(offset);
+    wanted.reserve(effects.size());
+}
+
+void effect_system::update(float dt, thread_pool & pool, packed_particle * render)
+{
+    std::size_t const alive = particle_count();
+    std::size_t const allowance = budget > alive ? budget - alive : 0;
+
+    wanted.clear();
+    std::size_t total = 0;
+    for (auto & effect : effects)
+    {
+        auto const & particles = effect.particles;
+        wanted.push_back(std::min(effect.requested(dt), particles.capacity() - particles.particle_count()));
+        total += wanted.back();
+    }
+
+    // Over budget every effect gets the same share of what it asked for
+    for (std::size_t i = 0; i < effects.size(); ++i)
+    {
+        auto & effect = effects[i];
+        effect.spawn(total <= allowance ? wanted[i] : wanted[i] * allowance / total);
+        effect.particles.update(dt, effect.parameters, pool, render ? render + offsets[i] : nullptr,
+            collider ? &*collider : nullptr);
+    }
+}
+
+void effect_system::pack(packed_particle * render, thread_pool & pool) const
+{
+    for (std::size_t i = 0; i < effects.size(); ++i)
+        effects[i].particles.pack(render + offsets[i], pool);
+}
+
+std::size_t effect_system::capacity() const
+{
+    return effects.empty() ? 0 : offsets.back() + effects.back().particles.capacity();
+}
+
+std::size_t effect_system::particle_count() const
+{
+    std::size_t result = 0;
+    for (auto const & effect : effects)
+        result += effect.particles.particle_count();
+    return result;
+}
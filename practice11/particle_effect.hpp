@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "particle_system.hpp"
+#include "philox.hpp"
+#include "signed_distance_field.hpp"
+#include "thread_pool.hpp"
+
+// Uniformly distributed value in [min, max]
+struct value_range
+{
+    float min = 0.f;
+    float max = 0.f;
+};
+
+struct emitter_description
+{
+    enum class velocity_shape
+    {
+        // Every component uniform between velocity_min and velocity_max
+        box,
+        // Uniform direction within cone_angle of cone_axis, times a uniform speed
+        cone,
+    };
+
+    std::string name;
+
+    // Particles per second
+    float rate = 0.f;
+
+    // Spawn positions are uniform in this box
+    glm::vec3 position_min{0.f};
+    glm::vec3 position_max{0.f};
+
+    velocity_shape velocity = velocity_shape::box;
+    glm::vec3 velocity_min{0.f};
+    glm::vec3 velocity_max{0.f};
+    glm::vec3 cone_axis{0.f, 1.f, 0.f};
+    float cone_angle = 0.f;
+    value_range speed;
+
+    value_range lifetime{1.f, 1.f};
+    value_range size{0.1f, 0.1f};
+    value_range angular_velocity;
+    // Particles also die once they rise above a height drawn from this range
+    value_range ceiling{1e30f, 1e30f};
+
+    particle_system::emitter_parameters parameters;
+};
+
+struct effect_description
+{
+    std::string name;
+    // Most particles alive at once, all emitters of the effect together
+    std::size_t capacity = 0;
+    std::vector<emitter_description> emitters;
+};
+
+// A mesh that the particles of every effect collide with
+struct collider_description
+{
+    std::filesystem::path mesh;
+    // Distance field grid points along the longest side of the mesh
+    int resolution = 64;
+    // Applied to the mesh before baking, scale first
+    float scale = 1.f;
+    glm::vec3 offset{0.f};
+};
+
+struct effect_library
+{
+    // Most particles alive at once over all effects, without one every effect
+    // may fill its pool
+    std::optional<std::size_t> budget;
+    std::vector<effect_description> effects;
+    std::optional<collider_description> collider;
+};
+
+// Reads a JSON effect file, see effects/fountain.json for the format. Mesh
+// paths are relative to the effect file.
+effect_library load_effects(std::filesystem::path const & path);
+
+signed_distance_field bake_collider(collider_description const & description, thread_pool & pool);
+
+// One running effect: its emitters and the pool all of them spawn into
+struct particle_effect
+{
+    particle_effect(effect_description description, std::uint64_t seed);
+
+    // How many particles the emitters want to spawn after dt, fractions carry over
+    std::size_t requested(float dt);
+    // Spawns `allowed` of the requested particles, spread over the emitters in
+    // proportion to their requests
+    void spawn(std::size_t allowed);
+
+    effect_description description;
+    particle_system particles;
+    std::vector<particle_system::emitter_parameters> parameters;
+
+private:
+    std::vector<float> accumulated;
+    std::vector<std::size_t> requests;
+    std::vector<philox_stream> random;
+
+    void emit(std::size_t emitter, std::size_t n);
+};
+
+// All running effects, drawn as one set of packed particles where every effect
+// owns a fixed range of `capacity()` entries
+struct effect_system
+{
+    effect_system(effect_library library, std::uint64_t seed = 0);
+
+    // Spawns within the global budget and advances every effect by dt, writing
+    // the packed particles to `render` if given
+    void update(float dt, thread_pool & pool, packed_particle * render = nullptr);
+    void pack(packed_particle * render, thread_pool & pool) const;
+
+    std::size_t capacity() const;
+    std::size_t particle_count() const;
+
+    std::size_t budget;
+    std::vector<particle_effect> effects;
+    std::optional<signed_distance_field> collider;
+    // Index of every effect's first entry in the packed particles
+    std::vector<std::size_t> offsets;
+
+private:
+    // Spawn requests of the current update, one per effect
+    std::vector<std::size_t> wanted;
+};
@@ -0,0 +1,497 @@
+#include "particle_fluid.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "emitter_random.hpp"
+#include "philox.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+    constexpr float pi = 3.14159265358979f;
+
+    // Particles per task of every pass
+    constexpr std::size_t grain = 1024;
+
+    // Neighbours boids are placed to see on average
+    constexpr float mean_boid_neighbors = 30.f;
+
+    // Blocks are padded to whole AVX2 vectors with particles this far away,
+    // which are outside every kernel
+    constexpr std::size_t lanes = 8;
+    constexpr float far_away = 1e18f;
+
+    // Copies of the particles in the buckets around one cell. The particles of
+    // a cell are consecutive after the reordering, so each copy serves all of
+    // them and the inner loops run over long contiguous arrays.
+    struct neighbor_block
+    {
+        particle_stream x, y, z;
+        particle_stream velocity_x, velocity_y, velocity_z;
+        particle_stream pressure, inverse_density;
+        // A multiple of `lanes`
+        std::size_t count = 0;
+    };
+
+    // Velocities are copied if asked for, pressures and inverse densities if
+    // `pressure` is given
+    void gather(particle_fluid const & fluid, neighbor_grid::neighborhood const & neighbors, bool velocities,
+        particle_stream const * pressure, neighbor_block & block)
+    {
+        neighbor_grid const & grid = fluid.grid;
+
+        std::size_t count = 0;
+        for (int n = 0; n < neighbors.count; ++n)
+            count += grid.end(neighbors.buckets[n]) - grid.begin(neighbors.buckets[n]);
+        std::size_t const padded = (count + lanes - 1) / lanes * lanes;
+
+        if (block.x.size() < padded)
+            for (auto stream : {&block.x, &block.y, &block.z, &block.velocity_x, &block.velocity_y,
+                &block.velocity_z, &block.pressure, &block.inverse_density})
+                stream->resize(padded);
+
+        std::size_t k = 0;
+        for (int n = 0; n < neighbors.count; ++n)
+        {
+            std::uint32_t const begin = grid.begin(neighbors.buckets[n]);
+            std::uint32_t const end = grid.end(neighbors.buckets[n]);
+            std::copy(fluid.position_x.begin() + begin, fluid.position_x.begin() + end, block.x.begin() + k);
+            std::copy(fluid.position_y.begin() + begin, fluid.position_y.begin() + end, block.y.begin() + k);
+            std::copy(fluid.position_z.begin() + begin, fluid.position_z.begin() + end, block.z.begin() + k);
+            if (velocities)
+            {
+                std::copy(fluid.velocity_x.begin() + begin, fluid.velocity_x.begin() + end, block.velocity_x.begin() + k);
+                std::copy(fluid.velocity_y.begin() + begin, fluid.velocity_y.begin() + end, block.velocity_y.begin() + k);
+                std::copy(fluid.velocity_z.begin() + begin, fluid.velocity_z.begin() + end, block.velocity_z.begin() + k);
+            }
+            if (pressure)
+                for (std::uint32_t j = begin; j < end; ++j)
+                {
+                    block.pressure[k + j - begin] = (*pressure)[j];
+                    block.inverse_density[k + j - begin] = 1.f / fluid.density[j];
+                }
+            k += end - begin;
+        }
+
+        // The padding's zero inverse density also zeroes its forces
+        for (; k < padded; ++k)
+        {
+            block.x[k] = block.y[k] = block.z[k] = far_away;
+            block.velocity_x[k] = block.velocity_y[k] = block.velocity_z[k] = 0.f;
+            block.pressure[k] = block.inverse_density[k] = 0.f;
+        }
+        block.count = padded;
+    }
+
+    // Calls f(i) for every particle of [begin, end) with `block` holding the
+    // particles around it, gathered again whenever the cell changes
+    template <typename F>
+    void for_each_particle(particle_fluid const & fluid, neighbor_block & block, bool velocities,
+        particle_stream const * pressure, std::size_t begin, std::size_t end, F && f)
+    {
+        constexpr std::int32_t none = std::numeric_limits<std::int32_t>::min();
+        neighbor_grid::cell_index current{none, none, none};
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            auto const cell = fluid.grid.cell(fluid.position_x[i], fluid.position_y[i], fluid.position_z[i]);
+            if (cell != current)
+            {
+                current = cell;
+                gather(fluid, fluid.grid.around(cell), velocities, pressure, block);
+            }
+            f(i);
+        }
+    }
+
+#ifdef __AVX2__
+
+    float horizontal_sum(__m256 v)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_movehdup_ps(s));
+        return _mm_cvtss_f32(s);
+    }
+
+#endif
+
+    // Sum of (h^2 - r^2)^3 over the particles closer than h, the poly6 kernel
+    // without its constant
+    float density_sum(neighbor_block const & block, float x, float y, float z, float h2)
+    {
+#ifdef __AVX2__
+        __m256 const x8 = _mm256_set1_ps(x), y8 = _mm256_set1_ps(y), z8 = _mm256_set1_ps(z);
+        __m256 const h28 = _mm256_set1_ps(h2);
+        __m256 sum = _mm256_setzero_ps();
+        for (std::size_t k = 0; k < block.count; k += lanes)
+        {
+            __m256 const dx = _mm256_sub_ps(x8, _mm256_load_ps(block.x.data() + k));
+            __m256 const dy = _mm256_sub_ps(y8, _mm256_load_ps(block.y.data() + k));
+            __m256 const dz = _mm256_sub_ps(z8, _mm256_load_ps(block.z.data() + k));
+            __m256 const r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+            __m256 const t = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(h28, r2));
+            sum = _mm256_fmadd_ps(_mm256_mul_ps(t, t), t, sum);
+        }
+        return horizontal_sum(sum);
+#else
+        float sum = 0.f;
+        for (std::size_t k = 0; k < block.count; ++k)
+        {
+            float const dx = x - block.x[k], dy = y - block.y[k], dz = z - block.z[k];
+            float const t = h2 - (dx * dx + dy * dy + dz * dz);
+            if (t > 0.f)
+                sum += t * t * t;
+        }
+        return sum;
+#endif
+    }
+
+    // Pressure and viscosity forces on a particle, per unit of its mass over its
+    // density. The particle itself is in the block but adds nothing: its offset
+    // and its velocity difference are both zero.
+    glm::vec3 sph_acceleration(neighbor_block const & block, glm::vec3 const & position, glm::vec3 const & velocity,
+        float pressure, float h, float spiky, float laplacian)
+    {
+        float const min_distance = 1e-6f * h;
+#ifdef __AVX2__
+        __m256 const x8 = _mm256_set1_ps(position.x), y8 = _mm256_set1_ps(position.y), z8 = _mm256_set1_ps(position.z);
+        __m256 const vx8 = _mm256_set1_ps(velocity.x), vy8 = _mm256_set1_ps(velocity.y), vz8 = _mm256_set1_ps(velocity.z);
+        __m256 const p8 = _mm256_set1_ps(pressure);
+        __m256 const h8 = _mm256_set1_ps(h);
+        __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+        for (std::size_t k = 0; k < block.count; k += lanes)
+        {
+            __m256 const dx = _mm256_sub_ps(x8, _mm256_load_ps(block.x.data() + k));
+            __m256 const dy = _mm256_sub_ps(y8, _mm256_load_ps(block.y.data() + k));
+            __m256 const dz = _mm256_sub_ps(z8, _mm256_load_ps(block.z.data() + k));
+            __m256 const r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+            __m256 const r = _mm256_max_ps(_mm256_sqrt_ps(r2), _mm256_set1_ps(min_distance));
+            __m256 const w = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(h8, r));
+
+            __m256 const inverse_density = _mm256_load_ps(block.inverse_density.data() + k);
+            __m256 const push = _mm256_div_ps(
+                _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(p8, _mm256_load_ps(block.pressure.data() + k)),
+                    inverse_density), _mm256_mul_ps(_mm256_set1_ps(spiky), _mm256_mul_ps(w, w))), r);
+            __m256 const drag = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(laplacian), inverse_density), w);
+
+            ax = _mm256_fmadd_ps(push, dx, _mm256_fmadd_ps(drag,
+                _mm256_sub_ps(_mm256_load_ps(block.velocity_x.data() + k), vx8), ax));
+            ay = _mm256_fmadd_ps(push, dy, _mm256_fmadd_ps(drag,
+                _mm256_sub_ps(_mm256_load_ps(block.velocity_y.data() + k), vy8), ay));
+            az = _mm256_fmadd_ps(push, dz, _mm256_fmadd_ps(drag,
+                _mm256_sub_ps(_mm256_load_ps(block.velocity_z.data() + k), vz8), az));
+        }
+        return {horizontal_sum(ax), horizontal_sum(ay), horizontal_sum(az)};
+#else
+        glm::vec3 a{0.f};
+        for (std::size_t k = 0; k < block.count; ++k)
+        {
+            glm::vec3 const d = position - glm::vec3{block.x[k], block.y[k], block.z[k]};
+            float const r2 = d.x * d.x + d.y * d.y + d.z * d.z;
+            if (r2 >= h * h)
+                continue;
+
+            float const r = std::max(std::sqrt(r2), min_distance);
+            float const w = h - r;
+            float const push = (pressure + block.pressure[k]) * block.inverse_density[k] * spiky * w * w / r;
+            float const drag = laplacian * block.inverse_density[k] * w;
+            a += push * d + drag * (glm::vec3{block.velocity_x[k], block.velocity_y[k], block.velocity_z[k]} - velocity);
+        }
+        return a;
+#endif
+    }
+
+    struct boid_neighbors
+    {
+        int count = 0;
+        glm::vec3 center{0.f};
+        glm::vec3 heading{0.f};
+        // Sum of the offsets from the boids closer than the separation radius,
+        // over their squared distances
+        glm::vec3 away{0.f};
+    };
+
+    // Positions and velocities of the boids within sqrt(r2), themselves included
+    boid_neighbors sum_neighbors(neighbor_block const & block, glm::vec3 const & position, float r2, float separation2)
+    {
+        boid_neighbors result;
+#ifdef __AVX2__
+        __m256 const x8 = _mm256_set1_ps(position.x), y8 = _mm256_set1_ps(position.y), z8 = _mm256_set1_ps(position.z);
+        __m256 const r28 = _mm256_set1_ps(r2);
+        __m256 const separation28 = _mm256_set1_ps(separation2);
+        __m256 const zero = _mm256_setzero_ps();
+        __m256 cx = zero, cy = zero, cz = zero, hx = zero, hy = zero, hz = zero, ax = zero, ay = zero, az = zero;
+        for (std::size_t k = 0; k < block.count; k += lanes)
+        {
+            __m256 const bx = _mm256_load_ps(block.x.data() + k);
+            __m256 const by = _mm256_load_ps(block.y.data() + k);
+            __m256 const bz = _mm256_load_ps(block.z.data() + k);
+            __m256 const dx = _mm256_sub_ps(x8, bx), dy = _mm256_sub_ps(y8, by), dz = _mm256_sub_ps(z8, bz);
+            __m256 const d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+            __m256 const inside = _mm256_cmp_ps(d2, r28, _CMP_LT_OQ);
+            int const mask = _mm256_movemask_ps(inside);
+            if (mask == 0)
+                continue;
+            result.count += std::popcount(unsigned(mask));
+
+            cx = _mm256_add_ps(cx, _mm256_and_ps(inside, bx));
+            cy = _mm256_add_ps(cy, _mm256_and_ps(inside, by));
+            cz = _mm256_add_ps(cz, _mm256_and_ps(inside, bz));
+            hx = _mm256_add_ps(hx, _mm256_and_ps(inside, _mm256_load_ps(block.velocity_x.data() + k)));
+            hy = _mm256_add_ps(hy, _mm256_and_ps(inside, _mm256_load_ps(block.velocity_y.data() + k)));
+            hz = _mm256_add_ps(hz, _mm256_and_ps(inside, _mm256_load_ps(block.velocity_z.data() + k)));
+
+            // The division is done for every lane and the ones too far or at
+            // distance zero are masked out afterwards
+            __m256 const close = _mm256_and_ps(_mm256_cmp_ps(d2, separation28, _CMP_LT_OQ),
+                _mm256_cmp_ps(d2, zero, _CMP_GT_OQ));
+            __m256 const inverse = _mm256_and_ps(close, _mm256_div_ps(_mm256_set1_ps(1.f), d2));
+            ax = _mm256_fmadd_ps(dx, inverse, ax);
+            ay = _mm256_fmadd_ps(dy, inverse, ay);
+            az = _mm256_fmadd_ps(dz, inverse, az);
+        }
+        result.center = {horizontal_sum(cx), horizontal_sum(cy), horizontal_sum(cz)};
+        result.heading = {horizontal_sum(hx), horizontal_sum(hy), horizontal_sum(hz)};
+        result.away = {horizontal_sum(ax), horizontal_sum(ay), horizontal_sum(az)};
+#else
+        for (std::size_t k = 0; k < block.count; ++k)
+        {
+            glm::vec3 const other{block.x[k], block.y[k], block.z[k]};
+            glm::vec3 const d = position - other;
+            float const d2 = d.x * d.x + d.y * d.y + d.z * d.z;
+            if (d2 >= r2)
+                continue;
+
+            ++result.count;
+            result.center += other;
+            result.heading += glm::vec3{block.velocity_x[k], block.velocity_y[k], block.velocity_z[k]};
+            if (d2 < separation2 && d2 > 0.f)
+                result.away += d / d2;
+        }
+#endif
+        return result;
+    }
+
+}
+
+particle_fluid::particle_fluid(mode simulation, std::size_t count, std::uint64_t seed)
+    : simulation(simulation)
+{
+    for (auto stream : {&position_x, &position_y, &position_z, &velocity_x, &velocity_y, &velocity_z, &density,
+        &scratch, &next_velocity_x, &next_velocity_y, &next_velocity_z})
+        stream->assign(count, 0.f);
+
+    philox_stream random(seed, 0);
+
+    if (simulation == mode::sph)
+    {
+        // A cube of particles half a radius apart, jittered a little so that
+        // they do not stack up in columns, in a box twice its width and height
+        float const spacing = sph.radius / 2.f;
+        std::size_t side = 1;
+        while (side * side * side < count)
+            ++side;
+        float const width = side * spacing;
+
+        box_min = glm::vec3(0.f);
+        box_max = glm::vec3(2.f * width, 2.f * width, width);
+        mass = sph.rest_density * spacing * spacing * spacing;
+        grid = neighbor_grid(sph.radius);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            position_x[i] = (i % side + random.uniform(0.4f, 0.6f)) * spacing;
+            position_y[i] = (i / side % side + random.uniform(0.4f, 0.6f)) * spacing;
+            position_z[i] = (i / side / side + random.uniform(0.4f, 0.6f)) * spacing;
+        }
+    }
+    else
+    {
+        // A cubic box where every boid sees about mean_boid_neighbors others
+        float const width = std::cbrt(count * 4.f / 3.f * pi / mean_boid_neighbors) * boids.radius;
+        box_min = glm::vec3(-width / 2.f);
+        box_max = glm::vec3(width / 2.f);
+        grid = neighbor_grid(boids.radius);
+
+        fill_uniform(random, position_x, box_min.x, box_max.x);
+        fill_uniform(random, position_y, box_min.y, box_max.y);
+        fill_uniform(random, position_z, box_min.z, box_max.z);
+
+        fill_unit_sphere(random, velocity_x, velocity_y, velocity_z);
+        float const speed = (boids.min_speed + boids.max_speed) / 2.f;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            velocity_x[i] *= speed;
+            velocity_y[i] *= speed;
+            velocity_z[i] *= speed;
+        }
+    }
+}
+
+std::size_t particle_fluid::particle_count() const
+{
+    return position_x.size();
+}
+
+void particle_fluid::step(float dt, thread_pool & pool)
+{
+    grid.build(position_x, position_y, position_z, pool);
+    reorder(pool);
+
+    if (simulation == mode::sph)
+        sph_step(dt, pool);
+    else
+        boids_step(dt, pool);
+}
+
+void particle_fluid::reorder(thread_pool & pool)
+{
+    // Particles of a bucket end up next to each other, and so do the buckets'
+    // ranges in grid.bucket_start
+    for (auto stream : {&position_x, &position_y, &position_z, &velocity_x, &velocity_y, &velocity_z})
+    {
+        pool.parallel_for(particle_count(), grain * 16, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                scratch[i] = (*stream)[grid.order[i]];
+        });
+        stream->swap(scratch);
+    }
+}
+
+void particle_fluid::sph_step(float dt, thread_pool & pool)
+{
+    float const h = sph.radius;
+    float const h2 = h * h;
+    float const h6 = h2 * h2 * h2;
+    float const poly6 = 315.f / (64.f * pi * h6 * h2 * h);
+    // The spiky kernel's gradient, halved for the symmetric pressure (p_i + p_j) / 2,
+    // and the viscosity kernel's Laplacian, both without their (h - r) factors
+    float const spiky = 45.f / (pi * h6) / 2.f;
+    float const laplacian = sph.viscosity * 45.f / (pi * h6);
+
+    pool.parallel_for(particle_count(), grain, [&](std::size_t begin, std::size_t end)
+    {
+        neighbor_block block;
+        for_each_particle(*this, block, false, nullptr, begin, end, [&](std::size_t i)
+        {
+            density[i] = mass * poly6 * density_sum(block, position_x[i], position_y[i], position_z[i], h2);
+            scratch[i] = std::max(0.f, sph.stiffness * (density[i] - sph.rest_density));
+        });
+    });
+
+    pool.parallel_for(particle_count(), grain, [&](std::size_t begin, std::size_t end)
+    {
+        neighbor_block block;
+        for_each_particle(*this, block, true, &scratch, begin, end, [&](std::size_t i)
+        {
+            glm::vec3 const a = sph_acceleration(block, {position_x[i], position_y[i], position_z[i]},
+                {velocity_x[i], velocity_y[i], velocity_z[i]}, scratch[i], h, spiky, laplacian);
+
+            float const scale = mass / density[i] * dt;
+            next_velocity_x[i] = velocity_x[i] + a.x * scale;
+            next_velocity_y[i] = velocity_y[i] + a.y * scale + sph.gravity * dt;
+            next_velocity_z[i] = velocity_z[i] + a.z * scale;
+        });
+    });
+
+    integrate(dt, sph.restitution, pool);
+}
+
+void particle_fluid::boids_step(float dt, thread_pool & pool)
+{
+    float const r2 = boids.radius * boids.radius;
+    float const separation2 = boids.separation_radius * boids.separation_radius;
+
+    pool.parallel_for(particle_count(), grain, [&](std::size_t begin, std::size_t end)
+    {
+        neighbor_block block;
+        for_each_particle(*this, block, true, nullptr, begin, end, [&](std::size_t i)
+        {
+            glm::vec3 const position{position_x[i], position_y[i], position_z[i]};
+            glm::vec3 const velocity{velocity_x[i], velocity_y[i], velocity_z[i]};
+
+            boid_neighbors const seen = sum_neighbors(block, position, r2, separation2);
+            // The boid itself is at distance zero and counted among its
+            // neighbours, it is taken out again here
+            glm::vec3 const center = seen.center - position;
+            glm::vec3 const heading = seen.heading - velocity;
+            int const count = seen.count - 1;
+
+            glm::vec3 steer = boids.separation * seen.away;
+            if (count > 0)
+            {
+                steer += boids.cohesion * (center / float(count) - position);
+                steer += boids.alignment * (heading / float(count) - velocity);
+            }
+
+            // Turn around within one radius of the walls
+            glm::vec3 const inner_min = box_min + boids.radius;
+            glm::vec3 const inner_max = box_max - boids.radius;
+            for (int c = 0; c < 3; ++c)
+            {
+                if (position[c] < inner_min[c])
+                    steer[c] += boids.containment * (inner_min[c] - position[c]);
+                if (position[c] > inner_max[c])
+                    steer[c] -= boids.containment * (position[c] - inner_max[c]);
+            }
+
+            glm::vec3 next = velocity + steer * dt;
+            float const speed = std::sqrt(next.x * next.x + next.y * next.y + next.z * next.z);
+            if (speed > 0.f)
+                next *= std::clamp(speed, boids.min_speed, boids.max_speed) / speed;
+
+            next_velocity_x[i] = next.x;
+            next_velocity_y[i] = next.y;
+            next_velocity_z[i] = next.z;
+        });
+    });
+
+    integrate(dt, 1.f, pool);
+}
+
+void particle_fluid::integrate(float dt, float restitution, thread_pool & pool)
+{
+    velocity_x.swap(next_velocity_x);
+    velocity_y.swap(next_velocity_y);
+    velocity_z.swap(next_velocity_z);
+
+    std::array<std::pair<particle_stream *, particle_stream *>, 3> const axes{{
+        {&position_x, &velocity_x}, {&position_y, &velocity_y}, {&position_z, &velocity_z}}};
+
+    pool.parallel_for(particle_count(), grain * 16, [&](std::size_t begin, std::size_t end)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            float * const position = axes[c].first->data();
+            float * const velocity = axes[c].second->data();
+            float const min = box_min[c], max = box_max[c];
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                float p = position[i] + velocity[i] * dt;
+                float v = velocity[i];
+                if (p < min)
+                {
+                    p = min;
+                    v = std::abs(v) * restitution;
+                }
+                if (p > max)
+                {
+                    p = max;
+                    v = -std::abs(v) * restitution;
+                }
+                position[i] = p;
+                velocity[i] = v;
+            }
+        }
+    });
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+
+#include "neighbor_grid.hpp"
+#include "particle_system.hpp"
+#include "thread_pool.hpp"
+
+// Particles that interact with their neighbours, either as an SPH fluid
+// (Müller et al., "Particle-Based Fluid Simulation for Interactive
+// Applications") or as boids. Every step rebuilds the neighbour grid and
+// reorders the particles by cell, so that the particles of a cell are
+// neighbours in the streams and share one copy of the particles around them.
+struct particle_fluid
+{
+    enum class mode
+    {
+        sph,
+        boids,
+    };
+
+    struct sph_parameters
+    {
+        // Smoothing radius, also the neighbour grid's cell size
+        float radius = 0.1f;
+        float rest_density = 1000.f;
+        // Pressure per unit of density above the rest density, densities
+        // below it give no pressure. Pressure waves travel at sqrt(stiffness),
+        // so stable steps are at most about 0.4 * radius / sqrt(stiffness).
+        float stiffness = 300.f;
+        float viscosity = 5.f;
+        float gravity = -9.8f;
+        // Fraction of the velocity kept when bouncing off the box
+        float restitution = 0.3f;
+    };
+
+    struct boid_parameters
+    {
+        // Boids see each other this far, also the neighbour grid's cell size
+        float radius = 1.f;
+        float separation_radius = 0.4f;
+        float separation = 2.f;
+        float alignment = 1.f;
+        float cohesion = 1.f;
+        // Steering back into the box
+        float containment = 4.f;
+        float min_speed = 1.f;
+        float max_speed = 4.f;
+    };
+
+    // Fills the box with `count` particles: a block of fluid in one corner of it
+    // for SPH, randomly placed and headed boids otherwise
+    particle_fluid(mode simulation, std::size_t count, std::uint64_t seed = 0);
+
+    void step(float dt, thread_pool & pool);
+
+    std::size_t particle_count() const;
+
+    mode simulation;
+    sph_parameters sph;
+    boid_parameters boids;
+
+    // Particles stay inside this box
+    glm::vec3 box_min;
+    glm::vec3 box_max;
+
+    particle_stream position_x, position_y, position_z;
+    particle_stream velocity_x, velocity_y, velocity_z;
+    // SPH only
+    particle_stream density;
+
+    neighbor_grid grid;
+
+private:
+    // Mass of every SPH particle, from the rest density and the initial spacing
+    float mass = 0.f;
+
+    // Gather target of the reordering, then the SPH pressures
+    particle_stream scratch;
+    // Velocities are written here while the neighbours still read the old ones
+    particle_stream next_velocity_x, next_velocity_y, next_velocity_z;
+
+    void reorder(thread_pool & pool);
+    void sph_step(float dt, thread_pool & pool);
+    void boids_step(float dt, thread_pool & pool);
+    // Moves the particles by their new velocities and keeps them in the box
+    void integrate(float dt, float restitution, thread_pool & pool);
+};
@@ -0,0 +1,451 @@
+#include "particle_system.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+    constexpr float inverse_turn = 0.5f / 3.14159265358979f;
+
+#if !defined(__AVX2__) || !defined(__F16C__)
+
+    // Round to nearest even, the same as F16C (after Fabian Giesen's float_to_half_fast3_rtne)
+    std::uint16_t to_half(float value)
+    {
+        std::uint32_t const bits = std::bit_cast<std::uint32_t>(value);
+        std::uint32_t const sign = (bits >> 16) & 0x8000u;
+        std::uint32_t const magnitude = bits & 0x7FFFFFFFu;
+
+        // Too large for a half, infinity or NaN
+        if (magnitude >= 0x47800000u)
+            return sign | (magnitude > 0x7F800000u ? 0x7E00u : 0x7C00u);
+
+        // Subnormal half: adding 0.5 lines the mantissa up and lets the FPU round
+        if (magnitude < 0x38800000u)
+            return sign | (std::bit_cast<std::uint32_t>(std::bit_cast<float>(magnitude) + 0.5f) - 0x3F000000u);
+
+        std::uint32_t const odd = (magnitude >> 13) & 1u;
+        return sign | ((magnitude + 0xC8000FFFu + odd) >> 13);
+    }
+
+    packed_particle pack_particle(float x, float y, float z, float size, float rotation)
+    {
+        float const turns = rotation * inverse_turn;
+
+        packed_particle result;
+        result.position[0] = to_half(x);
+        result.position[1] = to_half(y);
+        result.position[2] = to_half(z);
+        result.size = std::min(size * (1.f / packed_particle::max_size), 1.f) * 255.f + 0.5f;
+        result.rotation = int((turns - std::floor(turns)) * 256.f) & 255;
+        return result;
+    }
+
+#endif
+
+#if defined(__AVX2__) && defined(__F16C__)
+
+    // Packs eight particles and stores them at out[0..7]
+    void pack_batch(__m256 x, __m256 y, __m256 z, __m256 size, __m256 rotation, packed_particle * out)
+    {
+        __m128i const hx = _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT);
+        __m128i const hy = _mm256_cvtps_ph(y, _MM_FROUND_TO_NEAREST_INT);
+        __m128i const hz = _mm256_cvtps_ph(z, _MM_FROUND_TO_NEAREST_INT);
+
+        __m256 const relative_size = _mm256_min_ps(_mm256_mul_ps(size, _mm256_set1_ps(1.f / packed_particle::max_size)),
+            _mm256_set1_ps(1.f));
+        __m256i const size_bits = _mm256_cvttps_epi32(_mm256_fmadd_ps(relative_size, _mm256_set1_ps(255.f),
+            _mm256_set1_ps(0.5f)));
+
+        __m256 turns = _mm256_mul_ps(rotation, _mm256_set1_ps(inverse_turn));
+        turns = _mm256_sub_ps(turns, _mm256_floor_ps(turns));
+        __m256i const rotation_bits = _mm256_and_si256(
+            _mm256_cvttps_epi32(_mm256_mul_ps(turns, _mm256_set1_ps(256.f))), _mm256_set1_epi32(255));
+
+        // Size in the low byte and rotation in the high byte of 16-bit lanes
+        __m256i const packed = _mm256_or_si256(size_bits, _mm256_slli_epi32(rotation_bits, 8));
+        __m128i const hw = _mm_packus_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+
+        // Interleave into x y z w per particle
+        __m128i const xy_low = _mm_unpacklo_epi16(hx, hy);
+        __m128i const xy_high = _mm_unpackhi_epi16(hx, hy);
+        __m128i const zw_low = _mm_unpacklo_epi16(hz, hw);
+        __m128i const zw_high = _mm_unpackhi_epi16(hz, hw);
+
+        auto * const target = reinterpret_cast<__m128i *>(out);
+        _mm_storeu_si128(target + 0, _mm_unpacklo_epi32(xy_low, zw_low));
+        _mm_storeu_si128(target + 1, _mm_unpackhi_epi32(xy_low, zw_low));
+        _mm_storeu_si128(target + 2, _mm_unpacklo_epi32(xy_high, zw_high));
+        _mm_storeu_si128(target + 3, _mm_unpackhi_epi32(xy_high, zw_high));
+    }
+
+#endif
+
+    // Particles inside the collider are moved back out to its surface along the
+    // gradient, and the part of their velocity going into it is reflected.
+    // `reflect` is one plus the emitter's bounce.
+#ifdef __AVX2__
+
+    void collide(signed_distance_field const & collider, __m256 reflect, __m256 & x, __m256 & y, __m256 & z,
+        __m256 & vx, __m256 & vy, __m256 & vz)
+    {
+        __m256 const inverse_voxel = _mm256_set1_ps(1.f / collider.voxel_size);
+        __m256 const gx = _mm256_mul_ps(_mm256_sub_ps(x, _mm256_set1_ps(collider.origin.x)), inverse_voxel);
+        __m256 const gy = _mm256_mul_ps(_mm256_sub_ps(y, _mm256_set1_ps(collider.origin.y)), inverse_voxel);
+        __m256 const gz = _mm256_mul_ps(_mm256_sub_ps(z, _mm256_set1_ps(collider.origin.z)), inverse_voxel);
+
+        // Most particles are nowhere near the collider and skip the gathers
+        __m256 const top_x = _mm256_set1_ps(collider.size.x - 1.001f);
+        __m256 const top_y = _mm256_set1_ps(collider.size.y - 1.001f);
+        __m256 const top_z = _mm256_set1_ps(collider.size.z - 1.001f);
+        __m256 const zero = _mm256_setzero_ps();
+        __m256 const in_grid = _mm256_and_ps(
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(gx, zero, _CMP_GE_OQ), _mm256_cmp_ps(gx, top_x, _CMP_LE_OQ)),
+                _mm256_and_ps(_mm256_cmp_ps(gy, zero, _CMP_GE_OQ), _mm256_cmp_ps(gy, top_y, _CMP_LE_OQ))),
+            _mm256_and_ps(_mm256_cmp_ps(gz, zero, _CMP_GE_OQ), _mm256_cmp_ps(gz, top_z, _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(in_grid) == 0)
+            return;
+
+        // Lanes outside the grid look up point (0, 0, 0) and are masked out below
+        __m256i const ix = _mm256_cvttps_epi32(_mm256_and_ps(in_grid, gx));
+        __m256i const iy = _mm256_cvttps_epi32(_mm256_and_ps(in_grid, gy));
+        __m256i const iz = _mm256_cvttps_epi32(_mm256_and_ps(in_grid, gz));
+        __m256 const fx = _mm256_sub_ps(_mm256_and_ps(in_grid, gx), _mm256_cvtepi32_ps(ix));
+        __m256 const fy = _mm256_sub_ps(_mm256_and_ps(in_grid, gy), _mm256_cvtepi32_ps(iy));
+        __m256 const fz = _mm256_sub_ps(_mm256_and_ps(in_grid, gz), _mm256_cvtepi32_ps(iz));
+
+        int const row = collider.size.x;
+        int const slice = collider.size.x * collider.size.y;
+        __m256i const base = _mm256_add_epi32(_mm256_add_epi32(ix, _mm256_mullo_epi32(iy, _mm256_set1_epi32(row))),
+            _mm256_mullo_epi32(iz, _mm256_set1_epi32(slice)));
+        float const * const d = collider.distances.data();
+        auto corner = [&](int offset)
+        {
+            return _mm256_i32gather_ps(d, _mm256_add_epi32(base, _mm256_set1_epi32(offset)), 4);
+        };
+        __m256 const c000 = corner(0), c100 = corner(1), c010 = corner(row), c110 = corner(row + 1);
+        __m256 const c001 = corner(slice), c101 = corner(slice + 1);
+        __m256 const c011 = corner(slice + row), c111 = corner(slice + row + 1);
+
+        auto lerp = [](__m256 a, __m256 b, __m256 t){ return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a); };
+        __m256 const c00 = lerp(c000, c100, fx), c10 = lerp(c010, c110, fx);
+        __m256 const c01 = lerp(c001, c101, fx), c11 = lerp(c011, c111, fx);
+        __m256 const c0 = lerp(c00, c10, fy), c1 = lerp(c01, c11, fy);
+        __m256 const distance = lerp(c0, c1, fz);
+
+        __m256 const inside = _mm256_and_ps(in_grid, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(inside) == 0)
+            return;
+
+        // The gradient's length cancels, so the voxel size does not matter here
+        __m256 const dx0 = lerp(_mm256_sub_ps(c100, c000), _mm256_sub_ps(c110, c010), fy);
+        __m256 const dx1 = lerp(_mm256_sub_ps(c101, c001), _mm256_sub_ps(c111, c011), fy);
+        __m256 nx = lerp(dx0, dx1, fz);
+        __m256 ny = lerp(_mm256_sub_ps(c10, c00), _mm256_sub_ps(c11, c01), fz);
+        __m256 nz = _mm256_sub_ps(c1, c0);
+        __m256 const length2 = _mm256_fmadd_ps(nx, nx, _mm256_fmadd_ps(ny, ny, _mm256_mul_ps(nz, nz)));
+        __m256 const active = _mm256_and_ps(inside, _mm256_cmp_ps(length2, zero, _CMP_GT_OQ));
+        __m256 const inverse_length = _mm256_and_ps(active, _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(length2)));
+        nx = _mm256_mul_ps(nx, inverse_length);
+        ny = _mm256_mul_ps(ny, inverse_length);
+        nz = _mm256_mul_ps(nz, inverse_length);
+
+        x = _mm256_fnmadd_ps(distance, nx, x);
+        y = _mm256_fnmadd_ps(distance, ny, y);
+        z = _mm256_fnmadd_ps(distance, nz, z);
+
+        __m256 const vn = _mm256_fmadd_ps(vx, nx, _mm256_fmadd_ps(vy, ny, _mm256_mul_ps(vz, nz)));
+        __m256 const k = _mm256_mul_ps(reflect, _mm256_min_ps(vn, zero));
+        vx = _mm256_fnmadd_ps(k, nx, vx);
+        vy = _mm256_fnmadd_ps(k, ny, vy);
+        vz = _mm256_fnmadd_ps(k, nz, vz);
+    }
+
+#else
+
+    void collide(signed_distance_field const & collider, float reflect, float & x, float & y, float & z,
+        float & vx, float & vy, float & vz)
+    {
+        // Most particles are nowhere near the collider and skip the lookup
+        glm::vec3 const g = (glm::vec3{x, y, z} - collider.origin) / collider.voxel_size;
+        for (int c = 0; c < 3; ++c)
+            if (!(g[c] >= 0.f && g[c] <= collider.size[c] - 1))
+                return;
+
+        glm::vec3 gradient;
+        float const distance = collider.sample({x, y, z}, gradient);
+        float const length = glm::length(gradient);
+        if (distance >= 0.f || length == 0.f)
+            return;
+
+        glm::vec3 const n = gradient / length;
+        x -= distance * n.x;
+        y -= distance * n.y;
+        z -= distance * n.z;
+
+        float const vn = std::min(vx * n.x + vy * n.y + vz * n.z, 0.f);
+        vx -= reflect * vn * n.x;
+        vy -= reflect * vn * n.y;
+        vz -= reflect * vn * n.z;
+    }
+
+#endif
+
+}
+
+particle_curve::particle_curve(float value)
+{
+    values.fill(value);
+}
+
+particle_curve::particle_curve(std::span<std::pair<float, float> const> points)
+{
+    for (std::size_t k = 0; k < samples; ++k)
+    {
+        float const t = k / float(samples - 1);
+        auto next = std::find_if(points.begin(), points.end(), [t](auto const & point){ return point.first > t; });
+        if (next == points.begin())
+            values[k] = next->second;
+        else if (next == points.end())
+            values[k] = points.back().second;
+        else
+        {
+            auto const previous = std::prev(next);
+            float const s = (t - previous->first) / (next->first - previous->first);
+            values[k] = previous->second + (next->second - previous->second) * s;
+        }
+    }
+}
+
+float particle_curve::operator()(float age) const
+{
+    float const f = std::clamp(age, 0.f, 1.f) * (samples - 1);
+    std::size_t const i = std::min<std::size_t>(f, samples - 2);
+    return values[i] + (values[i + 1] - values[i]) * (f - i);
+}
+
+particle_system::particle_system(std::size_t capacity)
+{
+    std::size_t const padded = (capacity + batch - 1) / batch * batch;
+    for (auto stream : {&position_x, &position_y, &position_z, &velocity_x, &velocity_y, &velocity_z,
+        &base_size, &size, &rotation, &angular_velocity, &age, &ceiling_height})
+        stream->assign(padded, 0.f);
+    // Keeps age / lifetime finite in the padding
+    lifetime.assign(padded, 1.f);
+    emitter.assign(padded, 0);
+
+    std::size_t const chunks = (padded + chunk_size - 1) / chunk_size;
+    dead.resize(chunks * chunk_size);
+    dead_count.resize(chunks);
+}
+
+std::size_t particle_system::capacity() const
+{
+    return position_x.size();
+}
+
+std::size_t particle_system::particle_count() const
+{
+    return count;
+}
+
+std::size_t particle_system::allocate(std::size_t & n, std::uint32_t id)
+{
+    n = std::min(n, capacity() - count);
+
+    std::size_t const first = count;
+    std::fill_n(emitter.begin() + first, n, id);
+    std::fill_n(age.begin() + first, n, 0.f);
+    std::fill_n(rotation.begin() + first, n, 0.f);
+    count += n;
+    return first;
+}
+
+void particle_system::update(float dt, std::span<emitter_parameters const> emitters, thread_pool & pool,
+    packed_particle * render, signed_distance_field const * collider)
+{
+    // Everything that is the same for all particles of an emitter, exp() included,
+    // is computed here once per frame
+    lift_table.clear();
+    drag_table.clear();
+    bounce_table.clear();
+    curve_table.clear();
+    for (auto const & e : emitters)
+    {
+        lift_table.push_back(dt * e.lift);
+        drag_table.push_back(std::exp(-e.drag * dt));
+        bounce_table.push_back(1.f + e.bounce);
+        curve_table.insert(curve_table.end(), e.size.values.begin(), e.size.values.end());
+    }
+
+    std::size_t const chunks = (count + chunk_size - 1) / chunk_size;
+    pool.parallel_for(chunks, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t chunk = first; chunk < last; ++chunk)
+            update_range(chunk, dt, render, collider);
+    });
+
+    remove_dead(render);
+}
+
+void particle_system::pack(packed_particle * render, thread_pool & pool) const
+{
+    pool.parallel_for(count, chunk_size, [&](std::size_t begin, std::size_t end)
+    {
+        pack_range(begin, end, render);
+    });
+}
+
+void particle_system::pack_range(std::size_t begin, std::size_t end, packed_particle * render) const
+{
+#if defined(__AVX2__) && defined(__F16C__)
+    // The last batch may run into the padding, which `capacity()` entries cover
+    for (std::size_t i = begin; i < end; i += batch)
+        pack_batch(_mm256_load_ps(position_x.data() + i), _mm256_load_ps(position_y.data() + i),
+            _mm256_load_ps(position_z.data() + i), _mm256_load_ps(size.data() + i), _mm256_load_ps(rotation.data() + i),
+            render + i);
+#else
+    for (std::size_t i = begin; i < end; ++i)
+        render[i] = pack_particle(position_x[i], position_y[i], position_z[i], size[i], rotation[i]);
+#endif
+}
+
+void particle_system::update_range(std::size_t chunk, float dt, packed_particle * render,
+    signed_distance_field const * collider)
+{
+    std::size_t const begin = chunk * chunk_size;
+    // Chunks start on a batch boundary, only the last one needs rounding up
+    std::size_t const end = std::min((std::min(begin + chunk_size, count) + batch - 1) / batch * batch, capacity());
+
+    std::uint32_t * const chunk_dead = dead.data() + begin;
+    std::uint32_t dead_in_chunk = 0;
+
+    constexpr std::size_t last_sample = particle_curve::samples - 1;
+
+#ifdef __AVX2__
+    __m256 const dt8 = _mm256_set1_ps(dt);
+    __m256 const one = _mm256_set1_ps(1.f);
+
+    for (std::size_t i = begin; i < end; i += batch)
+    {
+        __m256i const e = _mm256_load_si256(reinterpret_cast<__m256i const *>(emitter.data() + i));
+        __m256 const lift = _mm256_i32gather_ps(lift_table.data(), e, 4);
+        __m256 const drag = _mm256_i32gather_ps(drag_table.data(), e, 4);
+
+        __m256 vx = _mm256_load_ps(velocity_x.data() + i);
+        __m256 vy = _mm256_add_ps(_mm256_load_ps(velocity_y.data() + i), lift);
+        __m256 vz = _mm256_load_ps(velocity_z.data() + i);
+
+        __m256 x = _mm256_fmadd_ps(dt8, vx, _mm256_load_ps(position_x.data() + i));
+        __m256 y = _mm256_fmadd_ps(dt8, vy, _mm256_load_ps(position_y.data() + i));
+        __m256 z = _mm256_fmadd_ps(dt8, vz, _mm256_load_ps(position_z.data() + i));
+        if (collider)
+            collide(*collider, _mm256_i32gather_ps(bounce_table.data(), e, 4), x, y, z, vx, vy, vz);
+        _mm256_store_ps(position_x.data() + i, x);
+        _mm256_store_ps(position_y.data() + i, y);
+        _mm256_store_ps(position_z.data() + i, z);
+
+        _mm256_store_ps(velocity_x.data() + i, _mm256_mul_ps(vx, drag));
+        _mm256_store_ps(velocity_y.data() + i, _mm256_mul_ps(vy, drag));
+        _mm256_store_ps(velocity_z.data() + i, _mm256_mul_ps(vz, drag));
+
+        __m256 const a = _mm256_add_ps(_mm256_load_ps(age.data() + i), dt8);
+        __m256 const l = _mm256_load_ps(lifetime.data() + i);
+        _mm256_store_ps(age.data() + i, a);
+
+        // Size curve, linear between the two nearest table samples. max() also
+        // turns a NaN into 0, so the gather indices are always in range.
+        __m256 const t = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(a, l), _mm256_setzero_ps()), one);
+        __m256 const f = _mm256_mul_ps(t, _mm256_set1_ps(float(last_sample)));
+        __m256i const sample = _mm256_min_epi32(_mm256_cvttps_epi32(f), _mm256_set1_epi32(last_sample - 1));
+        __m256i const index = _mm256_add_epi32(_mm256_mullo_epi32(e, _mm256_set1_epi32(particle_curve::samples)), sample);
+        __m256 const c0 = _mm256_i32gather_ps(curve_table.data(), index, 4);
+        __m256 const c1 = _mm256_i32gather_ps(curve_table.data() + 1, index, 4);
+        __m256 const curve = _mm256_fmadd_ps(_mm256_sub_ps(f, _mm256_cvtepi32_ps(sample)), _mm256_sub_ps(c1, c0), c0);
+
+        __m256 const s = _mm256_mul_ps(_mm256_load_ps(base_size.data() + i), curve);
+        __m256 const r = _mm256_fmadd_ps(dt8, _mm256_load_ps(angular_velocity.data() + i),
+            _mm256_load_ps(rotation.data() + i));
+        _mm256_store_ps(size.data() + i, s);
+        _mm256_store_ps(rotation.data() + i, r);
+
+#ifdef __F16C__
+        // Packed while everything is still in registers
+        if (render)
+            pack_batch(x, y, z, s, r, render + i);
+#endif
+
+        __m256 const expired = _mm256_or_ps(_mm256_cmp_ps(a, l, _CMP_GE_OQ),
+            _mm256_cmp_ps(y, _mm256_load_ps(ceiling_height.data() + i), _CMP_GT_OQ));
+        for (unsigned int mask = _mm256_movemask_ps(expired); mask != 0; mask &= mask - 1)
+        {
+            std::size_t const index = i + __builtin_ctz(mask);
+            if (index < count)
+                chunk_dead[dead_in_chunk++] = index;
+        }
+    }
+#else
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        std::uint32_t const e = emitter[i];
+        velocity_y[i] += lift_table[e];
+        position_x[i] += dt * velocity_x[i];
+        position_y[i] += dt * velocity_y[i];
+        position_z[i] += dt * velocity_z[i];
+        if (collider)
+            collide(*collider, bounce_table[e], position_x[i], position_y[i], position_z[i],
+                velocity_x[i], velocity_y[i], velocity_z[i]);
+        velocity_x[i] *= drag_table[e];
+        velocity_y[i] *= drag_table[e];
+        velocity_z[i] *= drag_table[e];
+        rotation[i] += dt * angular_velocity[i];
+        age[i] += dt;
+
+        float const t = std::min(std::max(age[i] / lifetime[i], 0.f), 1.f);
+        float const f = t * last_sample;
+        std::size_t const sample = std::min<std::size_t>(f, last_sample - 1);
+        float const * const c = curve_table.data() + e * particle_curve::samples + sample;
+        size[i] = base_size[i] * (c[0] + (c[1] - c[0]) * (f - sample));
+
+        if ((age[i] >= lifetime[i] || position_y[i] > ceiling_height[i]) && i < count)
+            chunk_dead[dead_in_chunk++] = i;
+    }
+#endif
+
+#if !defined(__AVX2__) || !defined(__F16C__)
+    if (render)
+        pack_range(begin, end, render);
+#endif
+
+    dead_count[chunk] = dead_in_chunk;
+}
+
+void particle_system::remove_dead(packed_particle * render)
+{
+    // From the highest index down, so that every particle moved into a hole is
+    // known to be alive
+    for (std::size_t chunk = (count + chunk_size - 1) / chunk_size; chunk-- > 0;)
+        for (std::size_t j = dead_count[chunk]; j-- > 0;)
+        {
+            std::size_t const hole = dead[chunk * chunk_size + j];
+            std::size_t const last = --count;
+            if (hole == last)
+                continue;
+
+            for (auto stream : {&position_x, &position_y, &position_z, &velocity_x, &velocity_y, &velocity_z,
+                &base_size, &size, &rotation, &angular_velocity, &age, &lifetime, &ceiling_height})
+                (*stream)[hole] = (*stream)[last];
+            emitter[hole] = emitter[last];
+
+            if (render)
+                render[hole] = render[last];
+        }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "signed_distance_field.hpp"
+#include "thread_pool.hpp"
+
+// Allocator for the particle streams, so that the update kernel can use aligned loads
+template <typename T, std::size_t Alignment = 32>
+struct aligned_allocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = aligned_allocator<U, Alignment>;
+    };
+
+    aligned_allocator() = default;
+
+    template <typename U>
+    aligned_allocator(aligned_allocator<U, Alignment> const &)
+    {}
+
+    T * allocate(std::size_t count)
+    {
+        return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T * p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator == (aligned_allocator<U, Alignment> const &) const
+    {
+        return true;
+    }
+};
+
+using particle_stream = std::vector<float, aligned_allocator<float>>;
+using particle_index_stream = std::vector<std::uint32_t, aligned_allocator<std::uint32_t>>;
+
+// What the renderer reads of a particle, 8 bytes instead of five floats
+struct packed_particle
+{
+    // Largest size that can be represented, smaller sizes are stored relative to it
+    static constexpr float max_size = 1.f;
+
+    // Half floats
+    std::uint16_t position[3];
+    // Fractions of max_size and of a full turn
+    std::uint8_t size;
+    std::uint8_t rotation;
+};
+
+// Piecewise linear function of a particle's normalized age, baked into a
+// table the update kernel can sample with gathers
+struct particle_curve
+{
+    static constexpr std::size_t samples = 16;
+
+    std::array<float, samples> values;
+
+    // Constant curve
+    particle_curve(float value = 1.f);
+    // Through (age, value) points sorted by age, constant beyond the first and last
+    explicit particle_curve(std::span<std::pair<float, float> const> points);
+
+    float operator()(float age) const;
+};
+
+// Fixed-capacity pool of particles, stored as one array per field. The live
+// particles are always [0, particle_count()): new ones are appended and dead
+// ones are replaced by the last, so both are O(1) and the memory never grows.
+// Every stream is padded to a multiple of `batch` so the kernel never needs a
+// scalar tail.
+//
+// The update is split into fixed chunks of `chunk_size` particles on the
+// thread pool; the particles that died are then removed in index order on the
+// calling thread, so the result does not depend on the number of threads.
+struct particle_system
+{
+    static constexpr std::size_t batch = 8;
+    static constexpr std::size_t chunk_size = 4096;
+
+    // Per-emitter constants of the update, indexed by each particle's `emitter`
+    struct emitter_parameters
+    {
+        // Upward acceleration
+        float lift = 0.f;
+        // Velocity decay rate, per second
+        float drag = 0.f;
+        // Fraction of the speed into a collider that a particle bounces back with
+        float bounce = 0.5f;
+        // Multiplies base_size over the particle's lifetime
+        particle_curve size;
+    };
+
+    explicit particle_system(std::size_t capacity);
+
+    std::size_t capacity() const;
+    std::size_t particle_count() const;
+
+    // Appends up to `n` particles of the given emitter, fewer if the pool is full,
+    // and returns the index of the first. Their age is zero and their rotation
+    // is reset; every other stream of [first, first + n) is for the caller to fill.
+    std::size_t allocate(std::size_t & n, std::uint32_t emitter);
+
+    // Advances every particle by dt and kills the ones past their lifetime or
+    // their ceiling. If `render` is given, the kernel also writes every live
+    // particle's packed form there, `capacity()` entries at most. Particles
+    // that end up inside the `collider` are pushed out along its gradient and
+    // bounce off it, at the cost of one trilinear lookup per particle.
+    void update(float dt, std::span<emitter_parameters const> emitters, thread_pool & pool,
+        packed_particle * render = nullptr, signed_distance_field const * collider = nullptr);
+
+    // Writes the packed particles without simulating, e.g. while paused
+    void pack(packed_particle * render, thread_pool & pool) const;
+
+    particle_stream position_x, position_y, position_z;
+    particle_stream velocity_x, velocity_y, velocity_z;
+    particle_stream base_size, size, rotation;
+    particle_stream angular_velocity;
+    particle_stream age, lifetime;
+    particle_stream ceiling_height;
+    particle_index_stream emitter;
+
+private:
+    std::size_t count = 0;
+
+    // Per-emitter tables for the kernel, rebuilt every update
+    std::vector<float> lift_table, drag_table, bounce_table, curve_table;
+
+    // Particles that died in the last update, chunk_size slots per chunk
+    std::vector<std::uint32_t> dead;
+    std::vector<std::uint32_t> dead_count;
+
+    void update_range(std::size_t chunk, float dt, packed_particle * render, signed_distance_field const * collider);
+    void pack_range(std::size_t begin, std::size_t end, packed_particle * render) const;
+    void remove_dead(packed_particle * render);
+};
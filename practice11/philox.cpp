@@ -0,0 +1,80 @@
+#include "philox.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+namespace
+{
+
+    // Low and high halves of the 32x32 bit products in all eight lanes
+    void mulhilo(__m256i a, __m256i multiplier, __m256i & lo, __m256i & hi)
+    {
+        __m256i const even = _mm256_mul_epu32(a, multiplier);
+        __m256i const odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier);
+        lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+        hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    }
+
+}
+#endif
+
+void philox_stream::fill(std::uint32_t * out, std::size_t n)
+{
+    std::uint32_t * const end = out + n;
+
+    // Whatever is left of the current block comes first
+    while (used < 4 && out < end)
+        *out++ = values[used++];
+
+#ifdef __AVX2__
+    __m256i const m0 = _mm256_set1_epi32(0xD2511F53u);
+    __m256i const m1 = _mm256_set1_epi32(0xCD9E8D57u);
+    __m256i const lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    // AVX2 only compares signed integers
+    __m256i const sign = _mm256_set1_epi32(0x80000000u);
+
+    for (; end - out >= 32; out += 32, position += 8)
+    {
+        // Eight consecutive 64-bit counters, one per lane, split in low and high words
+        __m256i const low = _mm256_set1_epi32(std::uint32_t(position));
+        __m256i c0 = _mm256_add_epi32(low, lanes);
+        __m256i const carry = _mm256_cmpgt_epi32(_mm256_xor_si256(low, sign), _mm256_xor_si256(c0, sign));
+        __m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32(std::uint32_t(position >> 32)), carry);
+        __m256i c2 = _mm256_set1_epi32(id);
+        __m256i c3 = _mm256_setzero_si256();
+
+        std::uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round)
+        {
+            __m256i lo0, hi0, lo1, hi1;
+            mulhilo(c0, m0, lo0, hi0);
+            mulhilo(c2, m1, lo1, hi1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(k0));
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(k1));
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+
+        // Transpose so that every block's four words are adjacent, as next() returns them
+        __m256i const t0 = _mm256_unpacklo_epi32(c0, c1);
+        __m256i const t1 = _mm256_unpackhi_epi32(c0, c1);
+        __m256i const t2 = _mm256_unpacklo_epi32(c2, c3);
+        __m256i const t3 = _mm256_unpackhi_epi32(c2, c3);
+        __m256i const b04 = _mm256_unpacklo_epi64(t0, t2);
+        __m256i const b15 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i const b26 = _mm256_unpacklo_epi64(t1, t3);
+        __m256i const b37 = _mm256_unpackhi_epi64(t1, t3);
+
+        auto * const target = reinterpret_cast<__m256i *>(out);
+        _mm256_storeu_si256(target + 0, _mm256_permute2x128_si256(b04, b15, 0x20));
+        _mm256_storeu_si256(target + 1, _mm256_permute2x128_si256(b26, b37, 0x20));
+        _mm256_storeu_si256(target + 2, _mm256_permute2x128_si256(b04, b15, 0x31));
+        _mm256_storeu_si256(target + 3, _mm256_permute2x128_si256(b26, b37, 0x31));
+    }
+#endif
+
+    while (out < end)
+        *out++ = next();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). The output is a pure function of the key and
+// the counter, so independent streams only need different counters and
+// there is no state to share between threads.
+struct philox
+{
+    using block = std::array<std::uint32_t, 4>;
+
+    static block generate(block counter, std::array<std::uint32_t, 2> key)
+    {
+        for (int round = 0; round < 10; ++round)
+        {
+            std::uint64_t const product0 = std::uint64_t(0xD2511F53u) * counter[0];
+            std::uint64_t const product1 = std::uint64_t(0xCD9E8D57u) * counter[2];
+            counter = {
+                std::uint32_t(product1 >> 32) ^ counter[1] ^ key[0],
+                std::uint32_t(product1),
+                std::uint32_t(product0 >> 32) ^ counter[3] ^ key[1],
+                std::uint32_t(product0),
+            };
+            key[0] += 0x9E3779B9u;
+            key[1] += 0xBB67AE85u;
+        }
+        return counter;
+    }
+};
+
+// One random stream: the stream id and a running position fill the counter
+struct philox_stream
+{
+    philox_stream() = default;
+
+    philox_stream(std::uint64_t seed, std::uint32_t id)
+        : key{std::uint32_t(seed), std::uint32_t(seed >> 32)}
+        , id(id)
+    {}
+
+    std::uint32_t next()
+    {
+        if (used == 4)
+        {
+            values = philox::generate({std::uint32_t(position), std::uint32_t(position >> 32), id, 0}, key);
+            ++position;
+            used = 0;
+        }
+        return values[used++];
+    }
+
+    // Same values as n calls to next(), eight counters at a time with AVX2
+    void fill(std::uint32_t * out, std::size_t n);
+
+    // Uniform over [min, max] with the 24 bits a float can hold; rounding can
+    // reach max itself
+    float uniform(float min, float max)
+    {
+        return to_uniform(next(), min, max);
+    }
+
+    static float to_uniform(std::uint32_t bits, float min, float max)
+    {
+        return min + (max - min) * ((bits >> 8) * 0x1p-24f);
+    }
+
+private:
+    std::array<std::uint32_t, 2> key{};
+    std::uint32_t id = 0;
+    std::uint64_t position = 0;
+    philox::block values{};
+    int used = 4;
+};
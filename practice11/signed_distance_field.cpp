@@ -0,0 +1,334 @@
+#include "signed_distance_field.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+
+namespace
+{
+
+    // Grid points around the mesh's bounding box, so that the border is outside
+    constexpr int padding = 2;
+
+    // Grid points around a triangle's bounding box that get exact distances
+    constexpr int band = 1;
+
+    struct triangle
+    {
+        glm::vec3 a, b, c;
+    };
+
+    // Closest point on a triangle, from Ericson's "Real-Time Collision Detection" 5.1.5
+    glm::vec3 closest_point(glm::vec3 const & p, triangle const & t)
+    {
+        glm::vec3 const ab = t.b - t.a, ac = t.c - t.a, ap = p - t.a;
+        float const d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if (d1 <= 0.f && d2 <= 0.f)
+            return t.a;
+
+        glm::vec3 const bp = p - t.b;
+        float const d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if (d3 >= 0.f && d4 <= d3)
+            return t.b;
+
+        float const vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+            return t.a + ab * (d1 / (d1 - d3));
+
+        glm::vec3 const cp = p - t.c;
+        float const d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if (d6 >= 0.f && d5 <= d6)
+            return t.c;
+
+        float const vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+            return t.a + ac * (d2 / (d2 - d6));
+
+        float const va = d3 * d6 - d5 * d4;
+        if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+            return t.b + (t.c - t.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float const denominator = 1.f / (va + vb + vc);
+        return t.a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+
+    struct grid_bake
+    {
+        signed_distance_field & field;
+        std::vector<triangle> const & triangles;
+
+        std::size_t index(int x, int y, int z) const
+        {
+            return (std::size_t(z) * field.size.y + y) * field.size.x + x;
+        }
+
+        glm::vec3 point(int x, int y, int z) const
+        {
+            return field.origin + glm::vec3(x, y, z) * field.voxel_size;
+        }
+
+        // Grid point range covered by [min, max] grown by `grow` points, clamped to the grid
+        void range(glm::vec3 const & min, glm::vec3 const & max, int grow, glm::ivec3 & lo, glm::ivec3 & hi) const
+        {
+            lo = glm::max(glm::ivec3(glm::floor((min - field.origin) / field.voxel_size)) - grow, glm::ivec3(0));
+            hi = glm::min(glm::ivec3(glm::ceil((max - field.origin) / field.voxel_size)) + grow, field.size - 1);
+        }
+    };
+
+    // Triangles listed under every slice along `axis` that their grown bounding box touches
+    std::vector<std::vector<std::uint32_t>> bin_by_slice(grid_bake const & bake, int axis, int grow)
+    {
+        std::vector<std::vector<std::uint32_t>> bins(bake.field.size[axis]);
+        for (std::size_t i = 0; i < bake.triangles.size(); ++i)
+        {
+            triangle const & t = bake.triangles[i];
+            glm::ivec3 lo, hi;
+            bake.range(glm::min(t.a, glm::min(t.b, t.c)), glm::max(t.a, glm::max(t.b, t.c)), grow, lo, hi);
+            for (int s = lo[axis]; s <= hi[axis]; ++s)
+                bins[s].push_back(i);
+        }
+        return bins;
+    }
+
+    // Exact closest points for the grid points near the triangles, NaN elsewhere.
+    // Every task owns whole z slices, so the writes never overlap.
+    void seed_band(grid_bake const & bake, std::vector<glm::vec3> & closest, thread_pool & pool)
+    {
+        auto const bins = bin_by_slice(bake, 2, band);
+        std::vector<float> best(closest.size(), std::numeric_limits<float>::infinity());
+
+        pool.parallel_for(bake.field.size.z, 1, [&](std::size_t first, std::size_t last)
+        {
+            for (int z = first; z < int(last); ++z)
+                for (std::uint32_t i : bins[z])
+                {
+                    triangle const & t = bake.triangles[i];
+                    glm::ivec3 lo, hi;
+                    bake.range(glm::min(t.a, glm::min(t.b, t.c)), glm::max(t.a, glm::max(t.b, t.c)), band, lo, hi);
+                    for (int y = lo.y; y <= hi.y; ++y)
+                        for (int x = lo.x; x <= hi.x; ++x)
+                        {
+                            glm::vec3 const p = bake.point(x, y, z);
+                            glm::vec3 const q = closest_point(p, t);
+                            glm::vec3 const d = p - q;
+                            float const d2 = glm::dot(d, d);
+                            std::size_t const v = bake.index(x, y, z);
+                            if (d2 < best[v])
+                            {
+                                best[v] = d2;
+                                closest[v] = q;
+                            }
+                        }
+                }
+        });
+    }
+
+    // Jump flooding (Rong and Tan, "Jump Flooding in GPU with Applications to
+    // Voronoi Diagram and Distance Transform"): every grid point looks at the
+    // closest points of the 26 points `step` away, halving the step down to one,
+    // followed by one more pass with a step of one to fix most of its errors
+    void jump_flood(grid_bake const & bake, std::vector<glm::vec3> & closest, thread_pool & pool)
+    {
+        glm::ivec3 const size = bake.field.size;
+        std::vector<glm::vec3> next(closest.size());
+
+        int step = 1;
+        while (step * 2 < std::max({size.x, size.y, size.z}))
+            step *= 2;
+
+        std::vector<int> steps;
+        for (; step >= 1; step /= 2)
+            steps.push_back(step);
+        steps.push_back(1);
+
+        for (int s : steps)
+        {
+            pool.parallel_for(size.z, 1, [&](std::size_t first, std::size_t last)
+            {
+                for (int z = first; z < int(last); ++z)
+                    for (int y = 0; y < size.y; ++y)
+                        for (int x = 0; x < size.x; ++x)
+                        {
+                            glm::vec3 const p = bake.point(x, y, z);
+                            glm::vec3 best = closest[bake.index(x, y, z)];
+                            float best_d2 = std::isnan(best.x) ? std::numeric_limits<float>::infinity()
+                                : glm::dot(p - best, p - best);
+
+                            for (int dz = -s; dz <= s; dz += s)
+                                for (int dy = -s; dy <= s; dy += s)
+                                    for (int dx = -s; dx <= s; dx += s)
+                                    {
+                                        int const nx = x + dx, ny = y + dy, nz = z + dz;
+                                        if (nx < 0 || ny < 0 || nz < 0 || nx >= size.x || ny >= size.y || nz >= size.z)
+                                            continue;
+                                        glm::vec3 const q = closest[bake.index(nx, ny, nz)];
+                                        if (std::isnan(q.x))
+                                            continue;
+                                        float const d2 = glm::dot(p - q, p - q);
+                                        if (d2 < best_d2)
+                                        {
+                                            best_d2 = d2;
+                                            best = q;
+                                        }
+                                    }
+
+                            next[bake.index(x, y, z)] = best;
+                        }
+            });
+            closest.swap(next);
+        }
+    }
+
+    // Adds one to the votes of the grid points that an odd number of triangles
+    // cross on a ray towards -infinity along `axis`. The rays are shifted off
+    // the grid points by an odd fraction of a voxel so that they rarely pass
+    // exactly through an edge or a vertex.
+    void vote_inside(grid_bake const & bake, int axis, std::vector<std::uint8_t> & votes, thread_pool & pool)
+    {
+        int const u = axis, v = (axis + 1) % 3, w = (axis + 2) % 3;
+        glm::ivec3 const size = bake.field.size;
+        float const shift = 0.0137f * bake.field.voxel_size;
+
+        auto const bins = bin_by_slice(bake, w, 0);
+
+        pool.parallel_for(size[w], 1, [&](std::size_t first, std::size_t last)
+        {
+            std::vector<std::vector<float>> hits(size[v]);
+            for (int sw = first; sw < int(last); ++sw)
+            {
+                for (auto & row : hits)
+                    row.clear();
+
+                float const pw = bake.field.origin[w] + sw * bake.field.voxel_size + shift;
+                for (std::uint32_t i : bins[sw])
+                {
+                    triangle const & t = bake.triangles[i];
+                    glm::ivec3 lo, hi;
+                    bake.range(glm::min(t.a, glm::min(t.b, t.c)), glm::max(t.a, glm::max(t.b, t.c)), 0, lo, hi);
+
+                    // Barycentric coordinates in the plane across the rays
+                    glm::vec2 const a{t.a[v], t.a[w]}, b{t.b[v], t.b[w]}, c{t.c[v], t.c[w]};
+                    float const area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+                    if (area == 0.f)
+                        continue;
+
+                    for (int sv = lo[v]; sv <= hi[v]; ++sv)
+                    {
+                        glm::vec2 const p{bake.field.origin[v] + sv * bake.field.voxel_size + shift, pw};
+                        float const l1 = ((p.x - a.x) * (c.y - a.y) - (c.x - a.x) * (p.y - a.y)) / area;
+                        float const l2 = ((b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y)) / area;
+                        if (l1 < 0.f || l2 < 0.f || l1 + l2 > 1.f)
+                            continue;
+                        hits[sv].push_back(t.a[u] + l1 * (t.b[u] - t.a[u]) + l2 * (t.c[u] - t.a[u]));
+                    }
+                }
+
+                for (int sv = 0; sv < size[v]; ++sv)
+                {
+                    auto & row = hits[sv];
+                    std::sort(row.begin(), row.end());
+
+                    std::size_t crossed = 0;
+                    for (int su = 0; su < size[u]; ++su)
+                    {
+                        float const pu = bake.field.origin[u] + su * bake.field.voxel_size;
+                        while (crossed < row.size() && row[crossed] < pu)
+                            ++crossed;
+
+                        glm::ivec3 g;
+                        g[u] = su;
+                        g[v] = sv;
+                        g[w] = sw;
+                        votes[bake.index(g.x, g.y, g.z)] += crossed % 2;
+                    }
+                }
+            }
+        });
+    }
+
+}
+
+float signed_distance_field::sample(glm::vec3 const & point, glm::vec3 & gradient) const
+{
+    glm::vec3 const g = glm::clamp((point - origin) / voxel_size, glm::vec3(0.f), glm::vec3(size - 1) - 1e-3f);
+    glm::ivec3 const i = glm::ivec3(g);
+    glm::vec3 const f = g - glm::vec3(i);
+
+    float const c000 = at(i.x, i.y, i.z), c100 = at(i.x + 1, i.y, i.z);
+    float const c010 = at(i.x, i.y + 1, i.z), c110 = at(i.x + 1, i.y + 1, i.z);
+    float const c001 = at(i.x, i.y, i.z + 1), c101 = at(i.x + 1, i.y, i.z + 1);
+    float const c011 = at(i.x, i.y + 1, i.z + 1), c111 = at(i.x + 1, i.y + 1, i.z + 1);
+
+    // Interpolated along x first, then y, then z
+    float const c00 = c000 + (c100 - c000) * f.x, c10 = c010 + (c110 - c010) * f.x;
+    float const c01 = c001 + (c101 - c001) * f.x, c11 = c011 + (c111 - c011) * f.x;
+    float const c0 = c00 + (c10 - c00) * f.y, c1 = c01 + (c11 - c01) * f.y;
+
+    float const dx00 = c100 - c000, dx10 = c110 - c010, dx01 = c101 - c001, dx11 = c111 - c011;
+    float const dx0 = dx00 + (dx10 - dx00) * f.y, dx1 = dx01 + (dx11 - dx01) * f.y;
+    gradient.x = (dx0 + (dx1 - dx0) * f.z) / voxel_size;
+    gradient.y = ((c10 - c00) + ((c11 - c01) - (c10 - c00)) * f.z) / voxel_size;
+    gradient.z = (c1 - c0) / voxel_size;
+
+    return c0 + (c1 - c0) * f.z;
+}
+
+signed_distance_field bake_sdf(obj_data const & mesh, int resolution, thread_pool & pool)
+{
+    if (mesh.indices.empty())
+        throw std::runtime_error("Can't bake a distance field of an empty mesh");
+
+    std::vector<triangle> triangles;
+    glm::vec3 min{std::numeric_limits<float>::infinity()}, max{-std::numeric_limits<float>::infinity()};
+    for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        auto position = [&](int k)
+        {
+            auto const & p = mesh.vertices[mesh.indices[i + k]].position;
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        triangle const t{position(0), position(1), position(2)};
+        triangles.push_back(t);
+        min = glm::min(min, glm::min(t.a, glm::min(t.b, t.c)));
+        max = glm::max(max, glm::max(t.a, glm::max(t.b, t.c)));
+    }
+
+    signed_distance_field field;
+    glm::vec3 const extent = max - min;
+    field.voxel_size = std::max({extent.x, extent.y, extent.z}) / std::max(resolution - 1, 1);
+    field.origin = min - float(padding) * field.voxel_size;
+    field.size = glm::ivec3(glm::ceil(extent / field.voxel_size)) + 1 + 2 * padding;
+
+    std::size_t const count = std::size_t(field.size.x) * field.size.y * field.size.z;
+    grid_bake const bake{field, triangles};
+
+    std::vector<glm::vec3> closest(count, glm::vec3(std::numeric_limits<float>::quiet_NaN()));
+    seed_band(bake, closest, pool);
+    jump_flood(bake, closest, pool);
+
+    std::vector<std::uint8_t> votes(count, 0);
+    for (int axis = 0; axis < 3; ++axis)
+        vote_inside(bake, axis, votes, pool);
+
+    field.distances.resize(count);
+    pool.parallel_for(field.size.z, 1, [&](std::size_t first, std::size_t last)
+    {
+        for (int z = first; z < int(last); ++z)
+            for (int y = 0; y < field.size.y; ++y)
+                for (int x = 0; x < field.size.x; ++x)
+                {
+                    std::size_t const v = bake.index(x, y, z);
+                    float const distance = glm::length(bake.point(x, y, z) - closest[v]);
+                    field.distances[v] = votes[v] >= 2 ? -distance : distance;
+                }
+    });
+
+    return field;
+}
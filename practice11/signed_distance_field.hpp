@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "obj_parser.hpp"
+#include "thread_pool.hpp"
+
+// Distances to a closed mesh on a regular grid, negative inside. Between the
+// grid points the distance is interpolated trilinearly; outside the grid it is
+// the distance at the nearest border point, which the padding keeps positive.
+struct signed_distance_field
+{
+    // Position of grid point (0, 0, 0)
+    glm::vec3 origin{0.f};
+    float voxel_size = 1.f;
+    glm::ivec3 size{0};
+
+    // x fastest, then y, then z
+    std::vector<float> distances;
+
+    float at(int x, int y, int z) const
+    {
+        return distances[(std::size_t(z) * size.y + y) * size.x + x];
+    }
+
+    // Trilinear distance at a point, and its gradient from the same eight grid points
+    float sample(glm::vec3 const & point, glm::vec3 & gradient) const;
+};
+
+// Voxelizes a mesh into a grid with `resolution` points along its longest side,
+// plus a border of a few points all around. Distances near the triangles are
+// exact, the closest surface points are then spread over the rest of the grid
+// by jump flooding. The sign comes from a majority vote of inside-outside
+// parity along rays in x, y and z, which tolerates a few holes in the mesh.
+signed_distance_field bake_sdf(obj_data const & mesh, int resolution, thread_pool & pool);
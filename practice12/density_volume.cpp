@@ -0,0 +1,35 @@
+#include "density_volume.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    constexpr std::size_t padding = 4;
+
+}
+
+density_volume load_density_volume(std::filesystem::path const & path, glm::ivec3 const & size)
+{
+    // Trilinear sampling needs two voxels along every axis
+    if (size.x < 2 || size.y < 2 || size.z < 2)
+        throw std::runtime_error("Volume is too small: " + path.string());
+
+    density_volume result;
+    result.size = size;
+    result.bbox_max = glm::vec3(size) / 100.f;
+    result.bbox_min = -result.bbox_max;
+
+    std::size_t const count = std::size_t(size.x) * size.y * size.z;
+    result.densities.assign(count + padding, 0);
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("Failed to open " + path.string());
+    if (!input.read(reinterpret_cast<char *>(result.densities.data()), count))
+        throw std::runtime_error("Volume is shorter than its size: " + path.string());
+
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+// 8-bit densities on a regular grid, laid out like the GL_R8 3D texture they
+// are uploaded to: x fastest, then y, then z
+struct density_volume
+{
+    glm::ivec3 size{0};
+
+    // The box the volume fills in world space
+    glm::vec3 bbox_min{0.f};
+    glm::vec3 bbox_max{0.f};
+
+    // Followed by a few zero bytes, so that samplers can read any voxel as
+    // the first byte of a 32-bit word
+    std::vector<std::uint8_t> densities;
+
+    std::uint8_t at(int x, int y, int z) const
+    {
+        return densities[(std::size_t(z) * size.y + y) * size.x + x];
+    }
+};
+
+// Reads size.x * size.y * size.z bytes of raw densities. The box is centered
+// at the origin and one voxel is 1/50 wide, as in the viewer.
+density_volume load_density_volume(std::filesystem::path const & path, glm::ivec3 const & size);
@@ -0,0 +1,43 @@
+#include "macro_grid.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    constexpr std::size_t padding = 4;
+
+}
+
+macro_grid build_macro_grid(density_volume const & volume, int cell_size)
+{
+    if (cell_size <= 0)
+        throw std::runtime_error("Bad macro cell size " + std::to_string(cell_size));
+
+    // Texel coordinates run from 0 to size - 1
+    glm::ivec3 const last = volume.size - 1;
+
+    macro_grid result;
+    result.cell_size = cell_size;
+    result.cells = (last + cell_size - 1) / cell_size;
+    result.maxima.assign(std::size_t(result.cells.x) * result.cells.y * result.cells.z + padding, 0);
+
+    for (int k = 0; k < result.cells.z; ++k)
+        for (int j = 0; j < result.cells.y; ++j)
+            for (int i = 0; i < result.cells.x; ++i)
+            {
+                std::uint8_t maximum = 0;
+                for (int z = k * cell_size; z <= std::min((k + 1) * cell_size, last.z); ++z)
+                    for (int y = j * cell_size; y <= std::min((j + 1) * cell_size, last.y); ++y)
+                    {
+                        auto const row = volume.densities.begin() + (std::size_t(z) * volume.size.y + y) * volume.size.x;
+                        maximum = std::max(maximum, *std::max_element(row + i * cell_size,
+                            row + std::min((i + 1) * cell_size, last.x) + 1));
+                    }
+                result.maxima[(std::size_t(k) * result.cells.y + j) * result.cells.x + i] = maximum;
+            }
+
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "density_volume.hpp"
+
+// The largest density around each block of cell_size^3 texels of a volume.
+// Cell (i, j, k) covers texel coordinates [i, i + 1) * cell_size and so on,
+// with texel centers at whole numbers; its maximum is taken over every voxel
+// that trilinear samples there can read, one more along each axis. The first
+// and last cells of each axis also cover the clamped coordinates past the
+// outermost texel centers. Samples in a cell with a zero maximum are zero, so
+// marchers can step over such cells without changing their result.
+struct macro_grid
+{
+    int cell_size = 0;
+    glm::ivec3 cells{0};
+
+    // x fastest, followed by a few zero bytes like density_volume::densities
+    std::vector<std::uint8_t> maxima;
+
+    std::uint8_t at(int x, int y, int z) const
+    {
+        return maxima[(std::size_t(z) * cells.y + y) * cells.x + x];
+    }
+};
+
+macro_grid build_macro_grid(density_volume const & volume, int cell_size);
@@ -27,8 +27,11 @@
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 
+#include "density_volume.hpp"
+#include "macro_grid.hpp"
 #include "obj_parser.hpp"
 #include "stb_image.h"
+#include "volume_benchmark.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -74,6 +77,9 @@ uniform vec3 light_direction;
 uniform vec3 bbox_min;
 uniform vec3 bbox_max;
 uniform sampler3D cloud_texture;
+// The largest density around each cell of macro_cell_size^3 texels
+uniform sampler3D macro_texture;
+uniform float macro_cell_size;
 
 layout (location = 0) out vec4 out_color;
 
@@ -113,6 +119,39 @@ vec2 intersect_bbox(vec3 origin, vec3 direction)
     return vec2(vmax(tmin), vmin(tmax));
 }
 
+// Texel coordinates, with texel centers at whole numbers like in linear filtering
+vec3 to_texels(vec3 p)
+{
+    return to_texture_coords(p) * vec3(textureSize(cloud_texture, 0)) - 0.5;
+}
+
+// The first sample from sample i on that is not in an empty macro cell. An
+// empty cell is left through the nearest of its far faces; the first and last
+// cells of an axis reach to infinity, as they also hold the clamped samples.
+float next_sample(vec3 origin, vec3 direction, float start, float dt, float i, float count)
+{
+    vec3 texel_origin = to_texels(origin);
+    vec3 texel_direction = direction * vec3(textureSize(cloud_texture, 0)) / (bbox_max - bbox_min);
+    vec3 inverse_direction = clamp(1.0 / texel_direction, vec3(-1e30), vec3(1e30));
+    vec3 max_texel = vec3(textureSize(cloud_texture, 0) - 1);
+    ivec3 max_cell = textureSize(macro_texture, 0) - 1;
+
+    while (i < count)
+    {
+        vec3 u = clamp(texel_origin + texel_direction * (start + (i + 0.5) * dt), vec3(0.0), max_texel);
+        ivec3 cell = min(ivec3(u / macro_cell_size), max_cell);
+        if (texelFetch(macro_texture, cell, 0).x > 0.0)
+            break;
+
+        vec3 lo = mix(vec3(cell) * macro_cell_size, vec3(-1e30), equal(cell, ivec3(0)));
+        vec3 hi = mix(vec3(cell + 1) * macro_cell_size, vec3(1e30), equal(cell, max_cell));
+        vec3 far = mix(lo, hi, greaterThan(inverse_direction, vec3(0.0)));
+        float exit = vmin((far - texel_origin) * inverse_direction);
+        i = max(i + 1.0, ceil((exit - start) / dt - 0.5));
+    }
+    return i;
+}
+
 const float PI = 3.1415926535;
 
 in vec3 position;
@@ -134,8 +173,12 @@ void main()
     float density = 0;
     vec3 optical_depth = vec3(0);
     const float N = 64, M = 16;
+    // Rays stop once less than this much light gets through them
+    const float min_transmittance = 0.001;
+    float max_optical_depth = -log(min_transmittance);
     float dt = (tmax - tmin) / N;
-    for(int i = 0; i < N; i++) {
+    for(float i = next_sample(camera_position, direction, tmin, dt, 0.0, N); i < N;
+        i = next_sample(camera_position, direction, tmin, dt, i + 1.0, N)) {
         float t = tmin + (i + 0.5) * dt;
         vec3 p = camera_position + direction * t;
         density = texture(cloud_texture, to_texture_coords(p)).x;
@@ -146,15 +189,20 @@ void main()
         float light_tmin = max(0, light_minmax.x);
         float light_tmax = light_minmax.y;
         float light_dt = (light_tmax - light_tmin) / M;
-        for(int j = 0; j < M; j++) {
+        for(float j = next_sample(p, light_direction, light_tmin, light_dt, 0.0, M); j < M;
+            j = next_sample(p, light_direction, light_tmin, light_dt, j + 1.0, M)) {
             float light_t = light_tmin + (j + 0.5) * light_dt;
             vec3 light_p = p + light_direction * light_t;
             float light_density = texture(cloud_texture, to_texture_coords(light_p)).x;
             light_optical_depth += extinction * light_density * light_dt;
+            if (vmin(light_optical_depth) > max_optical_depth)
+                break;
         }
         color += (ambient_light + light_color * exp(-light_optical_depth))
         * exp(-optical_depth) * dt * density
         * scattering / 4.0 / PI;
+        if (vmin(optical_depth) > max_optical_depth)
+            break;
     }
     vec3 opacity = 1.0 - exp(-optical_depth);
     color = mix(vec3(0.6, 0.8, 1.0), color, opacity);
@@ -217,9 +265,17 @@ static std::uint32_t cube_indices[]{// -Z
                                     // +X
                                     1, 3, 5, 5, 3, 7};
 
-int main()
+int main(int argc, char **argv)
 try
 {
+  // --reference renders the cloud on the CPU without a window and exits
+  auto const reference_options = parse_volume_benchmark_options(argc, argv);
+  if (reference_options.reference)
+  {
+    run_volume_benchmark(reference_options);
+    return EXIT_SUCCESS;
+  }
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     sdl2_fail("SDL_Init: ");
 
@@ -266,6 +322,10 @@ try
       glGetUniformLocation(program, "camera_position");
   GLuint light_direction_location =
       glGetUniformLocation(program, "light_direction");
+  GLuint cloud_texture_location = glGetUniformLocation(program, "cloud_texture");
+  GLuint macro_texture_location = glGetUniformLocation(program, "macro_texture");
+  GLuint macro_cell_size_location =
+      glGetUniformLocation(program, "macro_cell_size");
 
   GLuint vao, vbo, ebo;
   glGenVertexArrays(1, &vao);
@@ -298,18 +358,33 @@ try
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
   const std::uint32_t WIDTH = 126, HEIGHT = 86, DEPTH = 154;
-  std::vector<char> pixels(WIDTH * HEIGHT * DEPTH);
-  std::ifstream input(cloud_data_path);
-  assert(input.is_open());
-  input.read(pixels.data(), pixels.size());
+  const density_volume cloud =
+      load_density_volume(cloud_data_path, {WIDTH, HEIGHT, DEPTH});
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, WIDTH, HEIGHT, DEPTH, 0, GL_RED,
-               GL_UNSIGNED_BYTE, pixels.data());
+               GL_UNSIGNED_BYTE, cloud.densities.data());
+
+  // Lets the shader leap over the empty parts of the volume
+  const macro_grid cloud_macro_grid = build_macro_grid(cloud, 4);
+
+  GLuint macro_texture;
+  glGenTextures(1, &macro_texture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_3D, macro_texture);
+
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-  const glm::ivec3 cloud_texture_size{WIDTH, HEIGHT, DEPTH};
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, cloud_macro_grid.cells.x,
+               cloud_macro_grid.cells.y, cloud_macro_grid.cells.z, 0, GL_RED,
+               GL_UNSIGNED_BYTE, cloud_macro_grid.maxima.data());
+  glActiveTexture(GL_TEXTURE0);
 
-  const glm::vec3 cloud_bbox_max = glm::vec3(cloud_texture_size) / 100.f;
-  const glm::vec3 cloud_bbox_min = -cloud_bbox_max;
+  const glm::vec3 cloud_bbox_max = cloud.bbox_max;
+  const glm::vec3 cloud_bbox_min = cloud.bbox_min;
 
   auto last_frame_start = std::chrono::high_resolution_clock::now();
 
@@ -423,6 +498,9 @@ try
                  reinterpret_cast<float *>(&camera_position));
     glUniform3fv(light_direction_location, 1,
                  reinterpret_cast<float *>(&light_direction));
+    glUniform1i(cloud_texture_location, 0);
+    glUniform1i(macro_texture_location, 1);
+    glUniform1f(macro_cell_size_location, cloud_macro_grid.cell_size);
 
     glBindVertexArray(vao);
     glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT,
@@ -0,0 +1,143 @@
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+    // Largest length of a stored deflate block
+    constexpr std::size_t max_stored_block = 65535;
+
+    std::array<std::uint32_t, 256> const crc_table = []
+    {
+        std::array<std::uint32_t, 256> table;
+        for (std::uint32_t n = 0; n < 256; ++n)
+        {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    std::uint32_t crc32(std::uint8_t const * data, std::size_t size, std::uint32_t crc = 0)
+    {
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i)
+            crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    struct adler32
+    {
+        std::uint32_t a = 1, b = 0;
+
+        void add(std::uint8_t const * data, std::size_t size)
+        {
+            // 5552 bytes is the most that can be summed before b can overflow
+            while (size > 0)
+            {
+                std::size_t const n = std::min<std::size_t>(size, 5552);
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    a += data[i];
+                    b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+                data += n;
+                size -= n;
+            }
+        }
+
+        std::uint32_t value() const { return (b << 16) | a; }
+    };
+
+    void put_u32(std::vector<std::uint8_t> & out, std::uint32_t value)
+    {
+        out.push_back(value >> 24);
+        out.push_back(value >> 16);
+        out.push_back(value >> 8);
+        out.push_back(value);
+    }
+
+    void put_chunk(std::ofstream & out, char const (&type)[5], std::vector<std::uint8_t> const & data)
+    {
+        std::vector<std::uint8_t> header;
+        put_u32(header, data.size());
+        header.insert(header.end(), type, type + 4);
+
+        std::uint32_t const crc = crc32(data.data(), data.size(), crc32(header.data() + 4, 4));
+        std::vector<std::uint8_t> footer;
+        put_u32(footer, crc);
+
+        out.write(reinterpret_cast<char const *>(header.data()), header.size());
+        out.write(reinterpret_cast<char const *>(data.data()), data.size());
+        out.write(reinterpret_cast<char const *>(footer.data()), footer.size());
+    }
+
+}
+
+void write_png(std::filesystem::path const & path, int width, int height, std::span<std::uint8_t const> rgb)
+{
+    std::size_t const row_size = std::size_t(width) * 3;
+    if (width <= 0 || height <= 0 || rgb.size() != row_size * height)
+        throw std::runtime_error("Bad image size for " + path.string());
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    static std::uint8_t const signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.write(reinterpret_cast<char const *>(signature), sizeof(signature));
+
+    std::vector<std::uint8_t> header;
+    put_u32(header, width);
+    put_u32(header, height);
+    // 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    put_chunk(out, "IHDR", header);
+
+    // Every row starts with its filter type, 0 for none
+    std::vector<std::uint8_t> scanlines;
+    scanlines.reserve((row_size + 1) * height);
+    for (int y = 0; y < height; ++y)
+    {
+        scanlines.push_back(0);
+        scanlines.insert(scanlines.end(), rgb.begin() + y * row_size, rgb.begin() + (y + 1) * row_size);
+    }
+
+    // A zlib stream of stored blocks: each is a byte with the final block flag,
+    // then its length and the length's complement, little endian
+    std::vector<std::uint8_t> data;
+    std::size_t const blocks = std::max<std::size_t>(1, (scanlines.size() + max_stored_block - 1) / max_stored_block);
+    data.reserve(scanlines.size() + blocks * 5 + 6);
+    data.push_back(0x78);
+    data.push_back(0x01);
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        std::size_t const begin = block * max_stored_block;
+        std::size_t const size = std::min(max_stored_block, scanlines.size() - begin);
+        data.push_back(block + 1 == blocks);
+        data.push_back(size);
+        data.push_back(size >> 8);
+        data.push_back(~size);
+        data.push_back(~size >> 8);
+        data.insert(data.end(), scanlines.begin() + begin, scanlines.begin() + begin + size);
+    }
+    adler32 checksum;
+    checksum.add(scanlines.data(), scanlines.size());
+    put_u32(data, checksum.value());
+    put_chunk(out, "IDAT", data);
+
+    put_chunk(out, "IEND", {});
+
+    if (!out)
+        throw std::runtime_error("Failed to write " + path.string());
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// Writes 8-bit RGB pixels, rows top to bottom, as a PNG. The image data is
+// stored without compression, which every PNG reader accepts and which is
+// fast enough for reference images and benchmark output.
+void write_png(std::filesystem::path const & path, int width, int height, std::span<std::uint8_t const> rgb);
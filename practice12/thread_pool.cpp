@@ -0,0 +1,88 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+thread_pool::thread_pool(std::size_t thread_count)
+{
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    for (std::size_t i = 1; i < thread_count; ++i)
+        workers.emplace_back([this]{ worker_loop(); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+
+    for (auto & worker : workers)
+        worker.join();
+}
+
+void thread_pool::parallel_for(std::size_t count, std::size_t grain, task const & f)
+{
+    if (count == 0)
+        return;
+
+    grain = std::max<std::size_t>(grain, 1);
+
+    if (workers.empty() || count <= grain)
+    {
+        f(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        job = &f;
+        job_count = count;
+        job_grain = grain;
+        next_chunk = 0;
+        busy_workers = workers.size();
+        ++job_generation;
+    }
+    job_ready.notify_all();
+
+    run_chunks();
+
+    std::unique_lock lock(mutex);
+    job_done.wait(lock, [this]{ return busy_workers == 0; });
+    job = nullptr;
+}
+
+void thread_pool::run_chunks()
+{
+    std::size_t const chunks = (job_count + job_grain - 1) / job_grain;
+    for (std::size_t chunk; (chunk = next_chunk++) < chunks;)
+    {
+        std::size_t const begin = chunk * job_grain;
+        std::size_t const end = std::min(begin + job_grain, job_count);
+        (*job)(begin, end);
+    }
+}
+
+void thread_pool::worker_loop()
+{
+    std::size_t seen_generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock lock(mutex);
+            job_ready.wait(lock, [&]{ return stopping || job_generation != seen_generation; });
+            if (stopping)
+                return;
+            seen_generation = job_generation;
+        }
+
+        run_chunks();
+
+        {
+            std::lock_guard lock(mutex);
+            if (--busy_workers == 0)
+                job_done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,261 @@
+#include "volume_benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/matrix.hpp>
+
+#include "density_volume.hpp"
+#include "macro_grid.hpp"
+#include "png_writer.hpp"
+#include "stb_image.h"
+#include "volume_renderer.hpp"
+
+namespace
+{
+
+    // "<a>x<b>..." with exactly `count` positive numbers
+    std::vector<int> parse_dimensions(std::string const & value, int count, std::string const & arg)
+    {
+        std::vector<int> result;
+        std::size_t begin = 0;
+        while (true)
+        {
+            std::size_t const end = value.find('x', begin);
+            std::string const number = value.substr(begin, end - begin);
+            std::size_t used = 0;
+            int const n = number.empty() ? 0 : std::stoi(number, &used);
+            if (used != number.size() || n <= 0)
+                throw std::runtime_error("Bad value after " + arg + ": " + value);
+            result.push_back(n);
+            if (end == std::string::npos)
+                break;
+            begin = end + 1;
+        }
+        if (int(result.size()) != count)
+            throw std::runtime_error("Bad value after " + arg + ": " + value);
+        return result;
+    }
+
+    // The viewer's camera and light before any input
+    volume_view startup_view(float time)
+    {
+        float const view_angle = glm::pi<float>() / 12.f;
+        float const camera_distance = 2.5f;
+        float const camera_rotation = glm::pi<float>() / 2.f;
+
+        glm::mat4 view(1.f);
+        view = glm::translate(view, {0.f, 0.f, -camera_distance});
+        view = glm::rotate(view, view_angle, {1.f, 0.f, 0.f});
+        view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
+        glm::mat4 const inverse_view = glm::inverse(view);
+
+        volume_view result;
+        result.camera_position = glm::vec3(inverse_view[3]);
+        result.camera_rotation = glm::mat3(inverse_view);
+        result.vertical_fov = glm::pi<float>() / 2.f;
+        result.light_direction = glm::normalize(glm::vec3(std::cos(time), 1.f, std::sin(time)));
+        return result;
+    }
+
+    struct image_difference
+    {
+        int max = 0;
+        double mean = 0.0;
+        // Pixels with a channel more than one step off, rounding aside
+        std::size_t pixels = 0;
+    };
+
+    image_difference compare_images(rgb_image const & image, std::filesystem::path const & path)
+    {
+        int width, height, channels;
+        std::uint8_t * const pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 3);
+        if (!pixels)
+            throw std::runtime_error("Failed to load " + path.string());
+        if (width != image.width || height != image.height)
+        {
+            stbi_image_free(pixels);
+            throw std::runtime_error("Image size differs from " + path.string());
+        }
+
+        image_difference result;
+        std::size_t const count = std::size_t(width) * height;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int pixel = 0;
+            for (std::size_t j = i * 3; j < i * 3 + 3; ++j)
+            {
+                int const d = std::abs(int(image.pixels[j]) - int(pixels[j]));
+                pixel = std::max(pixel, d);
+                result.mean += d;
+            }
+            result.max = std::max(result.max, pixel);
+            if (pixel > 1)
+                ++result.pixels;
+        }
+        result.mean /= count * 3;
+
+        stbi_image_free(pixels);
+        return result;
+    }
+
+}
+
+volume_benchmark_options parse_volume_benchmark_options(int argc, char ** argv)
+{
+    volume_benchmark_options result;
+    result.volume = std::filesystem::path(PROJECT_ROOT) / "cloud.data";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--reference")
+            result.reference = value();
+        else if (arg == "--compare")
+            result.compare = value();
+        else if (arg == "--output")
+            result.output = value();
+        else if (arg == "--volume")
+            result.volume = value();
+        else if (arg == "--volume-size")
+        {
+            auto const size = parse_dimensions(value(), 3, arg);
+            result.volume_size = {size[0], size[1], size[2]};
+        }
+        else if (arg == "--size")
+        {
+            auto const size = parse_dimensions(value(), 2, arg);
+            result.width = size[0];
+            result.height = size[1];
+        }
+        else if (arg == "--macro-cell")
+            result.macro_cell_size = std::stoi(value());
+        else if (arg == "--no-skipping")
+            result.skipping = false;
+        else if (arg == "--frames")
+            result.frames = std::stoi(value());
+        else if (arg == "--time")
+            result.time = std::stof(value());
+        else if (arg == "--threads")
+            result.threads = std::stoul(value());
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (result.macro_cell_size <= 0)
+        throw std::runtime_error("--macro-cell must be positive");
+    if (result.frames <= 0)
+        throw std::runtime_error("--frames must be positive");
+
+    return result;
+}
+
+void run_volume_benchmark(volume_benchmark_options const & options)
+{
+    thread_pool pool(options.threads ? options.threads : std::thread::hardware_concurrency());
+    density_volume const volume = load_density_volume(options.volume, options.volume_size);
+    volume_view const view = startup_view(options.time);
+
+    cloud_parameters cloud;
+    std::optional<macro_grid> empty_space;
+    if (options.skipping)
+        empty_space = build_macro_grid(volume, options.macro_cell_size);
+    else
+        cloud.min_transmittance = 0.f;
+
+    rgb_image image;
+    image.width = options.width;
+    image.height = options.height;
+
+    std::vector<double> frame_ms;
+    for (int frame = 0; frame < options.frames; ++frame)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        render_volume(volume, cloud, view, image, pool, empty_space ? &*empty_space : nullptr);
+        frame_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    write_png(*options.reference, image.width, image.height, image.pixels);
+
+    std::vector<double> sorted = frame_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0.0;
+    for (double ms : sorted)
+        mean += ms;
+    mean /= sorted.size();
+    double const median = sorted[sorted.size() / 2];
+    double const rays = double(image.width) * image.height;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << options.volume.filename().string() << ": " << image.width << "x" << image.height << ", "
+        << frame_ms.size() << " frames of " << cloud.camera_steps << "x" << cloud.light_steps << " steps on "
+        << pool.size() << " threads\n";
+    if (empty_space)
+    {
+        std::size_t const empty = std::count(empty_space->maxima.begin(),
+            empty_space->maxima.begin() + empty_space->cells.x * empty_space->cells.y * empty_space->cells.z, 0);
+        std::cout << "skipping " << empty << " empty of " << empty_space->cells.x << "x" << empty_space->cells.y
+            << "x" << empty_space->cells.z << " macro cells of " << empty_space->cell_size
+            << " texels, rays stop below transmittance " << cloud.min_transmittance << '\n';
+    }
+    else
+        std::cout << "no skipping\n";
+    std::cout << "ms per frame\tmean " << mean << "\tp50 " << median << "\tmin " << sorted.front() << "\tmax "
+        << sorted.back() << '\n';
+    std::cout << "rays per second\t" << std::setprecision(0) << rays / mean * 1e3 << '\n';
+
+    std::optional<image_difference> difference;
+    if (options.compare)
+    {
+        difference = compare_images(image, *options.compare);
+        std::cout << std::setprecision(4) << "difference to " << options.compare->string() << "\tmax "
+            << difference->max << "\tmean " << difference->mean << "\tpixels off by more than 1 "
+            << difference->pixels << '\n';
+    }
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (!options.output)
+        return;
+
+    std::ofstream out(*options.output);
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "\"volume\": \"" << options.volume.filename().string() << "\",\n";
+    out << "\"width\": " << image.width << ",\n";
+    out << "\"height\": " << image.height << ",\n";
+    out << "\"threads\": " << pool.size() << ",\n";
+    out << "\"macro_cell_size\": " << (empty_space ? empty_space->cell_size : 0) << ",\n";
+    out << "\"frames\": " << frame_ms.size() << ",\n";
+    out << "\"mean_ms\": " << mean << ",\n";
+    out << "\"p50_ms\": " << median << ",\n";
+    out << "\"rays_per_second\": " << rays / mean * 1e3 << ",\n";
+    if (difference)
+    {
+        out << "\"max_difference\": " << difference->max << ",\n";
+        out << "\"mean_difference\": " << difference->mean << ",\n";
+    }
+    out << "\"frame_ms\": [";
+    for (std::size_t i = 0; i < frame_ms.size(); ++i)
+        out << (i ? ", " : "") << frame_ms[i];
+    out << "]\n}\n";
+}
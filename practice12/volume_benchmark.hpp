@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+#include <glm/vec3.hpp>
+
+struct volume_benchmark_options
+{
+    // Renders on the CPU without a window and writes this PNG when given
+    std::optional<std::filesystem::path> reference;
+    // A previous reference to report the differences to
+    std::optional<std::filesystem::path> compare;
+    std::optional<std::filesystem::path> output;
+
+    // cloud.data of this project by default
+    std::filesystem::path volume;
+    glm::ivec3 volume_size{128, 64, 64};
+
+    // Texels per side of the cells whose maxima let the marcher skip empty
+    // space. Without skipping every ray takes all of its steps, like the
+    // fixed-step shader.
+    int macro_cell_size = 4;
+    bool skipping = true;
+
+    int width = 1920;
+    int height = 1080;
+    int frames = 5;
+    // Seconds since the viewer's start, which turn the light around the cloud
+    float time = 0.f;
+    // All hardware threads by default
+    std::size_t threads = 0;
+};
+
+// --reference <png> [--compare <png>] [--volume <raw> [--volume-size <x>x<y>x<z>]] [--size <w>x<h>]
+//     [--macro-cell <texels> | --no-skipping] [--frames <n>] [--time <s>] [--threads <n>] [--output <json>]
+volume_benchmark_options parse_volume_benchmark_options(int argc, char ** argv);
+
+// Renders the volume as the viewer sees it at startup a few times, prints the
+// frame times and rays per second, writes the last frame to options.reference
+// and the times to options.output if given
+void run_volume_benchmark(volume_benchmark_options const & options);
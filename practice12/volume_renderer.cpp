@@ -0,0 +1,607 @@
+#include "volume_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/common.hpp>
+#include <glm/exponential.hpp>
+#include <glm/geometric.hpp>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+    constexpr float pi = 3.1415926535f;
+
+    constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    constexpr int tile_size = 8;
+
+    // Tiles per task
+    constexpr std::size_t grain = 4;
+
+    // The rays of one tile row
+    constexpr int lanes = tile_size;
+
+    // Positions and directions are in texel coordinates from here on: texel
+    // centers are at whole numbers, like in GL_LINEAR filtering, so the box
+    // spans [-0.5, size - 0.5]. The map from world space is affine, so
+    // distances along the rays stay those of world space.
+    struct ray_batch
+    {
+        alignas(32) float direction_x[lanes];
+        alignas(32) float direction_y[lanes];
+        alignas(32) float direction_z[lanes];
+        // Where the march starts and its step, zero for rays that miss the box
+        alignas(32) float start[lanes];
+        alignas(32) float step[lanes];
+
+        alignas(32) float red[lanes];
+        alignas(32) float green[lanes];
+        alignas(32) float blue[lanes];
+        alignas(32) float depth_red[lanes];
+        alignas(32) float depth_green[lanes];
+        alignas(32) float depth_blue[lanes];
+    };
+
+    // Everything that is the same for all rays of a frame
+    struct march_context
+    {
+        std::uint8_t const * densities;
+        glm::vec3 max_texel;
+        // The lowest corner of the last cell, so that every lookup has a next voxel
+        glm::ivec3 max_cell;
+        int stride_y;
+        int stride_z;
+
+        // Null without empty space skipping
+        std::uint8_t const * macro_maxima;
+        float macro_cell_size;
+        glm::ivec3 max_macro_cell;
+        int macro_stride_y;
+        int macro_stride_z;
+
+        glm::vec3 box_min;
+        glm::vec3 box_max;
+        glm::vec3 camera_position;
+        glm::vec3 light_direction;
+        glm::vec3 inverse_light_direction;
+
+        glm::vec3 extinction;
+        float min_extinction;
+        // Scattering over 4 pi, the phase function of isotropic scattering
+        glm::vec3 phase_scattering;
+        glm::vec3 ambient_light;
+        glm::vec3 light_color;
+        int camera_steps;
+        int light_steps;
+        // Rays stop once the optical depth of every channel is past this
+        float max_depth;
+    };
+
+    // 1 / direction, but finite along the axes, so that a ray in the plane of a
+    // face of the box gets 0 there instead of 0 * inf = NaN
+    glm::vec3 inverse(glm::vec3 const & direction)
+    {
+        return glm::clamp(1.f / direction, glm::vec3(-1e30f), glm::vec3(1e30f));
+    }
+
+    // Entry and exit distances of a ray through the box, like intersect_bbox()
+    // of the shader
+    void intersect_box(march_context const & c, glm::vec3 const & origin, glm::vec3 const & inverse_direction,
+        float & tmin, float & tmax)
+    {
+        glm::vec3 const t0 = (c.box_min - origin) * inverse_direction;
+        glm::vec3 const t1 = (c.box_max - origin) * inverse_direction;
+        glm::vec3 const lo = glm::min(t0, t1), hi = glm::max(t0, t1);
+        tmin = std::max(0.f, std::max(lo.x, std::max(lo.y, lo.z)));
+        tmax = std::min(hi.x, std::min(hi.y, hi.z));
+    }
+
+#ifdef __AVX2__
+
+    struct ray8
+    {
+        __m256 origin_x, origin_y, origin_z;
+        __m256 direction_x, direction_y, direction_z;
+        __m256 inverse_x, inverse_y, inverse_z;
+        __m256 start, step;
+    };
+
+    // Cephes' expf: 2^n times a polynomial on [-ln 2 / 2, ln 2 / 2]
+    __m256 exp8(__m256 x)
+    {
+        x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(88.f)), _mm256_set1_ps(-87.f));
+        __m256 const n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+        __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+
+        __m256i const scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+    }
+
+    __m256 clamp_texel(__m256 u, float max_texel)
+    {
+        // max() first, it returns its second argument for NaN
+        return _mm256_min_ps(_mm256_max_ps(u, _mm256_setzero_ps()), _mm256_set1_ps(max_texel));
+    }
+
+    __m256 lerp(__m256 a, __m256 b, __m256 t)
+    {
+        return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a);
+    }
+
+    // A voxel and the next one along x, from one 32-bit word at each voxel
+    __m256 lerp_x(__m256i word, __m256 t)
+    {
+        __m256i const mask = _mm256_set1_epi32(0xff);
+        __m256 const a = _mm256_cvtepi32_ps(_mm256_and_si256(word, mask));
+        __m256 const b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(word, 8), mask));
+        return lerp(a, b, t);
+    }
+
+    // Trilinear densities at eight points, clamped to the edge like the texture
+    __m256 sample8(march_context const & c, __m256 x, __m256 y, __m256 z)
+    {
+        __m256 const u = clamp_texel(x, c.max_texel.x);
+        __m256 const v = clamp_texel(y, c.max_texel.y);
+        __m256 const w = clamp_texel(z, c.max_texel.z);
+
+        __m256i const iu = _mm256_min_epi32(_mm256_cvttps_epi32(u), _mm256_set1_epi32(c.max_cell.x));
+        __m256i const iv = _mm256_min_epi32(_mm256_cvttps_epi32(v), _mm256_set1_epi32(c.max_cell.y));
+        __m256i const iw = _mm256_min_epi32(_mm256_cvttps_epi32(w), _mm256_set1_epi32(c.max_cell.z));
+        __m256 const fu = _mm256_sub_ps(u, _mm256_cvtepi32_ps(iu));
+        __m256 const fv = _mm256_sub_ps(v, _mm256_cvtepi32_ps(iv));
+        __m256 const fw = _mm256_sub_ps(w, _mm256_cvtepi32_ps(iw));
+
+        __m256i const sy = _mm256_set1_epi32(c.stride_y);
+        __m256i const sz = _mm256_set1_epi32(c.stride_z);
+        __m256i const i00 = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(iw, sz), _mm256_mullo_epi32(iv, sy)), iu);
+        __m256i const i10 = _mm256_add_epi32(i00, sy);
+        __m256i const i01 = _mm256_add_epi32(i00, sz);
+        __m256i const i11 = _mm256_add_epi32(i01, sy);
+
+        int const * const base = reinterpret_cast<int const *>(c.densities);
+        __m256 const c00 = lerp_x(_mm256_i32gather_epi32(base, i00, 1), fu);
+        __m256 const c10 = lerp_x(_mm256_i32gather_epi32(base, i10, 1), fu);
+        __m256 const c01 = lerp_x(_mm256_i32gather_epi32(base, i01, 1), fu);
+        __m256 const c11 = lerp_x(_mm256_i32gather_epi32(base, i11, 1), fu);
+
+        return _mm256_mul_ps(lerp(lerp(c00, c10, fv), lerp(c01, c11, fv), fw), _mm256_set1_ps(1.f / 255.f));
+    }
+
+    // Moves the sample index i of every lane that is still below `count` past
+    // the macro cells with nothing in them, a cell at a time. The exit from a
+    // cell is the nearest of its three far faces; the first and last cells of
+    // an axis reach to infinity there, as they also hold the clamped samples.
+    __m256 next_sample(march_context const & c, ray8 const & r, __m256 i, __m256 count)
+    {
+        if (!c.macro_maxima)
+            return i;
+
+        __m256 const cell_size = _mm256_set1_ps(c.macro_cell_size);
+        __m256 const inverse_cell_size = _mm256_set1_ps(1.f / c.macro_cell_size);
+        int const * const base = reinterpret_cast<int const *>(c.macro_maxima);
+
+        while (true)
+        {
+            __m256 const active = _mm256_cmp_ps(i, count, _CMP_LT_OQ);
+            if (_mm256_movemask_ps(active) == 0)
+                return i;
+
+            __m256 const t = _mm256_fmadd_ps(_mm256_add_ps(i, _mm256_set1_ps(0.5f)), r.step, r.start);
+            auto const cell = [&](__m256 origin, __m256 direction, float max_texel, int max_macro_cell)
+            {
+                __m256 const u = clamp_texel(_mm256_fmadd_ps(direction, t, origin), max_texel);
+                return _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, inverse_cell_size)),
+                    _mm256_set1_epi32(max_macro_cell));
+            };
+            __m256i const cx = cell(r.origin_x, r.direction_x, c.max_texel.x, c.max_macro_cell.x);
+            __m256i const cy = cell(r.origin_y, r.direction_y, c.max_texel.y, c.max_macro_cell.y);
+            __m256i const cz = cell(r.origin_z, r.direction_z, c.max_texel.z, c.max_macro_cell.z);
+
+            __m256i const index = _mm256_add_epi32(_mm256_add_epi32(
+                _mm256_mullo_epi32(cz, _mm256_set1_epi32(c.macro_stride_z)),
+                _mm256_mullo_epi32(cy, _mm256_set1_epi32(c.macro_stride_y))), cx);
+            __m256i const maximum = _mm256_and_si256(_mm256_i32gather_epi32(base, index, 1), _mm256_set1_epi32(0xff));
+            __m256 const empty = _mm256_and_ps(active,
+                _mm256_castsi256_ps(_mm256_cmpeq_epi32(maximum, _mm256_setzero_si256())));
+            if (_mm256_movemask_ps(empty) == 0)
+                return i;
+
+            auto const exit = [&](__m256i cell, __m256 origin, __m256 inverse, int max_macro_cell)
+            {
+                __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(cell), cell_size);
+                __m256 hi = _mm256_add_ps(lo, cell_size);
+                lo = _mm256_blendv_ps(lo, _mm256_set1_ps(-infinity),
+                    _mm256_castsi256_ps(_mm256_cmpeq_epi32(cell, _mm256_setzero_si256())));
+                hi = _mm256_blendv_ps(hi, _mm256_set1_ps(infinity),
+                    _mm256_castsi256_ps(_mm256_cmpeq_epi32(cell, _mm256_set1_epi32(max_macro_cell))));
+                __m256 const far = _mm256_blendv_ps(lo, hi, _mm256_cmp_ps(inverse, _mm256_setzero_ps(), _CMP_GT_OQ));
+                return _mm256_mul_ps(_mm256_sub_ps(far, origin), inverse);
+            };
+            __m256 const t_exit = _mm256_min_ps(exit(cx, r.origin_x, r.inverse_x, c.max_macro_cell.x),
+                _mm256_min_ps(exit(cy, r.origin_y, r.inverse_y, c.max_macro_cell.y),
+                    exit(cz, r.origin_z, r.inverse_z, c.max_macro_cell.z)));
+
+            // The first sample at or past the exit, and always a later one;
+            // max() gives its second argument for NaN
+            __m256 const past = _mm256_ceil_ps(_mm256_sub_ps(
+                _mm256_div_ps(_mm256_sub_ps(t_exit, r.start), r.step), _mm256_set1_ps(0.5f)));
+            i = _mm256_blendv_ps(i, _mm256_max_ps(past, _mm256_add_ps(i, _mm256_set1_ps(1.f))), empty);
+        }
+    }
+
+    // Density times step summed along the light ray from each active lane's
+    // sample to the far side of the box, up to where the light is blocked
+    __m256 light_density(march_context const & c, __m256 px, __m256 py, __m256 pz, __m256 active)
+    {
+        ray8 r;
+        r.origin_x = px;
+        r.origin_y = py;
+        r.origin_z = pz;
+        r.direction_x = _mm256_set1_ps(c.light_direction.x);
+        r.direction_y = _mm256_set1_ps(c.light_direction.y);
+        r.direction_z = _mm256_set1_ps(c.light_direction.z);
+        r.inverse_x = _mm256_set1_ps(c.inverse_light_direction.x);
+        r.inverse_y = _mm256_set1_ps(c.inverse_light_direction.y);
+        r.inverse_z = _mm256_set1_ps(c.inverse_light_direction.z);
+
+        __m256 light_start = _mm256_setzero_ps();
+        __m256 light_end = _mm256_set1_ps(infinity);
+        auto const slab = [&](__m256 p, float lo, float hi, __m256 inverse)
+        {
+            __m256 const t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(lo), p), inverse);
+            __m256 const t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(hi), p), inverse);
+            light_start = _mm256_max_ps(light_start, _mm256_min_ps(t0, t1));
+            light_end = _mm256_min_ps(light_end, _mm256_max_ps(t0, t1));
+        };
+        slab(px, c.box_min.x, c.box_max.x, r.inverse_x);
+        slab(py, c.box_min.y, c.box_max.y, r.inverse_y);
+        slab(pz, c.box_min.z, c.box_max.z, r.inverse_z);
+        r.start = light_start;
+        r.step = _mm256_mul_ps(_mm256_sub_ps(light_end, light_start), _mm256_set1_ps(1.f / c.light_steps));
+
+        __m256 const count = _mm256_and_ps(active, _mm256_set1_ps(c.light_steps));
+        __m256 const max_density = _mm256_set1_ps(c.max_depth / c.min_extinction);
+
+        __m256 density = _mm256_setzero_ps();
+        __m256 j = next_sample(c, r, _mm256_setzero_ps(), count);
+        while (true)
+        {
+            __m256 const sampling = _mm256_cmp_ps(j, count, _CMP_LT_OQ);
+            if (_mm256_movemask_ps(sampling) == 0)
+                break;
+
+            __m256 const t = _mm256_fmadd_ps(_mm256_add_ps(j, _mm256_set1_ps(0.5f)), r.step, r.start);
+            __m256 const s = sample8(c, _mm256_fmadd_ps(r.direction_x, t, px), _mm256_fmadd_ps(r.direction_y, t, py),
+                _mm256_fmadd_ps(r.direction_z, t, pz));
+            density = _mm256_add_ps(density, _mm256_and_ps(_mm256_mul_ps(s, r.step), sampling));
+
+            __m256 const blocked = _mm256_cmp_ps(density, max_density, _CMP_GT_OQ);
+            j = _mm256_blendv_ps(_mm256_add_ps(j, _mm256_set1_ps(1.f)), count, blocked);
+            j = next_sample(c, r, j, count);
+        }
+        return density;
+    }
+
+    // The lanes march on their own: each one skips its empty cells and stops
+    // when it is opaque, and the batch is done when all of them are
+    void march(march_context const & c, ray_batch & rays)
+    {
+        ray8 r;
+        r.origin_x = _mm256_set1_ps(c.camera_position.x);
+        r.origin_y = _mm256_set1_ps(c.camera_position.y);
+        r.origin_z = _mm256_set1_ps(c.camera_position.z);
+        r.direction_x = _mm256_load_ps(rays.direction_x);
+        r.direction_y = _mm256_load_ps(rays.direction_y);
+        r.direction_z = _mm256_load_ps(rays.direction_z);
+        auto const inverse = [](__m256 d)
+        {
+            return _mm256_max_ps(_mm256_min_ps(_mm256_div_ps(_mm256_set1_ps(1.f), d), _mm256_set1_ps(1e30f)),
+                _mm256_set1_ps(-1e30f));
+        };
+        r.inverse_x = inverse(r.direction_x);
+        r.inverse_y = inverse(r.direction_y);
+        r.inverse_z = inverse(r.direction_z);
+        r.start = _mm256_load_ps(rays.start);
+        r.step = _mm256_load_ps(rays.step);
+
+        // No samples at all for the rays that miss the box
+        __m256 const count = _mm256_and_ps(_mm256_cmp_ps(r.step, _mm256_setzero_ps(), _CMP_GT_OQ),
+            _mm256_set1_ps(c.camera_steps));
+        __m256 const max_depth = _mm256_set1_ps(c.max_depth);
+
+        __m256 red = _mm256_setzero_ps(), green = _mm256_setzero_ps(), blue = _mm256_setzero_ps();
+        __m256 depth_red = _mm256_setzero_ps(), depth_green = _mm256_setzero_ps(), depth_blue = _mm256_setzero_ps();
+
+        __m256 i = next_sample(c, r, _mm256_setzero_ps(), count);
+        while (true)
+        {
+            __m256 const active = _mm256_cmp_ps(i, count, _CMP_LT_OQ);
+            if (_mm256_movemask_ps(active) == 0)
+                break;
+
+            __m256 const t = _mm256_fmadd_ps(_mm256_add_ps(i, _mm256_set1_ps(0.5f)), r.step, r.start);
+            __m256 const px = _mm256_fmadd_ps(r.direction_x, t, r.origin_x);
+            __m256 const py = _mm256_fmadd_ps(r.direction_y, t, r.origin_y);
+            __m256 const pz = _mm256_fmadd_ps(r.direction_z, t, r.origin_z);
+
+            __m256 const density_dt = _mm256_and_ps(_mm256_mul_ps(sample8(c, px, py, pz), r.step), active);
+            depth_red = _mm256_fmadd_ps(_mm256_set1_ps(c.extinction.r), density_dt, depth_red);
+            depth_green = _mm256_fmadd_ps(_mm256_set1_ps(c.extinction.g), density_dt, depth_green);
+            depth_blue = _mm256_fmadd_ps(_mm256_set1_ps(c.extinction.b), density_dt, depth_blue);
+
+            __m256 const light_depth = light_density(c, px, py, pz, active);
+
+            auto const scatter = [&](__m256 & color, __m256 depth, int channel)
+            {
+                __m256 const light = _mm256_fmadd_ps(_mm256_set1_ps(c.light_color[channel]),
+                    exp8(_mm256_mul_ps(_mm256_set1_ps(-c.extinction[channel]), light_depth)),
+                    _mm256_set1_ps(c.ambient_light[channel]));
+                __m256 const weight = _mm256_mul_ps(_mm256_mul_ps(exp8(_mm256_sub_ps(_mm256_setzero_ps(), depth)),
+                    density_dt), _mm256_set1_ps(c.phase_scattering[channel]));
+                color = _mm256_fmadd_ps(light, weight, color);
+            };
+            scatter(red, depth_red, 0);
+            scatter(green, depth_green, 1);
+            scatter(blue, depth_blue, 2);
+
+            __m256 const opaque = _mm256_cmp_ps(_mm256_min_ps(depth_red, _mm256_min_ps(depth_green, depth_blue)),
+                max_depth, _CMP_GT_OQ);
+            i = _mm256_blendv_ps(_mm256_add_ps(i, _mm256_set1_ps(1.f)), count, opaque);
+            i = next_sample(c, r, i, count);
+        }
+
+        _mm256_store_ps(rays.red, red);
+        _mm256_store_ps(rays.green, green);
+        _mm256_store_ps(rays.blue, blue);
+        _mm256_store_ps(rays.depth_red, depth_red);
+        _mm256_store_ps(rays.depth_green, depth_green);
+        _mm256_store_ps(rays.depth_blue, depth_blue);
+    }
+
+#else
+
+    struct ray
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        glm::vec3 inverse;
+        float start;
+        float step;
+    };
+
+    float clamp_texel(float u, float max_texel)
+    {
+        // Also false for NaN
+        return u > 0.f ? std::min(u, max_texel) : 0.f;
+    }
+
+    float sample(march_context const & c, glm::vec3 const & p)
+    {
+        float const u = clamp_texel(p.x, c.max_texel.x);
+        float const v = clamp_texel(p.y, c.max_texel.y);
+        float const w = clamp_texel(p.z, c.max_texel.z);
+        int const iu = std::min(int(u), c.max_cell.x);
+        int const iv = std::min(int(v), c.max_cell.y);
+        int const iw = std::min(int(w), c.max_cell.z);
+        float const fu = u - iu, fv = v - iv, fw = w - iw;
+
+        std::uint8_t const * const d = c.densities + std::size_t(iw) * c.stride_z + std::size_t(iv) * c.stride_y + iu;
+        auto const lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+        float const c00 = lerp(d[0], d[1], fu);
+        float const c10 = lerp(d[c.stride_y], d[c.stride_y + 1], fu);
+        float const c01 = lerp(d[c.stride_z], d[c.stride_z + 1], fu);
+        float const c11 = lerp(d[c.stride_z + c.stride_y], d[c.stride_z + c.stride_y + 1], fu);
+        return lerp(lerp(c00, c10, fv), lerp(c01, c11, fv), fw) * (1.f / 255.f);
+    }
+
+    // The sample index i moved past the macro cells with nothing in them, like
+    // the AVX2 version
+    float next_sample(march_context const & c, ray const & r, float i, float count)
+    {
+        if (!c.macro_maxima)
+            return i;
+
+        while (i < count)
+        {
+            glm::vec3 const p = r.origin + r.direction * (r.start + (i + 0.5f) * r.step);
+            glm::ivec3 cell;
+            for (int a = 0; a < 3; ++a)
+                cell[a] = std::min(int(clamp_texel(p[a], c.max_texel[a]) / c.macro_cell_size), c.max_macro_cell[a]);
+
+            if (c.macro_maxima[cell.z * c.macro_stride_z + cell.y * c.macro_stride_y + cell.x] != 0)
+                return i;
+
+            float t_exit = infinity;
+            for (int a = 0; a < 3; ++a)
+            {
+                float const far = r.inverse[a] > 0.f
+                    ? (cell[a] == c.max_macro_cell[a] ? infinity : (cell[a] + 1) * c.macro_cell_size)
+                    : (cell[a] == 0 ? -infinity : cell[a] * c.macro_cell_size);
+                t_exit = std::min(t_exit, (far - r.origin[a]) * r.inverse[a]);
+            }
+
+            float const past = std::ceil((t_exit - r.start) / r.step - 0.5f);
+            // Also for NaN
+            i = past > i + 1.f ? past : i + 1.f;
+        }
+        return i;
+    }
+
+    float light_density(march_context const & c, glm::vec3 const & p)
+    {
+        ray r;
+        r.origin = p;
+        r.direction = c.light_direction;
+        r.inverse = c.inverse_light_direction;
+        float light_end;
+        intersect_box(c, p, r.inverse, r.start, light_end);
+        r.step = (light_end - r.start) / c.light_steps;
+
+        float const max_density = c.max_depth / c.min_extinction;
+        float const count = c.light_steps;
+
+        float density = 0.f;
+        for (float j = next_sample(c, r, 0.f, count); j < count; j = next_sample(c, r, j + 1.f, count))
+        {
+            density += sample(c, p + r.direction * (r.start + (j + 0.5f) * r.step)) * r.step;
+            if (density > max_density)
+                break;
+        }
+        return density;
+    }
+
+    void march(march_context const & c, ray_batch & rays)
+    {
+        for (int k = 0; k < lanes; ++k)
+        {
+            ray r;
+            r.origin = c.camera_position;
+            r.direction = {rays.direction_x[k], rays.direction_y[k], rays.direction_z[k]};
+            r.inverse = inverse(r.direction);
+            r.start = rays.start[k];
+            r.step = rays.step[k];
+            float const count = r.step > 0.f ? c.camera_steps : 0;
+
+            glm::vec3 color{0.f};
+            glm::vec3 depth{0.f};
+            for (float i = next_sample(c, r, 0.f, count); i < count; i = next_sample(c, r, i + 1.f, count))
+            {
+                glm::vec3 const p = r.origin + r.direction * (r.start + (i + 0.5f) * r.step);
+                float const density_dt = sample(c, p) * r.step;
+                depth += c.extinction * density_dt;
+
+                glm::vec3 const light = c.ambient_light + c.light_color * glm::exp(-c.extinction * light_density(c, p));
+                color += light * glm::exp(-depth) * density_dt * c.phase_scattering;
+
+                if (std::min(depth.r, std::min(depth.g, depth.b)) > c.max_depth)
+                    break;
+            }
+
+            rays.red[k] = color.r;
+            rays.green[k] = color.g;
+            rays.blue[k] = color.b;
+            rays.depth_red[k] = depth.r;
+            rays.depth_green[k] = depth.g;
+            rays.depth_blue[k] = depth.b;
+        }
+    }
+
+#endif
+
+    std::uint8_t to_byte(float value)
+    {
+        return std::uint8_t(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+    }
+
+}
+
+void render_volume(density_volume const & volume, cloud_parameters const & cloud, volume_view const & view,
+    rgb_image & image, thread_pool & pool, macro_grid const * empty_space)
+{
+    glm::vec3 const texel_scale = glm::vec3(volume.size) / (volume.bbox_max - volume.bbox_min);
+    glm::vec3 const texel_offset = -volume.bbox_min * texel_scale - 0.5f;
+
+    march_context c;
+    c.densities = volume.densities.data();
+    c.max_texel = glm::vec3(volume.size - 1);
+    c.max_cell = volume.size - 2;
+    c.stride_y = volume.size.x;
+    c.stride_z = volume.size.x * volume.size.y;
+
+    c.macro_maxima = empty_space ? empty_space->maxima.data() : nullptr;
+    if (empty_space)
+    {
+        c.macro_cell_size = empty_space->cell_size;
+        c.max_macro_cell = empty_space->cells - 1;
+        c.macro_stride_y = empty_space->cells.x;
+        c.macro_stride_z = empty_space->cells.x * empty_space->cells.y;
+    }
+
+    c.box_min = glm::vec3(-0.5f);
+    c.box_max = glm::vec3(volume.size) - 0.5f;
+    c.camera_position = view.camera_position * texel_scale + texel_offset;
+    c.light_direction = view.light_direction * texel_scale;
+    c.inverse_light_direction = inverse(c.light_direction);
+
+    c.extinction = cloud.absorption + cloud.scattering;
+    c.min_extinction = std::min(c.extinction.r, std::min(c.extinction.g, c.extinction.b));
+    c.phase_scattering = cloud.scattering / (4.f * pi);
+    c.ambient_light = cloud.ambient_light;
+    c.light_color = cloud.light_color;
+    c.camera_steps = cloud.camera_steps;
+    c.light_steps = cloud.light_steps;
+    c.max_depth = cloud.min_transmittance > 0.f ? -std::log(cloud.min_transmittance) : infinity;
+
+    int const width = image.width, height = image.height;
+    image.pixels.resize(std::size_t(width) * height * 3);
+
+    float const tan_half_fov = std::tan(view.vertical_fov / 2.f);
+    float const aspect = float(width) / height;
+
+    int const tiles_x = (width + tile_size - 1) / tile_size;
+    int const tiles_y = (height + tile_size - 1) / tile_size;
+
+    pool.parallel_for(std::size_t(tiles_x) * tiles_y, grain, [&](std::size_t first, std::size_t last)
+    {
+        ray_batch rays;
+        for (std::size_t tile = first; tile < last; ++tile)
+        {
+            int const x0 = int(tile % tiles_x) * tile_size;
+            int const y0 = int(tile / tiles_x) * tile_size;
+
+            for (int y = y0; y < std::min(y0 + tile_size, height); ++y)
+            {
+                // Through the pixel centers; the rays past the right edge are
+                // marched too and thrown away
+                for (int k = 0; k < lanes; ++k)
+                {
+                    float const sx = (2.f * (x0 + k + 0.5f) / width - 1.f) * tan_half_fov * aspect;
+                    float const sy = (1.f - 2.f * (y + 0.5f) / height) * tan_half_fov;
+                    glm::vec3 const direction =
+                        glm::normalize(view.camera_rotation * glm::vec3(sx, sy, -1.f)) * texel_scale;
+
+                    float tmin, tmax;
+                    intersect_box(c, c.camera_position, inverse(direction), tmin, tmax);
+
+                    rays.direction_x[k] = direction.x;
+                    rays.direction_y[k] = direction.y;
+                    rays.direction_z[k] = direction.z;
+                    bool const hit = tmax > tmin;
+                    rays.start[k] = hit ? tmin : 0.f;
+                    rays.step[k] = hit ? (tmax - tmin) / c.camera_steps : 0.f;
+                }
+
+                march(c, rays);
+
+                for (int k = 0; k < std::min(lanes, width - x0); ++k)
+                {
+                    glm::vec3 const color{rays.red[k], rays.green[k], rays.blue[k]};
+                    glm::vec3 const depth{rays.depth_red[k], rays.depth_green[k], rays.depth_blue[k]};
+                    glm::vec3 const opacity = 1.f - glm::exp(-depth);
+                    glm::vec3 const result = cloud.background + (color - cloud.background) * opacity;
+
+                    std::uint8_t * const pixel = image.pixels.data() + (std::size_t(y) * width + x0 + k) * 3;
+                    pixel[0] = to_byte(result.r);
+                    pixel[1] = to_byte(result.g);
+                    pixel[2] = to_byte(result.b);
+                }
+            }
+        }
+    });
+}
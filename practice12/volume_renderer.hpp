@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/mat3x3.hpp>
+#include <glm/vec3.hpp>
+
+#include "density_volume.hpp"
+#include "macro_grid.hpp"
+#include "thread_pool.hpp"
+
+// The medium and the lighting of the viewer's fragment shader
+struct cloud_parameters
+{
+    glm::vec3 absorption{0.1f};
+    glm::vec3 scattering{1.f, 2.f, 3.f};
+    glm::vec3 light_color{16.f};
+    glm::vec3 ambient_light = 4.f * glm::vec3(0.6f, 0.8f, 1.f);
+    // Seen through the cloud and around it
+    glm::vec3 background{0.6f, 0.8f, 1.f};
+
+    // Samples along every camera ray, and along the light ray from each of them
+    int camera_steps = 64;
+    int light_steps = 16;
+
+    // Camera and light rays stop once less than this much light gets through
+    // them in every channel; zero marches them to the end
+    float min_transmittance = 1e-3f;
+};
+
+struct volume_view
+{
+    glm::vec3 camera_position{0.f};
+    // Camera to world, the camera looks along its -z with y up
+    glm::mat3 camera_rotation{1.f};
+    float vertical_fov = 1.5707963f;
+
+    // Towards the light
+    glm::vec3 light_direction{0.f, 1.f, 0.f};
+};
+
+struct rgb_image
+{
+    int width = 0;
+    int height = 0;
+    // Rows top to bottom, three bytes per pixel
+    std::vector<std::uint8_t> pixels;
+};
+
+// Marches a ray through the volume for every pixel of the image, at its current
+// size, with the fragment shader's fixed step counts and single scattering
+// model. The image is split into 8x8 tiles over the pool; with AVX2 the eight
+// rays of a tile row are marched together and sample the volume with gathers.
+// Given a macro grid of the volume, camera and light rays leap over its empty
+// cells, which leaves the image as it is: only zero samples are skipped.
+void render_volume(density_volume const & volume, cloud_parameters const & cloud, volume_view const & view,
+    rgb_image & image, thread_pool & pool, macro_grid const * empty_space = nullptr);
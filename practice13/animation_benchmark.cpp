@@ -0,0 +1,203 @@
+#include "animation_benchmark.hpp"
+
+#include "animation_graph.hpp"
+#include "animation_lod.hpp"
+#include "gltf_loader.hpp"
+#include "pose_transform.hpp"
+
+#include <glm/ext/scalar_constants.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// The viewer's projection at its default size
+constexpr float fov_y = glm::pi<float>() / 2.f;
+constexpr float viewport_height = 720.f;
+constexpr float timestep = 1.f / 60.f;
+
+struct crowd_result
+{
+    char const * name;
+    double milliseconds = 0.0;
+    double sampled_bones = 0.0;
+    // Graph nodes per frame
+    double evaluated = 0.0;
+    double cached = 0.0;
+    double skipped = 0.0;
+    // Dancers per level
+    std::vector<std::size_t> levels;
+};
+
+}
+
+animation_benchmark_options parse_animation_benchmark_options(int argc, char ** argv)
+{
+    animation_benchmark_options result;
+    if (argc < 2 || std::string(argv[1]) != "--animation-bench")
+        return result;
+    result.enabled = true;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--output")
+            result.output = value();
+        else if (arg == "--instances")
+            result.instances = std::stoul(value());
+        else if (arg == "--frames")
+            result.frames = std::stoi(value());
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (result.instances == 0)
+        throw std::runtime_error("--instances must be positive");
+    if (result.frames <= 0)
+        throw std::runtime_error("--frames must be positive");
+
+    return result;
+}
+
+bool run_animation_benchmark(animation_benchmark_options const & options)
+{
+    std::filesystem::path const root = PROJECT_ROOT;
+    gltf_model const model = load_gltf(root / "dancing/dancing.gltf");
+    auto graph = load_animation_graph(root / "dancing/animation_graph.json", model);
+    pose_transform transform(model);
+
+    animation_graph::statistics graph_stats;
+    auto sample_graph = [&](float t, std::vector<std::uint32_t> const & active_bones, pose & result)
+    {
+        auto const & graph_pose = graph.evaluate(t, &active_bones);
+        graph_stats.evaluated += graph.stats.evaluated;
+        graph_stats.cached += graph.stats.cached;
+        graph_stats.skipped += graph.stats.skipped;
+        for (auto i : active_bones)
+        {
+            result.translation[i] = graph_pose.translation[i];
+            result.rotation[i] = graph_pose.rotation[i];
+            result.scale[i] = graph_pose.scale[i];
+        }
+    };
+
+    // The dancers keep their distance, each one dances a second later than the last
+    std::vector<float> screen_radius(options.instances);
+    std::vector<float> offset(options.instances);
+    for (std::size_t i = 0; i < options.instances; ++i)
+    {
+        float const distance = 1.f + 49.f * i / std::max<std::size_t>(options.instances - 1, 1);
+        screen_radius[i] = projected_radius({0.f, 0.f, -distance}, 1.f, fov_y, viewport_height);
+        offset[i] = float(i);
+    }
+
+    animation_lod_settings full_rate;
+    full_rate.levels = {{0.f, 1, true, 0}};
+    animation_lod const lods[] = {build_animation_lod(model), build_animation_lod(model, full_rate)};
+
+    std::vector<crowd_result> results;
+    // The last frame's palettes of the dancers at full detail
+    std::vector<std::vector<std::vector<glm::mat4x3>>> palettes;
+    for (auto const & lod : lods)
+    {
+        auto & result = results.emplace_back();
+        result.name = &lod == &lods[0] ? "animation LOD" : "full rate";
+        result.levels.assign(lod.levels.size(), 0);
+
+        std::vector<animated_instance> crowd(options.instances);
+        auto & final_palettes = palettes.emplace_back(options.instances);
+        std::vector<glm::mat4x3> palette;
+
+        std::size_t sampled_bones = 0;
+        graph_stats = {};
+        auto const start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            float const time = frame * timestep;
+            for (std::size_t i = 0; i < options.instances; ++i)
+            {
+                auto const & current = update_animated_instance(lod, crowd[i], screen_radius[i], time + offset[i],
+                    sample_graph);
+                transform.compute(current, palette);
+                sampled_bones += crowd[i].sampled_bones;
+
+                if (frame + 1 == options.frames && crowd[i].level == 0)
+                    final_palettes[i] = palette;
+            }
+        }
+        auto const end = std::chrono::steady_clock::now();
+
+        result.milliseconds = std::chrono::duration<double, std::milli>(end - start).count() / options.frames;
+        result.sampled_bones = double(sampled_bones) / options.frames;
+        result.evaluated = double(graph_stats.evaluated) / options.frames;
+        result.cached = double(graph_stats.cached) / options.frames;
+        result.skipped = double(graph_stats.skipped) / options.frames;
+        for (auto const & instance : crowd)
+            ++result.levels[instance.level];
+    }
+
+    // Full detail samples every bone every frame, with or without the LOD
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < options.instances; ++i)
+        if (!palettes[0][i].empty() && palettes[0][i] != palettes[1][i])
+            ++mismatches;
+    bool const passed = mismatches == 0;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << options.instances << " dancers, " << model.bones.size() << " bones, " << options.frames
+        << " frames\n";
+    if (!passed)
+        std::cout << "FAILED: " << mismatches << " dancers at full detail differ from the full rate\n";
+    std::cout << "mode\tms per frame\tbones sampled per frame\tgraph nodes evaluated / cached / skipped per frame"
+        "\tdancers per level\n";
+    for (auto const & r : results)
+    {
+        std::cout << r.name << "\t" << r.milliseconds << "\t" << std::setprecision(0) << r.sampled_bones << "\t"
+            << r.evaluated << " / " << r.cached << " / " << r.skipped << std::setprecision(3) << "\t";
+        for (std::size_t level = 0; level < r.levels.size(); ++level)
+            std::cout << (level ? " / " : "") << r.levels[level];
+        std::cout << '\n';
+    }
+    std::cout << (passed ? "passed" : "FAILED") << '\n';
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (options.output)
+    {
+        std::ofstream out(*options.output);
+        out << "{\n";
+        out << "\"instances\": " << options.instances << ",\n";
+        out << "\"frames\": " << options.frames << ",\n";
+        out << "\"passed\": " << (passed ? "true" : "false") << ",\n";
+        out << "\"modes\": [";
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            auto const & r = results[i];
+            out << (i ? ",\n" : "\n") << "{\"mode\": \"" << r.name << "\", \"ms_per_frame\": " << r.milliseconds
+                << ", \"sampled_bones_per_frame\": " << r.sampled_bones
+                << ", \"graph_nodes_per_frame\": {\"evaluated\": " << r.evaluated << ", \"cached\": " << r.cached
+                << ", \"skipped\": " << r.skipped << "}, \"levels\": [";
+            for (std::size_t level = 0; level < r.levels.size(); ++level)
+                out << (level ? ", " : "") << r.levels[level];
+            out << "]}";
+        }
+        out << "\n]\n}\n";
+    }
+
+    return passed;
+}
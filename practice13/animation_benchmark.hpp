@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+struct animation_benchmark_options
+{
+    // Set by --animation-bench, which has to be the first argument
+    bool enabled = false;
+    std::optional<std::filesystem::path> output;
+
+    // Dancers spread evenly between 1 and 50 meters from the camera
+    std::size_t instances = 1000;
+    // At 60 frames per second
+    int frames = 240;
+};
+
+// --animation-bench [--instances <n>] [--frames <n>] [--output <json>]
+// Anything else leaves the options disabled without looking at the arguments.
+animation_benchmark_options parse_animation_benchmark_options(int argc, char ** argv);
+
+// Animates a crowd of dancers through the animation graph and pose_transform
+// without a window, once with the default animation LOD and once sampling every
+// bone every frame. Prints the time, the bones sampled and the graph nodes
+// evaluated, cached and skipped per frame for both, and how many dancers each
+// level got. Dancers at full detail have to get the same palette either way.
+// Returns false if they do not.
+bool run_animation_benchmark(animation_benchmark_options const & options);
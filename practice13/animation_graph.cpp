@@ -0,0 +1,460 @@
+#include "animation_graph.hpp"
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+void pose::resize(std::size_t bone_count)
+{
+    translation.resize(bone_count);
+    rotation.resize(bone_count);
+    scale.resize(bone_count);
+}
+
+std::size_t pose_pool::acquire()
+{
+    if (!free.empty())
+    {
+        std::size_t id = free.back();
+        free.pop_back();
+        return id;
+    }
+
+    poses.emplace_back().resize(bone_count);
+    return poses.size() - 1;
+}
+
+void pose_pool::release(std::size_t id)
+{
+    free.push_back(id);
+}
+
+template <typename F>
+static void for_each_bone(std::size_t count, std::vector<std::uint32_t> const * bones, F && f)
+{
+    if (bones)
+    {
+        for (std::uint32_t i : *bones)
+            f(i);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            f(i);
+    }
+}
+
+void blend_poses(pose const & a, pose const & b, float t, pose & result, std::vector<std::uint32_t> const * bones)
+{
+    for_each_bone(a.translation.size(), bones, [&](std::size_t i)
+    {
+        result.translation[i] = glm::lerp(a.translation[i], b.translation[i], t);
+        result.rotation[i] = glm::slerp(a.rotation[i], b.rotation[i], t);
+        result.scale[i] = glm::lerp(a.scale[i], b.scale[i], t);
+    });
+}
+
+void sample_animation(gltf_model::animation const & animation, float time, pose & result,
+    std::vector<std::uint32_t> const * bones)
+{
+    for_each_bone(animation.bones.size(), bones, [&](std::size_t i)
+    {
+        result.translation[i] = animation.bones[i].translation(time);
+        result.rotation[i] = animation.bones[i].rotation(time);
+        result.scale[i] = animation.bones[i].scale(time);
+    });
+}
+
+pose const & animation_graph::evaluate(float time, std::vector<std::uint32_t> const * bones)
+{
+    // Cached outputs only hold the bones that were active when they were computed
+    if (bones != active_bones)
+    {
+        for (auto & n : nodes)
+            n.cache_key.clear();
+        active_bones = bones;
+    }
+
+    this->time = time;
+    ++frame;
+    stats = {};
+    last_visit.resize(nodes.size(), 0);
+
+    evaluate_node(root);
+    release_inactive();
+
+    return pool[nodes[root].output];
+}
+
+void animation_graph::release_inactive()
+{
+    for (std::size_t id = 0; id < nodes.size(); ++id)
+    {
+        auto & n = nodes[id];
+        if (last_visit[id] == frame)
+            continue;
+
+        ++stats.skipped;
+        if (n.output == no_pose)
+            continue;
+
+        pool.release(n.output);
+        n.output = no_pose;
+        n.cache_key.clear();
+    }
+}
+
+void animation_graph::evaluate_node(std::size_t id)
+{
+    auto & n = nodes[id];
+
+    if (last_visit[id] == frame)
+        return;
+    last_visit[id] = frame;
+
+    auto parameter = [&](std::size_t i) -> float
+    {
+        if (i >= n.parameters.size())
+            return 1.f;
+        auto it = parameters.find(n.parameters[i]);
+        return it == parameters.end() ? 0.f : it->second;
+    };
+
+    // Weights of the inputs of blending nodes, zero-weight inputs are not evaluated
+    auto & weights = n.weights;
+    auto & key = n.key;
+    std::fill(weights.begin(), weights.end(), 0.f);
+    key.clear();
+
+    switch (n.type)
+    {
+    case node_type::clip:
+    {
+        float local_time = time * n.speed;
+        if (n.animation->max_time > 0.f)
+            local_time = std::fmod(local_time, n.animation->max_time);
+        key.push_back(local_time);
+        break;
+    }
+    case node_type::blend_1d:
+    {
+        float const x = parameter(0);
+        std::size_t const count = n.inputs.size();
+        if (x <= n.positions.front().x)
+            weights.front() = 1.f;
+        else if (x >= n.positions.back().x)
+            weights.back() = 1.f;
+        else
+        {
+            for (std::size_t i = 0; i + 1 < count; ++i)
+            {
+                if (x < n.positions[i].x || x > n.positions[i + 1].x)
+                    continue;
+                float t = (x - n.positions[i].x) / (n.positions[i + 1].x - n.positions[i].x);
+                weights[i] = 1.f - t;
+                weights[i + 1] = t;
+                break;
+            }
+        }
+        key.push_back(x);
+        break;
+    }
+    case node_type::blend_2d:
+    {
+        glm::vec2 const p{parameter(0), parameter(1)};
+
+        // Inverse distance weighting, an exact hit takes the whole weight
+        float total = 0.f;
+        for (std::size_t i = 0; i < n.inputs.size(); ++i)
+        {
+            float d2 = glm::dot(p - n.positions[i], p - n.positions[i]);
+            if (d2 < 1e-8f)
+            {
+                std::fill(weights.begin(), weights.end(), 0.f);
+                weights[i] = total = 1.f;
+                break;
+            }
+            weights[i] = 1.f / d2;
+            total += weights[i];
+        }
+        for (auto & w : weights)
+        {
+            w /= total;
+            if (w < 1e-3f)
+                w = 0.f;
+        }
+        key.push_back(p.x);
+        key.push_back(p.y);
+        break;
+    }
+    case node_type::additive:
+    case node_type::mask:
+    {
+        float const w = glm::clamp(parameter(0), 0.f, 1.f);
+        weights[0] = 1.f;
+        weights[1] = w;
+        key.push_back(w);
+        break;
+    }
+    case node_type::crossfade:
+    {
+        std::size_t target = glm::clamp<int>(std::lround(parameter(0)), 0, n.inputs.size() - 1);
+        if (target != n.current && time - n.switch_time >= n.duration)
+        {
+            n.previous = n.current;
+            n.current = target;
+            n.switch_time = time;
+        }
+
+        float factor = n.duration > 0.f ? glm::clamp((time - n.switch_time) / n.duration, 0.f, 1.f) : 1.f;
+        weights[n.previous] += 1.f - factor;
+        weights[n.current] += factor;
+        key.push_back(factor);
+        key.push_back(n.previous);
+        key.push_back(n.current);
+        break;
+    }
+    }
+
+    for (std::size_t i = 0; i < n.inputs.size(); ++i)
+    {
+        if (weights[i] > 0.f)
+        {
+            evaluate_node(n.inputs[i]);
+            key.push_back(nodes[n.inputs[i]].version);
+        }
+        else
+            key.push_back(-1.0);
+    }
+
+    if (n.output != no_pose && key == n.cache_key)
+    {
+        ++stats.cached;
+        return;
+    }
+
+    if (n.output == no_pose)
+        n.output = pool.acquire();
+    std::swap(n.cache_key, key);
+    ++n.version;
+    ++stats.evaluated;
+
+    pose & result = pool[n.output];
+    auto input = [&](std::size_t i) -> pose const & { return pool[nodes[n.inputs[i]].output]; };
+
+    switch (n.type)
+    {
+    case node_type::clip:
+        sample_animation(*n.animation, n.cache_key[0], result, active_bones);
+        break;
+    case node_type::blend_1d:
+    case node_type::blend_2d:
+    case node_type::crossfade:
+    {
+        // Folds the active inputs one by one, each blend keeping the running weights proportional
+        float accumulated = 0.f;
+        for (std::size_t i = 0; i < n.inputs.size(); ++i)
+        {
+            if (weights[i] <= 0.f)
+                continue;
+            if (accumulated == 0.f)
+                result = input(i);
+            else
+                blend_poses(result, input(i), weights[i] / (accumulated + weights[i]), result, active_bones);
+            accumulated += weights[i];
+        }
+        break;
+    }
+    case node_type::additive:
+    {
+        result = input(0);
+        if (weights[1] <= 0.f)
+            break;
+
+        pose const & delta = input(1);
+        float const w = weights[1];
+        for_each_bone(result.translation.size(), active_bones, [&](std::size_t i)
+        {
+            result.translation[i] += w * (delta.translation[i] - n.reference.translation[i]);
+            result.rotation[i] = glm::normalize(glm::slerp(glm::quat(1.f, 0.f, 0.f, 0.f),
+                delta.rotation[i] * glm::inverse(n.reference.rotation[i]), w) * result.rotation[i]);
+            result.scale[i] *= glm::lerp(glm::vec3(1.f), delta.scale[i] / n.reference.scale[i], w);
+        });
+        break;
+    }
+    case node_type::mask:
+    {
+        result = input(0);
+        if (weights[1] <= 0.f)
+            break;
+
+        pose const & overlay = input(1);
+        for_each_bone(result.translation.size(), active_bones, [&](std::size_t i)
+        {
+            float const t = weights[1] * n.bone_weights[i];
+            if (t <= 0.f)
+                return;
+            result.translation[i] = glm::lerp(result.translation[i], overlay.translation[i], t);
+            result.rotation[i] = glm::slerp(result.rotation[i], overlay.rotation[i], t);
+            result.scale[i] = glm::lerp(result.scale[i], overlay.scale[i], t);
+        });
+        break;
+    }
+    }
+}
+
+animation_graph load_animation_graph(std::filesystem::path const & path, gltf_model const & model)
+{
+    rapidjson::Document document;
+
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input)
+            throw std::runtime_error("Failed to open animation graph " + path.string());
+        rapidjson::IStreamWrapper stream(input);
+        document.ParseStream(stream);
+    }
+
+    if (document.HasParseError())
+        throw std::runtime_error("Failed to parse animation graph " + path.string());
+
+    animation_graph result;
+    result.pool.bone_count = model.bones.size();
+
+    auto const & nodes = document["nodes"].GetArray();
+
+    std::unordered_map<std::string, std::size_t> node_index;
+    for (auto const & node : nodes)
+    {
+        std::string name = node["name"].GetString();
+        node_index[name] = result.nodes.size();
+        result.nodes.emplace_back().name = std::move(name);
+    }
+
+    auto find_node = [&](std::string const & name)
+    {
+        auto it = node_index.find(name);
+        if (it == node_index.end())
+            throw std::runtime_error("Unknown animation graph node: " + name);
+        return it->second;
+    };
+
+    auto find_animation = [&](std::string const & name) -> gltf_model::animation const &
+    {
+        auto it = model.animations.find(name);
+        if (it == model.animations.end())
+            throw std::runtime_error("Unknown animation: " + name);
+        return it->second;
+    };
+
+    for (std::size_t id = 0; id < result.nodes.size(); ++id)
+    {
+        auto const & node = nodes[id];
+        auto & n = result.nodes[id];
+
+        std::string const type = node["type"].GetString();
+
+        if (node.HasMember("inputs"))
+            for (auto const & input : node["inputs"].GetArray())
+                n.inputs.push_back(find_node(input.GetString()));
+
+        if (node.HasMember("parameter"))
+            n.parameters.push_back(node["parameter"].GetString());
+        if (node.HasMember("parameters"))
+            for (auto const & parameter : node["parameters"].GetArray())
+                n.parameters.push_back(parameter.GetString());
+
+        if (node.HasMember("positions"))
+        {
+            for (auto const & position : node["positions"].GetArray())
+            {
+                if (position.IsArray())
+                    n.positions.push_back({position[0].GetFloat(), position[1].GetFloat()});
+                else
+                    n.positions.push_back({position.GetFloat(), 0.f});
+            }
+        }
+
+        auto expect_inputs = [&](std::size_t count)
+        {
+            if (count ? n.inputs.size() != count : n.inputs.empty())
+                throw std::runtime_error("Wrong number of inputs for animation graph node " + n.name);
+        };
+
+        if (type == "clip")
+        {
+            n.type = animation_graph::node_type::clip;
+            n.animation = &find_animation(node["animation"].GetString());
+            if (node.HasMember("speed"))
+                n.speed = node["speed"].GetFloat();
+        }
+        else if (type == "blend_1d" || type == "blend_2d")
+        {
+            n.type = type == "blend_1d" ? animation_graph::node_type::blend_1d : animation_graph::node_type::blend_2d;
+            expect_inputs(0);
+            if (n.positions.size() != n.inputs.size())
+                throw std::runtime_error("Animation graph node " + n.name + " needs a position per input");
+            if (n.type == animation_graph::node_type::blend_1d)
+                for (std::size_t i = 0; i + 1 < n.positions.size(); ++i)
+                    if (n.positions[i + 1].x <= n.positions[i].x)
+                        throw std::runtime_error("Animation graph node " + n.name + " needs increasing positions");
+        }
+        else if (type == "additive")
+        {
+            n.type = animation_graph::node_type::additive;
+            expect_inputs(2);
+
+            // The additive input is applied relative to a fixed frame of a clip,
+            // by default the first frame of the additive clip itself
+            auto const & additive = result.nodes[n.inputs[1]];
+            auto const * reference = additive.animation;
+            if (node.HasMember("reference"))
+                reference = &find_animation(node["reference"].GetString());
+            if (!reference)
+                throw std::runtime_error("Additive node " + n.name + " needs a reference animation");
+
+            n.reference.resize(model.bones.size());
+            sample_animation(*reference, node.HasMember("reference_time") ? node["reference_time"].GetFloat() : 0.f,
+                n.reference);
+        }
+        else if (type == "crossfade")
+        {
+            n.type = animation_graph::node_type::crossfade;
+            expect_inputs(0);
+            n.duration = node.HasMember("duration") ? node["duration"].GetFloat() : 0.f;
+        }
+        else if (type == "mask")
+        {
+            n.type = animation_graph::node_type::mask;
+            expect_inputs(2);
+
+            // Listed bones take the whole subtree with them
+            n.bone_weights.assign(model.bones.size(), 0.f);
+            for (auto const & bone : node["bones"].GetArray())
+            {
+                std::string const name = bone.GetString();
+                for (std::size_t i = 0; i < model.bones.size(); ++i)
+                    if (model.bones[i].name == name)
+                        n.bone_weights[i] = 1.f;
+            }
+            for (std::size_t i = 0; i < model.bones.size(); ++i)
+                if (model.bones[i].parent != gltf_model::bone::no_parent)
+                    n.bone_weights[i] = std::max(n.bone_weights[i], n.bone_weights[model.bones[i].parent]);
+        }
+        else
+            throw std::runtime_error("Unknown animation graph node type: " + type);
+
+        // Crossfade keys are the longest: factor, previous and current, then a
+        // version per input
+        n.weights.assign(n.inputs.size(), 0.f);
+        n.key.reserve(3 + n.inputs.size());
+        n.cache_key.reserve(3 + n.inputs.size());
+    }
+
+    result.root = find_node(document["root"].GetString());
+
+    return result;
+}
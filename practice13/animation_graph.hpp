@@ -0,0 +1,127 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Local (parent-relative) transform of every bone
+struct pose
+{
+    std::vector<glm::vec3> translation;
+    std::vector<glm::quat> rotation;
+    std::vector<glm::vec3> scale;
+
+    void resize(std::size_t bone_count);
+};
+
+// Pose buffers are recycled between nodes instead of being allocated every frame
+struct pose_pool
+{
+    std::size_t bone_count = 0;
+    std::vector<pose> poses;
+    std::vector<std::size_t> free;
+
+    std::size_t acquire();
+    void release(std::size_t id);
+
+    pose & operator[](std::size_t id) { return poses[id]; }
+};
+
+struct animation_graph
+{
+    enum class node_type
+    {
+        clip,
+        blend_1d,
+        blend_2d,
+        additive,
+        crossfade,
+        mask,
+    };
+
+    static constexpr std::size_t no_pose = -1;
+
+    struct node
+    {
+        node_type type;
+        std::string name;
+        std::vector<std::size_t> inputs;
+
+        // clip
+        gltf_model::animation const * animation = nullptr;
+        float speed = 1.f;
+
+        // blend_1d uses x of positions, blend_2d uses both, one per input
+        std::vector<glm::vec2> positions;
+
+        // Names of the float parameters driving the node (blend coordinates,
+        // additive/mask weight, crossfade target index)
+        std::vector<std::string> parameters;
+
+        // additive: reference pose the additive input is relative to
+        pose reference;
+
+        // mask: per-bone weight of the second input
+        std::vector<float> bone_weights;
+
+        // crossfade
+        float duration = 0.f;
+        std::size_t current = 0;
+        std::size_t previous = 0;
+        float switch_time = -1e9f;
+
+        // Cached output, reused while the cache key is unchanged
+        std::size_t output = no_pose;
+        std::uint64_t version = 0;
+        std::vector<double> cache_key;
+
+        // Per-evaluation scratch, sized by the loader: a weight per input and the
+        // key being built, swapped with cache_key when it changes
+        std::vector<float> weights;
+        std::vector<double> key;
+    };
+
+    std::vector<node> nodes;
+    std::size_t root = 0;
+
+    std::unordered_map<std::string, float> parameters;
+
+    struct statistics
+    {
+        std::size_t evaluated = 0;
+        std::size_t cached = 0;
+        std::size_t skipped = 0;
+    };
+
+    statistics stats;
+
+    // Evaluates the graph at the given global time, the returned reference
+    // stays valid until the next call. If bones is given, only those bones
+    // are sampled and blended and the others hold unspecified values.
+    pose const & evaluate(float time, std::vector<std::uint32_t> const * bones = nullptr);
+
+private:
+    pose_pool pool;
+    std::vector<std::size_t> last_visit;
+    std::size_t frame = 0;
+    float time = 0.f;
+    std::vector<std::uint32_t> const * active_bones = nullptr;
+
+    void evaluate_node(std::size_t id);
+    void release_inactive();
+
+    friend animation_graph load_animation_graph(std::filesystem::path const & path, gltf_model const & model);
+};
+
+animation_graph load_animation_graph(std::filesystem::path const & path, gltf_model const & model);
+
+void sample_animation(gltf_model::animation const & animation, float time, pose & result,
+    std::vector<std::uint32_t> const * bones = nullptr);
+
+// Same as the per-bone glm::lerp/glm::slerp blend main.cpp used to do
+void blend_poses(pose const & a, pose const & b, float t, pose & result,
+    std::vector<std::uint32_t> const * bones = nullptr);
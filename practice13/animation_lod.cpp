@@ -0,0 +1,135 @@
+#include "animation_lod.hpp"
+
+#include <glm/gtx/matrix_decompose.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+animation_lod build_animation_lod(gltf_model const & model, animation_lod_settings const & settings)
+{
+    std::size_t const bone_count = model.bones.size();
+
+    animation_lod result;
+
+    // Local bind pose, recovered from the inverse bind matrices
+    result.rest.resize(bone_count);
+    for (std::size_t i = 0; i < bone_count; ++i)
+    {
+        glm::mat4 local = glm::inverse(model.bones[i].inverse_bind_matrix);
+        if (model.bones[i].parent != gltf_model::bone::no_parent)
+            local = model.bones[model.bones[i].parent].inverse_bind_matrix * local;
+
+        glm::vec3 skew;
+        glm::vec4 perspective;
+        glm::decompose(local, result.rest.scale[i], result.rest.rotation[i], result.rest.translation[i], skew, perspective);
+    }
+
+    std::vector<bool> detail(bone_count, false);
+    for (std::size_t i = 0; i < bone_count; ++i)
+    {
+        for (auto const & pattern : settings.detail_bone_patterns)
+            if (model.bones[i].name.find(pattern) != std::string::npos)
+                detail[i] = true;
+    }
+
+    for (auto const & level_settings : settings.levels)
+    {
+        std::vector<bool> active(bone_count, true);
+
+        for (std::size_t i = 0; i < bone_count; ++i)
+        {
+            unsigned int parent = model.bones[i].parent;
+            if (!level_settings.detail_bones && detail[i])
+                active[i] = false;
+            if (parent != gltf_model::bone::no_parent && !active[parent])
+                active[i] = false;
+        }
+
+        for (unsigned int pass = 0; pass < level_settings.leaf_merges; ++pass)
+        {
+            std::vector<bool> has_children(bone_count, false);
+            for (std::size_t i = 0; i < bone_count; ++i)
+                if (active[i] && model.bones[i].parent != gltf_model::bone::no_parent)
+                    has_children[model.bones[i].parent] = true;
+
+            for (std::size_t i = 0; i < bone_count; ++i)
+                if (active[i] && !has_children[i] && model.bones[i].parent != gltf_model::bone::no_parent)
+                    active[i] = false;
+        }
+
+        auto & level = result.levels.emplace_back();
+        level.min_screen_radius = level_settings.min_screen_radius;
+        level.update_interval = std::max(1u, level_settings.update_interval);
+        for (std::size_t i = 0; i < bone_count; ++i)
+            if (active[i])
+                level.bones.push_back(i);
+    }
+
+    return result;
+}
+
+std::size_t animation_lod::select(float screen_radius) const
+{
+    for (std::size_t i = 0; i < levels.size(); ++i)
+        if (screen_radius >= levels[i].min_screen_radius)
+            return i;
+    return levels.size() - 1;
+}
+
+float projected_radius(glm::vec3 const & view_center, float radius, float fov_y, float viewport_height)
+{
+    float const distance = std::max(-view_center.z, 1e-4f);
+    return radius * 0.5f * viewport_height / (std::tan(fov_y * 0.5f) * distance);
+}
+
+pose const & update_animated_instance(animation_lod const & lod, animated_instance & instance,
+    float screen_radius, float time, pose_sampler const & sample)
+{
+    std::size_t const level_index = lod.select(screen_radius);
+    auto const & level = lod.levels[level_index];
+
+    instance.sampled_bones = 0;
+
+    if (level_index != instance.level)
+    {
+        // Bones the new level does not animate snap back to the bind pose
+        instance.level = level_index;
+        instance.previous = instance.next = instance.current = lod.rest;
+        instance.frames_since_update = level.update_interval;
+    }
+
+    if (level.update_interval == 1)
+    {
+        sample(time, level.bones, instance.current);
+        instance.sampled_bones = level.bones.size();
+        return instance.current;
+    }
+
+    if (++instance.frames_since_update >= level.update_interval)
+    {
+        // The sampler may be stateful, so it only ever sees the current time.
+        // A fresh level starts from its first sample, otherwise the last one
+        // becomes the start of the next interpolation.
+        bool const fresh = instance.frames_since_update > level.update_interval;
+        std::swap(instance.previous, instance.next);
+        instance.previous_time = instance.next_time;
+
+        sample(time, level.bones, instance.next);
+        instance.sampled_bones = level.bones.size();
+        instance.next_time = time;
+        instance.frames_since_update = 0;
+
+        if (fresh)
+        {
+            instance.previous = instance.next;
+            instance.previous_time = time;
+        }
+    }
+
+    // Plays the last two samples back one interval late
+    float const span = instance.next_time - instance.previous_time;
+    float const t = span > 0.f ? glm::clamp((time - instance.next_time) / span, 0.f, 1.f) : 1.f;
+    blend_poses(instance.previous, instance.next, t, instance.current, &level.bones);
+
+    return instance.current;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "animation_graph.hpp"
+#include "gltf_loader.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct animation_lod_settings
+{
+    struct level
+    {
+        // Smallest projected bounding-sphere radius, in pixels, that still uses this level
+        float min_screen_radius;
+        // The pose is resampled every this many frames and interpolated in between
+        unsigned int update_interval;
+        // Whether finger and face bones are animated
+        bool detail_bones;
+        // How many times the current leaf bones are merged into their parents
+        unsigned int leaf_merges;
+    };
+
+    std::vector<level> levels = {
+        {200.f, 1, true, 0},
+        {80.f, 2, false, 0},
+        {30.f, 4, false, 1},
+        {0.f, 8, false, 2},
+    };
+
+    // Case-sensitive name fragments of bones only animated at full detail
+    std::vector<std::string> detail_bone_patterns = {
+        "Thumb", "Index", "Middle", "Ring", "Pinky",
+        "Eye", "HeadTop", "horn", "Jaw",
+    };
+};
+
+// Bones that a level does not animate keep their bind-pose local transform,
+// i.e. they follow their parent rigidly as if merged into it
+struct animation_lod
+{
+    struct level
+    {
+        float min_screen_radius;
+        unsigned int update_interval;
+        // Animated bones in ascending order, so parents come before children
+        std::vector<std::uint32_t> bones;
+    };
+
+    std::vector<level> levels;
+    pose rest;
+
+    std::size_t select(float screen_radius) const;
+};
+
+animation_lod build_animation_lod(gltf_model const & model, animation_lod_settings const & settings = {});
+
+// Radius in pixels of a view-space sphere after perspective projection
+float projected_radius(glm::vec3 const & view_center, float radius, float fov_y, float viewport_height);
+
+// Samples the listed bones of some animation source at the given time
+using pose_sampler = std::function<void(float time, std::vector<std::uint32_t> const & bones, pose & result)>;
+
+struct animated_instance
+{
+    std::size_t level = -1;
+    unsigned int frames_since_update = 0;
+    float previous_time = 0.f;
+    float next_time = 0.f;
+
+    pose previous;
+    pose next;
+    pose current;
+
+    // Number of bone samples taken by the last update, for budgeting
+    std::size_t sampled_bones = 0;
+};
+
+// Picks the level for the given screen size and resamples the pose if it is due.
+// Between samples the previous two are interpolated, one update interval
+// behind, so that the sampler is never asked for a time ahead of `time`.
+// Returns the pose to render with.
+pose const & update_animated_instance(animation_lod const & lod, animated_instance & instance,
+    float screen_radius, float time, pose_sampler const & sample);
@@ -0,0 +1,327 @@
+#include "benchmark.hpp"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+camera_track camera_track::load(std::filesystem::path const & path)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Can't open camera track " + path.string());
+
+    camera_track result;
+
+    std::string line;
+    std::getline(in, line);
+    std::istringstream header(line);
+    for (std::string name; header >> name;)
+        result.channels.push_back(name);
+
+    while (std::getline(in, line))
+    {
+        std::istringstream row(line);
+        float time;
+        if (!(row >> time))
+            continue;
+
+        std::vector<float> values(result.channels.size());
+        for (auto & value : values)
+            if (!(row >> value))
+                throw std::runtime_error("Camera track " + path.string() + " has a key with missing channels");
+        result.add(time, std::move(values));
+    }
+
+    if (result.times.empty())
+        throw std::runtime_error("Camera track " + path.string() + " has no keys");
+
+    return result;
+}
+
+void camera_track::save(std::filesystem::path const & path) const
+{
+    std::ofstream out(path);
+    for (std::size_t c = 0; c < channels.size(); ++c)
+        out << (c ? " " : "") << channels[c];
+    out << '\n';
+
+    // Enough digits to read back the same floats
+    out << std::setprecision(9);
+    for (std::size_t k = 0; k < times.size(); ++k)
+    {
+        out << times[k];
+        for (float value : keys[k])
+            out << ' ' << value;
+        out << '\n';
+    }
+}
+
+void camera_track::add(float time, std::vector<float> values)
+{
+    if (!times.empty() && time < times.back())
+        throw std::runtime_error("Camera track keys must be ordered by time");
+
+    times.push_back(time);
+    keys.push_back(std::move(values));
+}
+
+float camera_track::duration() const
+{
+    return times.empty() ? 0.f : times.back();
+}
+
+std::vector<float> camera_track::sample(float time) const
+{
+    std::size_t const next = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+    if (next == 0)
+        return keys.front();
+    if (next == times.size())
+        return keys.back();
+
+    float const t = (time - times[next - 1]) / (times[next] - times[next - 1]);
+    std::vector<float> result(channels.size());
+    for (std::size_t c = 0; c < result.size(); ++c)
+        result[c] = keys[next - 1][c] + (keys[next][c] - keys[next - 1][c]) * t;
+    return result;
+}
+
+benchmark_options parse_benchmark_options(int argc, char ** argv)
+{
+    benchmark_options result;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--benchmark")
+            result.track = value();
+        else if (arg == "--record")
+            result.record = value();
+        else if (arg == "--output")
+            result.output = value();
+        else if (arg == "--trace")
+            result.trace = value();
+        else if (arg == "--timestep")
+            result.timestep = std::stof(value());
+        else if (arg == "--size")
+        {
+            std::string const size = value();
+            auto const x = size.find('x');
+            if (x == std::string::npos)
+                throw std::runtime_error("Expected --size <width>x<height>");
+            result.width = std::stoi(size.substr(0, x));
+            result.height = std::stoi(size.substr(x + 1));
+        }
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (!(result.timestep > 0.f))
+        throw std::runtime_error("--timestep must be positive");
+
+    return result;
+}
+
+void prepare_headless(benchmark_options const & options)
+{
+    if (options.track)
+        SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+}
+
+benchmark::benchmark(benchmark_options const & options, std::string program)
+    : options(options)
+    , program(std::move(program))
+{
+    if (!options.track)
+        return;
+
+    track = camera_track::load(*options.track);
+
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, options.width, options.height);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, options.width, options.height);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Benchmark framebuffer is incomplete");
+    glViewport(0, 0, options.width, options.height);
+
+    glGenQueries(queries.size(), queries.data());
+}
+
+benchmark::~benchmark()
+{
+    if (!options.track)
+        return;
+
+    glDeleteQueries(queries.size(), queries.data());
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+}
+
+bool benchmark::next_frame()
+{
+    ++frame;
+    return time() <= track.duration();
+}
+
+float benchmark::time() const
+{
+    // Multiplied rather than accumulated so that every run sees the same times
+    return frame * options.timestep;
+}
+
+std::vector<float> benchmark::camera() const
+{
+    return track.sample(time());
+}
+
+void benchmark::begin_frame()
+{
+    if (frame >= latency)
+        resolve(frame - latency);
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame % latency]);
+    frame_start = std::chrono::steady_clock::now();
+}
+
+void benchmark::end_frame()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    cpu_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+}
+
+void benchmark::resolve(int index)
+{
+    GLuint64 ns;
+    glGetQueryObjectui64v(queries[index % latency], GL_QUERY_RESULT, &ns);
+    gpu_ms.push_back(ns * 1e-6);
+}
+
+namespace
+{
+
+struct percentiles
+{
+    double mean, p50, p95, p99, max;
+
+    explicit percentiles(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        auto rank = [&](double p)
+        {
+            // Nearest rank
+            std::size_t const index = std::ceil(p * values.size());
+            return values[std::max<std::size_t>(index, 1) - 1];
+        };
+
+        mean = 0.0;
+        for (double v : values)
+            mean += v;
+        mean /= values.size();
+        p50 = rank(0.50);
+        p95 = rank(0.95);
+        p99 = rank(0.99);
+        max = values.back();
+    }
+
+    void write_json(std::ostream & out) const
+    {
+        out << "{\"mean\": " << mean << ", \"p50\": " << p50 << ", \"p95\": " << p95
+            << ", \"p99\": " << p99 << ", \"max\": " << max << "}";
+    }
+};
+
+void write_json_array(std::ostream & out, std::vector<double> const & values)
+{
+    out << "[";
+    for (std::size_t i = 0; i < values.size(); ++i)
+        out << (i ? ", " : "") << values[i];
+    out << "]";
+}
+
+}
+
+void benchmark::finish()
+{
+    for (int index = std::max(0, frame - latency); index < frame; ++index)
+        resolve(index);
+
+    if (cpu_ms.empty())
+        throw std::runtime_error("The camera track ended before the first frame");
+
+    percentiles const cpu(cpu_ms);
+    percentiles const gpu(gpu_ms);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << program << ": " << cpu_ms.size() << " frames at " << options.width << "x" << options.height << '\n';
+    std::cout << "ms\tmean\tp50\tp95\tp99\tmax\n";
+    std::cout << "cpu\t" << cpu.mean << '\t' << cpu.p50 << '\t' << cpu.p95 << '\t' << cpu.p99 << '\t' << cpu.max << '\n';
+    std::cout << "gpu\t" << gpu.mean << '\t' << gpu.p50 << '\t' << gpu.p95 << '\t' << gpu.p99 << '\t' << gpu.max << '\n';
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (!options.output)
+        return;
+
+    std::ofstream out(*options.output);
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "\"program\": \"" << program << "\",\n";
+    out << "\"track\": \"" << options.track->filename().string() << "\",\n";
+    out << "\"width\": " << options.width << ",\n";
+    out << "\"height\": " << options.height << ",\n";
+    out << "\"timestep\": " << options.timestep << ",\n";
+    out << "\"frames\": " << cpu_ms.size() << ",\n";
+    out << "\"cpu_ms\": ";
+    cpu.write_json(out);
+    out << ",\n\"gpu_ms\": ";
+    gpu.write_json(out);
+    out << ",\n\"frame_cpu_ms\": ";
+    write_json_array(out, cpu_ms);
+    out << ",\n\"frame_gpu_ms\": ";
+    write_json_array(out, gpu_ms);
+    out << "\n}\n";
+}
+
+track_recorder::track_recorder(benchmark_options const & options, std::vector<std::string> channels)
+    : path(options.record)
+{
+    track.channels = std::move(channels);
+}
+
+track_recorder::~track_recorder()
+{
+    if (path && !track.times.empty())
+        track.save(*path);
+}
+
+void track_recorder::add(float time, std::vector<float> values)
+{
+    if (path)
+        track.add(time, std::move(values));
+}
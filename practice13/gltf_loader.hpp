@@ -40,7 +40,9 @@ struct gltf_model
 
     struct bone
     {
-        unsigned int parent = -1;
+        static constexpr unsigned int no_parent = -1;
+
+        unsigned int parent = no_parent;
         std::string name;
         glm::mat4 inverse_bind_matrix;
     };
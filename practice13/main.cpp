@@ -9,6 +9,7 @@
 
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -27,8 +28,17 @@
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 
+#include "animation_benchmark.hpp"
+#include "animation_graph.hpp"
+#include "animation_lod.hpp"
+#include "benchmark.hpp"
 #include "gltf_loader.hpp"
+#include "pose_transform.hpp"
+#include "profiler.hpp"
+#include "skinning_benchmark.hpp"
 #include "stb_image.h"
+#include "thread_pool.hpp"
+#include "vertex_animation.hpp"
 
 std::string to_string(std::string_view str) {
   return std::string(str.begin(), str.end());
@@ -104,6 +114,72 @@ void main()
 }
 )";
 
+const char crowd_vertex_shader_source[] =
+    R"(#version 330 core
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform sampler2D vat_positions;
+uniform sampler2D vat_normals;
+uniform int vat_width;
+uniform int vat_rows_per_frame;
+uniform int vat_frame_count;
+uniform float vat_frame_rate;
+uniform int vat_quantized;
+uniform vec3 vat_bounds_min;
+uniform vec3 vat_bounds_max;
+uniform int vertex_base;
+uniform float time;
+
+layout (location = 2) in vec2 in_texcoord;
+layout (location = 5) in vec4 in_instance;
+
+out vec3 normal;
+out vec2 texcoord;
+out vec4 weights;
+
+ivec2 vat_texel(int frame)
+{
+    int v = vertex_base + gl_VertexID;
+    return ivec2(v % vat_width, frame * vat_rows_per_frame + v / vat_width);
+}
+
+vec3 fetch_position(int frame)
+{
+    vec3 p = texelFetch(vat_positions, vat_texel(frame), 0).xyz;
+    if (vat_quantized == 1)
+        p = mix(vat_bounds_min, vat_bounds_max, p);
+    return p;
+}
+
+vec3 fetch_normal(int frame)
+{
+    vec2 e = texelFetch(vat_normals, vat_texel(frame), 0).xy;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+    return n;
+}
+
+void main()
+{
+    float frame = mod((time + in_instance.w) * vat_frame_rate, float(vat_frame_count));
+    int frame0 = int(frame);
+    int frame1 = (frame0 + 1) % vat_frame_count;
+    float t = fract(frame);
+
+    vec3 position = mix(fetch_position(frame0), fetch_position(frame1), t);
+    vec3 object_normal = mix(fetch_normal(frame0), fetch_normal(frame1), t);
+
+    gl_Position = projection * view * (model * vec4(position, 1.0) + vec4(in_instance.xyz, 0.0));
+    normal = mat3(model) * object_normal;
+    texcoord = in_texcoord;
+    weights = vec4(0.0);
+}
+)";
+
 GLuint create_shader(GLenum type, const char *source) {
   GLuint result = glCreateShader(type);
   glShaderSource(result, 1, &source, nullptr);
@@ -139,7 +215,20 @@ GLuint create_program(Shaders... shaders) {
   return result;
 }
 
-int main() try {
+int main(int argc, char **argv) try {
+  auto const animation_options = parse_animation_benchmark_options(argc, argv);
+  if (animation_options.enabled)
+    return run_animation_benchmark(animation_options) ? EXIT_SUCCESS
+                                                      : EXIT_FAILURE;
+
+  auto const skinning_options = parse_skinning_benchmark_options(argc, argv);
+  if (skinning_options.enabled)
+    return run_skinning_benchmark(skinning_options) ? EXIT_SUCCESS
+                                                    : EXIT_FAILURE;
+
+  auto const options = parse_benchmark_options(argc, argv);
+  prepare_headless(options);
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0) sdl2_fail("SDL_Init: ");
 
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -156,7 +245,9 @@ int main() try {
   SDL_Window *window = SDL_CreateWindow(
       "Graphics course practice 11", SDL_WINDOWPOS_CENTERED,
       SDL_WINDOWPOS_CENTERED, 800, 600,
-      SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
+      SDL_WINDOW_OPENGL | (options.track
+                               ? SDL_WINDOW_HIDDEN
+                               : SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED));
 
   if (!window) sdl2_fail("SDL_CreateWindow: ");
 
@@ -186,6 +277,41 @@ int main() try {
   GLuint light_direction_location =
       glGetUniformLocation(program, "light_direction");
   GLuint bones_location = glGetUniformLocation(program, "bones");
+
+  auto crowd_vertex_shader =
+      create_shader(GL_VERTEX_SHADER, crowd_vertex_shader_source);
+  auto crowd_program = create_program(crowd_vertex_shader, fragment_shader);
+
+  GLuint crowd_model_location = glGetUniformLocation(crowd_program, "model");
+  GLuint crowd_view_location = glGetUniformLocation(crowd_program, "view");
+  GLuint crowd_projection_location =
+      glGetUniformLocation(crowd_program, "projection");
+  GLuint crowd_color_location = glGetUniformLocation(crowd_program, "color");
+  GLuint crowd_use_texture_location =
+      glGetUniformLocation(crowd_program, "use_texture");
+  GLuint crowd_light_direction_location =
+      glGetUniformLocation(crowd_program, "light_direction");
+  GLuint vat_positions_location =
+      glGetUniformLocation(crowd_program, "vat_positions");
+  GLuint vat_normals_location =
+      glGetUniformLocation(crowd_program, "vat_normals");
+  GLuint vat_width_location = glGetUniformLocation(crowd_program, "vat_width");
+  GLuint vat_rows_per_frame_location =
+      glGetUniformLocation(crowd_program, "vat_rows_per_frame");
+  GLuint vat_frame_count_location =
+      glGetUniformLocation(crowd_program, "vat_frame_count");
+  GLuint vat_frame_rate_location =
+      glGetUniformLocation(crowd_program, "vat_frame_rate");
+  GLuint vat_quantized_location =
+      glGetUniformLocation(crowd_program, "vat_quantized");
+  GLuint vat_bounds_min_location =
+      glGetUniformLocation(crowd_program, "vat_bounds_min");
+  GLuint vat_bounds_max_location =
+      glGetUniformLocation(crowd_program, "vat_bounds_max");
+  GLuint vertex_base_location =
+      glGetUniformLocation(crowd_program, "vertex_base");
+  GLuint crowd_time_location = glGetUniformLocation(crowd_program, "time");
+
   const std::string project_root = PROJECT_ROOT;
   const std::string model_path = project_root + "/dancing/dancing.gltf";
 
@@ -199,6 +325,7 @@ int main() try {
   struct mesh {
     GLuint vao;
     gltf_model::accessor indices;
+    gltf_model::accessor texcoord;
     gltf_model::material material;
   };
 
@@ -222,6 +349,7 @@ int main() try {
 
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
       result.indices = primitive.indices;
+      result.texcoord = primitive.texcoord;
 
       setup_attribute(0, primitive.position);
       setup_attribute(1, primitive.normal);
@@ -260,6 +388,94 @@ int main() try {
     textures[*mesh.material.texture_path] = texture;
   }
 
+  thread_pool pool;
+
+  // Background crowd: every dancer replays a pre-skinned clip from a vertex
+  // animation texture, so the vertex shader only does texture fetches
+  struct crowd_clip {
+    vertex_animation_texture bake;
+    GLuint positions;
+    GLuint normals;
+    GLuint instances;
+    GLsizei instance_count;
+    std::vector<GLuint> vaos;
+  };
+
+  const int crowd_size = 128;
+  const float crowd_spacing = 1.f;
+  const auto crowd_encoding = vertex_animation_encoding::quantized;
+
+  std::vector<crowd_clip> crowd;
+  {
+    std::default_random_engine rng;
+    std::uniform_real_distribution<float> time_offset{0.f, 100.f};
+
+    std::vector<std::vector<glm::vec4>> instances(3);
+    for (int i = 0; i < crowd_size; ++i)
+      for (int j = 0; j < crowd_size; ++j) {
+        // Leave the middle free for the live character
+        if (i == crowd_size / 2 && j == crowd_size / 2) continue;
+        instances[(i + j) % instances.size()].push_back(
+            {(i - crowd_size / 2) * crowd_spacing, 0.f,
+             (j - crowd_size / 2) * crowd_spacing, time_offset(rng)});
+      }
+
+    for (auto const &name : {"hip-hop", "rumba", "flair"}) {
+      auto &clip = crowd.emplace_back();
+      clip.bake = bake_vertex_animation(input_model, name, 30.f,
+                                        crowd_encoding, &pool);
+
+      bool const quantized =
+          clip.bake.encoding == vertex_animation_encoding::quantized;
+
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+      glGenTextures(1, &clip.positions);
+      glBindTexture(GL_TEXTURE_2D, clip.positions);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexImage2D(GL_TEXTURE_2D, 0, quantized ? GL_RGB16 : GL_RGB16F,
+                   clip.bake.width, clip.bake.height(), 0, GL_RGB,
+                   quantized ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT,
+                   clip.bake.positions.data());
+
+      glGenTextures(1, &clip.normals);
+      glBindTexture(GL_TEXTURE_2D, clip.normals);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, clip.bake.width,
+                   clip.bake.height(), 0, GL_RG, GL_SHORT,
+                   clip.bake.normals.data());
+
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+      auto const &clip_instances = instances[crowd.size() - 1];
+      clip.instance_count = clip_instances.size();
+      glGenBuffers(1, &clip.instances);
+      glBindBuffer(GL_ARRAY_BUFFER, clip.instances);
+      glBufferData(GL_ARRAY_BUFFER,
+                   clip_instances.size() * sizeof(clip_instances[0]),
+                   clip_instances.data(), GL_STATIC_DRAW);
+
+      for (auto const &mesh : meshes) {
+        auto &vao = clip.vaos.emplace_back();
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        setup_attribute(2, mesh.texcoord);
+
+        glBindBuffer(GL_ARRAY_BUFFER, clip.instances);
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
+        glVertexAttribDivisor(5, 1);
+      }
+    }
+  }
+
+  bool crowd_enabled = false;
+
   auto last_frame_start = std::chrono::high_resolution_clock::now();
 
   float time = 0.f;
@@ -273,16 +489,46 @@ int main() try {
   float camera_height = 1.f;
 
   bool paused = false;
-  int current_animation = 0;
-  int prev_animation = 0;
-  float last_switch = -1000;
-  auto delta = 1000.f;
   bool running = true;
 
-  std::vector<gltf_model::animation> animations = {
-      input_model.animations.at("hip-hop"), input_model.animations.at("rumba"),
-      input_model.animations.at("flair")};
+  // With --benchmark the camera follows the track into an offscreen
+  // framebuffer, with --record the interactive camera is saved as a track
+  auto bench = benchmark{options, "practice13"};
+  if (options.track) {
+    width = options.width;
+    height = options.height;
+  }
+  auto recorder = track_recorder{
+      options, {"distance", "rotation", "height", "view_angle", "crowd"}};
+  float recorded_time = 0.f;
+
+  auto profiler = frame_profiler{};
+  std::size_t frame_count = 0;
+  std::size_t sampled_bones = 0;
+
+  // Clips and how they blend live in the graph description, main.cpp only
+  // drives its parameters
+  auto graph = load_animation_graph(
+      project_root + "/dancing/animation_graph.json", input_model);
+
+  pose_transform bone_transform(input_model);
+  std::vector<glm::mat4x3> bones;
+
+  auto const character_lod = build_animation_lod(input_model);
+  animated_instance character_animation;
+  auto sample_graph = [&](float t,
+                          std::vector<std::uint32_t> const &active_bones,
+                          pose &result) {
+    auto const &graph_pose = graph.evaluate(t, &active_bones);
+    for (auto i : active_bones) {
+      result.translation[i] = graph_pose.translation[i];
+      result.rotation[i] = graph_pose.rotation[i];
+      result.scale[i] = graph_pose.scale[i];
+    }
+  };
   while (running) {
+    profiler.begin_frame();
+
     for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type) {
         case SDL_QUIT:
           running = false;
@@ -299,6 +545,7 @@ int main() try {
         case SDL_KEYDOWN:
           button_down[event.key.keysym.sym] = true;
           if (event.key.keysym.sym == SDLK_SPACE) paused = !paused;
+          if (event.key.keysym.sym == SDLK_c) crowd_enabled = !crowd_enabled;
           break;
         case SDL_KEYUP:
           button_down[event.key.keysym.sym] = false;
@@ -313,6 +560,12 @@ int main() try {
                    .count();
     last_frame_start = now;
 
+    if (options.track) {
+      if (!bench.next_frame()) break;
+      bench.begin_frame();
+      dt = options.timestep;
+    }
+
     if (!paused) time += dt;
 
     if (button_down[SDLK_UP]) camera_distance -= 3.f * dt;
@@ -324,26 +577,24 @@ int main() try {
     if (button_down[SDLK_w]) view_angle -= 2.f * dt;
     if (button_down[SDLK_s]) view_angle += 2.f * dt;
 
-    const auto max_delta = 1.f;
-    if (button_down[SDLK_1])
-      if (current_animation != 0 && delta > max_delta) {
-        prev_animation = current_animation;
-        current_animation = 0;
-        last_switch = time;
-      }
-    if (button_down[SDLK_2])
-      if (current_animation != 1 && delta > max_delta) {
-        prev_animation = current_animation;
-        current_animation = 1;
-        last_switch = time;
-      }
-    if (button_down[SDLK_3])
-      if (current_animation != 2 && delta > max_delta) {
-        prev_animation = current_animation;
-        current_animation = 2;
-        last_switch = time;
-      }
-    delta = time - last_switch;
+    for (int i = 0; i < 9; ++i)
+      if (button_down[SDLK_1 + i]) graph.parameters["dance"] = i;
+
+    if (options.track) {
+      auto const camera = bench.camera();
+      camera_distance = camera[0];
+      camera_rotation = camera[1];
+      camera_height = camera[2];
+      view_angle = camera[3];
+      crowd_enabled = camera[4] > 0.5f;
+      time = bench.time();
+    } else {
+      recorded_time += dt;
+      recorder.add(recorded_time,
+                   {camera_distance, camera_rotation, camera_height,
+                    view_angle, crowd_enabled ? 1.f : 0.f});
+    }
+
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -367,41 +618,20 @@ int main() try {
 
     glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
 
-    auto easeIn = [](float x) {
-      return 1 - cos((x * M_PI) / 2);
-      //      return x == 0 ? 0 : std::pow(2, 10 * x - 10);
-    };
-    auto current_animation_duration = animations[current_animation].max_time;
-    auto prev_time = std::fmod(time, animations[prev_animation].max_time);
-    auto current_time = std::fmod(time, current_animation_duration);
-    float factor = delta < max_delta ? (delta / max_delta) : 1;
-    std::vector<glm::mat4x3> bones(input_model.bones.size());
-    for (int i = 0; i < bones.size(); i++) {
-      glm::vec3 translation = glm::lerp(
-          animations[prev_animation].bones[i].translation(prev_time),
-          animations[current_animation].bones[i].translation(current_time),
-          factor);
-      glm::vec3 scale = glm::lerp(
-          animations[prev_animation].bones[i].scale(prev_time),
-          animations[current_animation].bones[i].scale(current_time), factor);
-      glm::quat rotation = glm::slerp(
-          animations[prev_animation].bones[i].rotation(prev_time),
-          animations[current_animation].bones[i].rotation(current_time),
-          factor);
-
-      glm::mat4 transform = glm::translate(glm::mat4(1), translation) *
-                            glm::toMat4(rotation) *
-                            glm::scale(glm::mat4(1), scale);
-
-      if (input_model.bones[i].parent != -1)
-        transform = bones[input_model.bones[i].parent] * transform;
-
-      bones[i] = transform;
-    }
+    profiler.push("animation");
+    // Fewer bones and a lower update rate once the dancer gets small on screen
+    glm::vec3 character_center = (view * glm::vec4(0.f, 0.9f, 0.f, 1.f)).xyz();
+    float screen_radius = projected_radius(
+        character_center, 1.f, glm::pi<float>() / 2.f, height);
+    auto const &current_pose =
+        update_animated_instance(character_lod, character_animation,
+                                 screen_radius, time, sample_graph);
 
-    for (int i = 0; i < bones.size(); i++)
-      bones[i] = bones[i] * input_model.bones[i].inverse_bind_matrix;
+    sampled_bones += character_animation.sampled_bones;
+    bone_transform.compute(current_pose, bones);
+    profiler.pop();
 
+    profiler.push("draw");
     glUseProgram(program);
     glUniformMatrix4fv(model_location, 1, GL_FALSE,
                        reinterpret_cast<float *>(&model));
@@ -414,8 +644,10 @@ int main() try {
     glUniformMatrix4x3fv(bones_location, bones.size(), GL_FALSE,
                          reinterpret_cast<float *>(&bones[0][0][0]));
 
-    auto draw_meshes = [&](bool transparent) {
-      for (auto const &mesh : meshes) {
+    auto draw_meshes = [&](bool transparent, GLuint use_texture_location,
+                           GLuint color_location, auto const &draw) {
+      for (std::size_t i = 0; i < meshes.size(); ++i) {
+        auto const &mesh = meshes[i];
         if (mesh.material.transparent != transparent) continue;
 
         if (mesh.material.two_sided)
@@ -439,19 +671,93 @@ int main() try {
         } else
           continue;
 
-        glBindVertexArray(mesh.vao);
-        glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type,
-                       reinterpret_cast<void *>(mesh.indices.view.offset));
+        draw(i);
+      }
+    };
+
+    auto draw_character = [&](bool transparent) {
+      glUseProgram(program);
+      draw_meshes(transparent, use_texture_location, color_location,
+                  [&](std::size_t i) {
+                    auto const &mesh = meshes[i];
+                    glBindVertexArray(mesh.vao);
+                    glDrawElements(
+                        GL_TRIANGLES, mesh.indices.count, mesh.indices.type,
+                        reinterpret_cast<void *>(mesh.indices.view.offset));
+                  });
+    };
+
+    auto draw_crowd = [&](bool transparent) {
+      glUseProgram(crowd_program);
+      glUniformMatrix4fv(crowd_model_location, 1, GL_FALSE,
+                         reinterpret_cast<float *>(&model));
+      glUniformMatrix4fv(crowd_view_location, 1, GL_FALSE,
+                         reinterpret_cast<float *>(&view));
+      glUniformMatrix4fv(crowd_projection_location, 1, GL_FALSE,
+                         reinterpret_cast<float *>(&projection));
+      glUniform3fv(crowd_light_direction_location, 1,
+                   reinterpret_cast<float *>(&light_direction));
+      glUniform1i(vat_positions_location, 1);
+      glUniform1i(vat_normals_location, 2);
+      glUniform1f(crowd_time_location, time);
+
+      for (auto const &clip : crowd) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, clip.positions);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, clip.normals);
+        glActiveTexture(GL_TEXTURE0);
+
+        auto const &bake = clip.bake;
+        glUniform1i(vat_width_location, bake.width);
+        glUniform1i(vat_rows_per_frame_location, bake.rows_per_frame);
+        glUniform1i(vat_frame_count_location, bake.frame_count);
+        glUniform1f(vat_frame_rate_location, bake.frame_rate);
+        glUniform1i(vat_quantized_location,
+                    bake.encoding == vertex_animation_encoding::quantized);
+        glUniform3fv(vat_bounds_min_location, 1, &bake.bounds_min[0]);
+        glUniform3fv(vat_bounds_max_location, 1, &bake.bounds_max[0]);
+
+        draw_meshes(transparent, crowd_use_texture_location,
+                    crowd_color_location, [&](std::size_t i) {
+                      auto const &mesh = meshes[i];
+                      glUniform1i(vertex_base_location,
+                                  bake.primitive_offsets[i]);
+                      glBindVertexArray(clip.vaos[i]);
+                      glDrawElementsInstanced(
+                          GL_TRIANGLES, mesh.indices.count, mesh.indices.type,
+                          reinterpret_cast<void *>(mesh.indices.view.offset),
+                          clip.instance_count);
+                    });
       }
     };
 
-    draw_meshes(false);
+    draw_character(false);
+    if (crowd_enabled) draw_crowd(false);
     glDepthMask(GL_FALSE);
-    draw_meshes(true);
+    draw_character(true);
+    if (crowd_enabled) draw_crowd(true);
     glDepthMask(GL_TRUE);
+    profiler.pop();
 
-    SDL_GL_SwapWindow(window);
+    if (options.track)
+      bench.end_frame();
+    else
+      SDL_GL_SwapWindow(window);
+    profiler.end_frame();
+
+    if (options.track || ++frame_count % 60 != 0) continue;
+
+    profiler.print(std::cout);
+    std::cout << "animation level:\t" << character_animation.level
+              << "\tbones sampled per frame:\t" << sampled_bones / 60.f
+              << "\tgraph nodes evaluated / cached / skipped:\t"
+              << graph.stats.evaluated << " / " << graph.stats.cached << " / "
+              << graph.stats.skipped << std::endl;
+    sampled_bones = 0;
   }
+  if (options.track) bench.finish();
+  if (options.trace) profiler.write_trace(*options.trace);
 
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
@@ -0,0 +1,272 @@
+#include "pose_transform.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+constexpr std::size_t batch = 8;
+
+std::size_t padded(std::size_t count)
+{
+    return (count + batch - 1) / batch * batch;
+}
+
+// Column-major 4x3 affine matrices from translation, rotation and scale,
+// component 3 * column + row of bone i lives at out[component * stride + i]
+
+#ifdef __AVX2__
+
+void compose(pose_soa const & local, float * out, std::size_t stride)
+{
+    __m256 const one = _mm256_set1_ps(1.f);
+    __m256 const two = _mm256_set1_ps(2.f);
+
+    for (std::size_t i = 0; i < stride; i += batch)
+    {
+        __m256 x = _mm256_loadu_ps(local.rotation[0].data() + i);
+        __m256 y = _mm256_loadu_ps(local.rotation[1].data() + i);
+        __m256 z = _mm256_loadu_ps(local.rotation[2].data() + i);
+        __m256 w = _mm256_loadu_ps(local.rotation[3].data() + i);
+        __m256 sx = _mm256_loadu_ps(local.scale[0].data() + i);
+        __m256 sy = _mm256_loadu_ps(local.scale[1].data() + i);
+        __m256 sz = _mm256_loadu_ps(local.scale[2].data() + i);
+
+        __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+        __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+        __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+        auto diagonal = [&](__m256 a, __m256 b, __m256 s)
+        {
+            return _mm256_mul_ps(s, _mm256_fnmadd_ps(two, _mm256_add_ps(a, b), one));
+        };
+        auto sum = [&](__m256 a, __m256 b, __m256 s)
+        {
+            return _mm256_mul_ps(s, _mm256_mul_ps(two, _mm256_add_ps(a, b)));
+        };
+        auto difference = [&](__m256 a, __m256 b, __m256 s)
+        {
+            return _mm256_mul_ps(s, _mm256_mul_ps(two, _mm256_sub_ps(a, b)));
+        };
+
+        _mm256_storeu_ps(out + 0 * stride + i, diagonal(yy, zz, sx));
+        _mm256_storeu_ps(out + 1 * stride + i, sum(xy, wz, sx));
+        _mm256_storeu_ps(out + 2 * stride + i, difference(xz, wy, sx));
+        _mm256_storeu_ps(out + 3 * stride + i, difference(xy, wz, sy));
+        _mm256_storeu_ps(out + 4 * stride + i, diagonal(xx, zz, sy));
+        _mm256_storeu_ps(out + 5 * stride + i, sum(yz, wx, sy));
+        _mm256_storeu_ps(out + 6 * stride + i, sum(xz, wy, sz));
+        _mm256_storeu_ps(out + 7 * stride + i, difference(yz, wx, sz));
+        _mm256_storeu_ps(out + 8 * stride + i, diagonal(xx, yy, sz));
+        _mm256_storeu_ps(out + 9 * stride + i, _mm256_loadu_ps(local.translation[0].data() + i));
+        _mm256_storeu_ps(out + 10 * stride + i, _mm256_loadu_ps(local.translation[1].data() + i));
+        _mm256_storeu_ps(out + 11 * stride + i, _mm256_loadu_ps(local.translation[2].data() + i));
+    }
+}
+
+// Columns of an affine matrix, the fourth lane is ignored
+struct affine
+{
+    __m128 c[4];
+};
+
+inline affine load(float const * m, std::size_t stride)
+{
+    affine result;
+    for (int c = 0; c < 4; ++c)
+        result.c[c] = _mm_setr_ps(m[(3 * c + 0) * stride], m[(3 * c + 1) * stride], m[(3 * c + 2) * stride], 0.f);
+    return result;
+}
+
+// a * b, where b is read component by component with the given stride
+inline affine multiply(affine const & a, float const * b, std::size_t stride)
+{
+    affine result;
+    for (int c = 0; c < 4; ++c)
+    {
+        result.c[c] = _mm_fmadd_ps(a.c[0], _mm_set1_ps(b[(3 * c + 0) * stride]),
+            _mm_fmadd_ps(a.c[1], _mm_set1_ps(b[(3 * c + 1) * stride]),
+            _mm_mul_ps(a.c[2], _mm_set1_ps(b[(3 * c + 2) * stride]))));
+    }
+    result.c[3] = _mm_add_ps(result.c[3], a.c[3]);
+    return result;
+}
+
+// Writes 12 floats; the first three columns spill one float into the next one,
+// which is then overwritten
+inline void store(affine const & m, float * out)
+{
+    _mm_storeu_ps(out + 0, m.c[0]);
+    _mm_storeu_ps(out + 3, m.c[1]);
+    _mm_storeu_ps(out + 6, m.c[2]);
+    _mm_storel_pi(reinterpret_cast<__m64 *>(out + 9), m.c[3]);
+    _mm_store_ss(out + 11, _mm_movehl_ps(m.c[3], m.c[3]));
+}
+
+inline affine load_padded(std::array<float, 16> const & m)
+{
+    return {_mm_loadu_ps(&m[0]), _mm_loadu_ps(&m[4]), _mm_loadu_ps(&m[8]), _mm_loadu_ps(&m[12])};
+}
+
+inline void store_padded(affine const & m, std::array<float, 16> & out)
+{
+    for (int c = 0; c < 4; ++c)
+        _mm_storeu_ps(&out[4 * c], m.c[c]);
+}
+
+#else
+
+void compose(pose_soa const & local, float * out, std::size_t stride)
+{
+    for (std::size_t i = 0; i < stride; ++i)
+    {
+        float x = local.rotation[0][i], y = local.rotation[1][i], z = local.rotation[2][i], w = local.rotation[3][i];
+        float sx = local.scale[0][i], sy = local.scale[1][i], sz = local.scale[2][i];
+
+        out[0 * stride + i] = sx * (1.f - 2.f * (y * y + z * z));
+        out[1 * stride + i] = sx * (2.f * (x * y + w * z));
+        out[2 * stride + i] = sx * (2.f * (x * z - w * y));
+        out[3 * stride + i] = sy * (2.f * (x * y - w * z));
+        out[4 * stride + i] = sy * (1.f - 2.f * (x * x + z * z));
+        out[5 * stride + i] = sy * (2.f * (y * z + w * x));
+        out[6 * stride + i] = sz * (2.f * (x * z + w * y));
+        out[7 * stride + i] = sz * (2.f * (y * z - w * x));
+        out[8 * stride + i] = sz * (1.f - 2.f * (x * x + y * y));
+        out[9 * stride + i] = local.translation[0][i];
+        out[10 * stride + i] = local.translation[1][i];
+        out[11 * stride + i] = local.translation[2][i];
+    }
+}
+
+struct affine
+{
+    float m[12];
+};
+
+inline affine load(float const * m, std::size_t stride)
+{
+    affine result;
+    for (int k = 0; k < 12; ++k)
+        result.m[k] = m[k * stride];
+    return result;
+}
+
+inline affine multiply(affine const & a, float const * b, std::size_t stride)
+{
+    affine result;
+    for (int c = 0; c < 4; ++c)
+    {
+        float const bx = b[(3 * c + 0) * stride], by = b[(3 * c + 1) * stride], bz = b[(3 * c + 2) * stride];
+        for (int r = 0; r < 3; ++r)
+            result.m[3 * c + r] = a.m[r] * bx + a.m[3 + r] * by + a.m[6 + r] * bz + (c == 3 ? a.m[9 + r] : 0.f);
+    }
+    return result;
+}
+
+inline void store(affine const & m, float * out)
+{
+    std::copy(m.m, m.m + 12, out);
+}
+
+inline affine load_padded(std::array<float, 16> const & m)
+{
+    affine result;
+    std::copy(m.begin(), m.begin() + 12, result.m);
+    return result;
+}
+
+inline void store_padded(affine const & m, std::array<float, 16> & out)
+{
+    std::copy(m.m, m.m + 12, out.begin());
+}
+
+#endif
+
+}
+
+void pose_soa::assign(pose const & source)
+{
+    std::size_t const count = source.translation.size();
+    std::size_t const size = padded(count);
+
+    for (auto & v : translation) v.assign(size, 0.f);
+    for (auto & v : scale) v.assign(size, 1.f);
+    for (auto & v : rotation) v.assign(size, 0.f);
+    rotation[3].assign(size, 1.f);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            translation[c][i] = source.translation[i][c];
+            scale[c][i] = source.scale[i][c];
+        }
+        rotation[0][i] = source.rotation[i].x;
+        rotation[1][i] = source.rotation[i].y;
+        rotation[2][i] = source.rotation[i].z;
+        rotation[3][i] = source.rotation[i].w;
+    }
+}
+
+pose_transform::pose_transform(gltf_model const & model)
+{
+    for (auto const & bone : model.bones)
+    {
+        parents.push_back(bone.parent);
+        glm::mat4x3 const ibm(bone.inverse_bind_matrix);
+        inverse_bind.insert(inverse_bind.end(), &ibm[0][0], &ibm[0][0] + 12);
+    }
+
+    stride = padded(parents.size());
+    local_affine.resize(12 * stride);
+    global.resize(parents.size());
+}
+
+void pose_transform::compute(pose const & local, std::vector<glm::mat4x3> & palette)
+{
+    soa.assign(local);
+    compute(soa, palette);
+}
+
+void pose_transform::compute(pose_soa const & local, std::vector<glm::mat4x3> & palette)
+{
+    std::size_t const count = parents.size();
+    palette.resize(count);
+
+    compose(local, local_affine.data(), stride);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        float const * l = local_affine.data() + i;
+
+        affine const g = parents[i] == gltf_model::bone::no_parent ? load(l, stride) : multiply(load_padded(global[parents[i]]), l, stride);
+        store_padded(g, global[i]);
+
+        store(multiply(g, inverse_bind.data() + 12 * i, 1), &palette[i][0][0]);
+    }
+}
+
+void compute_palette_reference(gltf_model const & model, pose const & local, std::vector<glm::mat4x3> & palette)
+{
+    palette.resize(model.bones.size());
+    for (std::size_t i = 0; i < palette.size(); i++)
+    {
+        glm::mat4 transform = glm::translate(glm::mat4(1), local.translation[i])
+            * glm::toMat4(local.rotation[i])
+            * glm::scale(glm::mat4(1), local.scale[i]);
+
+        if (model.bones[i].parent != gltf_model::bone::no_parent)
+            transform = palette[model.bones[i].parent] * transform;
+
+        palette[i] = transform;
+    }
+
+    for (std::size_t i = 0; i < palette.size(); i++)
+        palette[i] = palette[i] * model.bones[i].inverse_bind_matrix;
+}
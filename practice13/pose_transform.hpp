@@ -0,0 +1,46 @@
+#pragma once
+
+#include "animation_graph.hpp"
+#include "gltf_loader.hpp"
+
+#include <glm/mat4x3.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Structure-of-arrays local pose, bone count padded to a multiple of 8
+struct pose_soa
+{
+    std::array<std::vector<float>, 3> translation;
+    std::array<std::vector<float>, 4> rotation;
+    std::array<std::vector<float>, 3> scale;
+
+    void assign(pose const & source);
+};
+
+// Turns local bone poses into the skinning palette (global bone transform times
+// inverse bind matrix). TRS is composed straight into 4x3 affine form eight bones
+// at a time, then a single pass in bone order multiplies by the parent and by the
+// inverse bind matrix; this relies on the loader guaranteeing parent < child.
+struct pose_transform
+{
+    explicit pose_transform(gltf_model const & model);
+
+    void compute(pose_soa const & local, std::vector<glm::mat4x3> & palette);
+    void compute(pose const & local, std::vector<glm::mat4x3> & palette);
+
+private:
+    std::vector<std::uint32_t> parents;
+    // 4x3 column-major, 12 floats per bone
+    std::vector<float> inverse_bind;
+
+    pose_soa soa;
+    std::size_t stride = 0;
+    std::vector<float> local_affine;
+    // Global bone transforms, one padded 4x4 column-major block per bone
+    std::vector<std::array<float, 16>> global;
+};
+
+// The glm::mat4 version main.cpp used before, kept to validate and benchmark against
+void compute_palette_reference(gltf_model const & model, pose const & local, std::vector<glm::mat4x3> & palette);
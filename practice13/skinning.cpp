@@ -0,0 +1,371 @@
+#include "skinning.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+constexpr unsigned int gl_unsigned_byte = 0x1401;
+constexpr unsigned int gl_unsigned_short = 0x1403;
+constexpr unsigned int gl_float = 0x1406;
+
+// Rigid part of a palette matrix as a unit dual quaternion,
+// stored as {real.xyzw, dual.xyzw} so kernels can gather it by component
+std::array<float, 8> to_dual_quaternion(glm::mat4x3 const & m)
+{
+    glm::mat3 rotation{glm::normalize(m[0]), glm::normalize(m[1]), glm::normalize(m[2])};
+    glm::quat q = glm::normalize(glm::quat_cast(rotation));
+    glm::vec3 t = m[3];
+
+    glm::vec3 qv{q.x, q.y, q.z};
+    glm::vec3 dv = 0.5f * (q.w * t + glm::cross(t, qv));
+    float dw = -0.5f * glm::dot(t, qv);
+
+    return {q.x, q.y, q.z, q.w, dv.x, dv.y, dv.z, dw};
+}
+
+std::vector<std::array<float, 8>> to_dual_quaternions(std::vector<glm::mat4x3> const & bones)
+{
+    std::vector<std::array<float, 8>> result(bones.size());
+    for (std::size_t i = 0; i < bones.size(); ++i)
+        result[i] = to_dual_quaternion(bones[i]);
+    return result;
+}
+
+void resize(skinned_vertices & result, std::size_t count)
+{
+    for (auto & v : result.position) v.resize(count);
+    for (auto & v : result.normal) v.resize(count);
+}
+
+void skin_linear_scalar(skin_data const & data, glm::mat4x3 const * bones, skinned_vertices & result,
+    std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        glm::mat4x3 average(0.f);
+        for (int k = 0; k < 4; ++k)
+            average += bones[data.joints[k][i]] * data.weights[k][i];
+
+        glm::vec3 p{data.position[0][i], data.position[1][i], data.position[2][i]};
+        glm::vec3 n{data.normal[0][i], data.normal[1][i], data.normal[2][i]};
+
+        p = average * glm::vec4(p, 1.f);
+        n = glm::normalize(glm::mat3(average) * n);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            result.position[c][i] = p[c];
+            result.normal[c][i] = n[c];
+        }
+    }
+}
+
+void skin_dual_quaternion_scalar(skin_data const & data, std::array<float, 8> const * bones, skinned_vertices & result,
+    std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        auto real_of = [&](std::uint32_t j){ return glm::quat(bones[j][3], bones[j][0], bones[j][1], bones[j][2]); };
+        auto dual_of = [&](std::uint32_t j){ return glm::quat(bones[j][7], bones[j][4], bones[j][5], bones[j][6]); };
+
+        glm::quat const pivot = real_of(data.joints[0][i]);
+
+        glm::quat real(0.f, 0.f, 0.f, 0.f);
+        glm::quat dual(0.f, 0.f, 0.f, 0.f);
+        for (int k = 0; k < 4; ++k)
+        {
+            std::uint32_t j = data.joints[k][i];
+            float w = data.weights[k][i];
+            if (glm::dot(real_of(j), pivot) < 0.f)
+                w = -w;
+            real = real + real_of(j) * w;
+            dual = dual + dual_of(j) * w;
+        }
+
+        float const length = glm::length(real);
+        real = real / length;
+        dual = dual / length;
+
+        glm::quat const offset = dual * glm::conjugate(real);
+        glm::vec3 const translation = 2.f * glm::vec3(offset.x, offset.y, offset.z);
+
+        glm::vec3 p{data.position[0][i], data.position[1][i], data.position[2][i]};
+        glm::vec3 n{data.normal[0][i], data.normal[1][i], data.normal[2][i]};
+
+        p = glm::rotate(real, p) + translation;
+        n = glm::normalize(glm::rotate(real, n));
+
+        for (int c = 0; c < 3; ++c)
+        {
+            result.position[c][i] = p[c];
+            result.normal[c][i] = n[c];
+        }
+    }
+}
+
+#ifdef __AVX2__
+
+struct vec3x8
+{
+    __m256 x, y, z;
+};
+
+inline vec3x8 load3(std::array<std::vector<float>, 3> const & v, std::size_t i)
+{
+    return {_mm256_loadu_ps(v[0].data() + i), _mm256_loadu_ps(v[1].data() + i), _mm256_loadu_ps(v[2].data() + i)};
+}
+
+inline void store3(std::array<std::vector<float>, 3> & v, std::size_t i, vec3x8 const & value)
+{
+    _mm256_storeu_ps(v[0].data() + i, value.x);
+    _mm256_storeu_ps(v[1].data() + i, value.y);
+    _mm256_storeu_ps(v[2].data() + i, value.z);
+}
+
+inline vec3x8 cross(vec3x8 const & a, vec3x8 const & b)
+{
+    return {
+        _mm256_fmsub_ps(a.y, b.z, _mm256_mul_ps(a.z, b.y)),
+        _mm256_fmsub_ps(a.z, b.x, _mm256_mul_ps(a.x, b.z)),
+        _mm256_fmsub_ps(a.x, b.y, _mm256_mul_ps(a.y, b.x)),
+    };
+}
+
+inline vec3x8 normalize(vec3x8 const & v)
+{
+    __m256 length2 = _mm256_fmadd_ps(v.x, v.x, _mm256_fmadd_ps(v.y, v.y, _mm256_mul_ps(v.z, v.z)));
+    __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(length2));
+    return {_mm256_mul_ps(v.x, inv), _mm256_mul_ps(v.y, inv), _mm256_mul_ps(v.z, inv)};
+}
+
+void skin_linear_avx2(skin_data const & data, glm::mat4x3 const * bones, skinned_vertices & result,
+    std::size_t begin, std::size_t end)
+{
+    float const * palette = &bones[0][0][0];
+    __m256i const stride = _mm256_set1_epi32(12);
+
+    for (std::size_t i = begin; i < end; i += skinning_batch)
+    {
+        __m256 m[12];
+        for (auto & c : m) c = _mm256_setzero_ps();
+
+        for (int k = 0; k < 4; ++k)
+        {
+            __m256i base = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data.joints[k].data() + i)), stride);
+            __m256 w = _mm256_loadu_ps(data.weights[k].data() + i);
+            for (int c = 0; c < 12; ++c)
+                m[c] = _mm256_fmadd_ps(w, _mm256_i32gather_ps(palette + c, base, 4), m[c]);
+        }
+
+        vec3x8 p = load3(data.position, i);
+        vec3x8 n = load3(data.normal, i);
+
+        vec3x8 rp, rn;
+        rp.x = _mm256_fmadd_ps(m[0], p.x, _mm256_fmadd_ps(m[3], p.y, _mm256_fmadd_ps(m[6], p.z, m[9])));
+        rp.y = _mm256_fmadd_ps(m[1], p.x, _mm256_fmadd_ps(m[4], p.y, _mm256_fmadd_ps(m[7], p.z, m[10])));
+        rp.z = _mm256_fmadd_ps(m[2], p.x, _mm256_fmadd_ps(m[5], p.y, _mm256_fmadd_ps(m[8], p.z, m[11])));
+        rn.x = _mm256_fmadd_ps(m[0], n.x, _mm256_fmadd_ps(m[3], n.y, _mm256_mul_ps(m[6], n.z)));
+        rn.y = _mm256_fmadd_ps(m[1], n.x, _mm256_fmadd_ps(m[4], n.y, _mm256_mul_ps(m[7], n.z)));
+        rn.z = _mm256_fmadd_ps(m[2], n.x, _mm256_fmadd_ps(m[5], n.y, _mm256_mul_ps(m[8], n.z)));
+
+        store3(result.position, i, rp);
+        store3(result.normal, i, normalize(rn));
+    }
+}
+
+void skin_dual_quaternion_avx2(skin_data const & data, std::array<float, 8> const * bones, skinned_vertices & result,
+    std::size_t begin, std::size_t end)
+{
+    float const * palette = bones[0].data();
+    __m256i const stride = _mm256_set1_epi32(8);
+    __m256 const sign_bit = _mm256_set1_ps(-0.f);
+
+    for (std::size_t i = begin; i < end; i += skinning_batch)
+    {
+        __m256 real[4], dual[4], pivot[4];
+
+        for (int k = 0; k < 4; ++k)
+        {
+            __m256i base = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data.joints[k].data() + i)), stride);
+            __m256 w = _mm256_loadu_ps(data.weights[k].data() + i);
+
+            __m256 q[8];
+            for (int c = 0; c < 8; ++c)
+                q[c] = _mm256_i32gather_ps(palette + c, base, 4);
+
+            if (k == 0)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    pivot[c] = q[c];
+                    real[c] = _mm256_mul_ps(w, q[c]);
+                    dual[c] = _mm256_mul_ps(w, q[c + 4]);
+                }
+                continue;
+            }
+
+            // Take the shortest path relative to the first influence
+            __m256 d = _mm256_fmadd_ps(q[0], pivot[0], _mm256_fmadd_ps(q[1], pivot[1],
+                _mm256_fmadd_ps(q[2], pivot[2], _mm256_mul_ps(q[3], pivot[3]))));
+            w = _mm256_xor_ps(w, _mm256_and_ps(d, sign_bit));
+
+            for (int c = 0; c < 4; ++c)
+            {
+                real[c] = _mm256_fmadd_ps(w, q[c], real[c]);
+                dual[c] = _mm256_fmadd_ps(w, q[c + 4], dual[c]);
+            }
+        }
+
+        __m256 length2 = _mm256_fmadd_ps(real[0], real[0], _mm256_fmadd_ps(real[1], real[1],
+            _mm256_fmadd_ps(real[2], real[2], _mm256_mul_ps(real[3], real[3]))));
+        __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(length2));
+        for (int c = 0; c < 4; ++c)
+        {
+            real[c] = _mm256_mul_ps(real[c], inv);
+            dual[c] = _mm256_mul_ps(dual[c], inv);
+        }
+
+        vec3x8 rv{real[0], real[1], real[2]};
+        vec3x8 dv{dual[0], dual[1], dual[2]};
+        __m256 two = _mm256_set1_ps(2.f);
+
+        // t = 2 (r.w d.xyz - d.w r.xyz + r.xyz x d.xyz)
+        vec3x8 rd = cross(rv, dv);
+        vec3x8 t{
+            _mm256_mul_ps(two, _mm256_add_ps(_mm256_fmsub_ps(real[3], dv.x, _mm256_mul_ps(dual[3], rv.x)), rd.x)),
+            _mm256_mul_ps(two, _mm256_add_ps(_mm256_fmsub_ps(real[3], dv.y, _mm256_mul_ps(dual[3], rv.y)), rd.y)),
+            _mm256_mul_ps(two, _mm256_add_ps(_mm256_fmsub_ps(real[3], dv.z, _mm256_mul_ps(dual[3], rv.z)), rd.z)),
+        };
+
+        // v' = v + 2 r.xyz x (r.xyz x v + r.w v)
+        auto rotate = [&](vec3x8 const & v)
+        {
+            vec3x8 a = cross(rv, v);
+            a.x = _mm256_fmadd_ps(real[3], v.x, a.x);
+            a.y = _mm256_fmadd_ps(real[3], v.y, a.y);
+            a.z = _mm256_fmadd_ps(real[3], v.z, a.z);
+            vec3x8 b = cross(rv, a);
+            return vec3x8{_mm256_fmadd_ps(two, b.x, v.x), _mm256_fmadd_ps(two, b.y, v.y), _mm256_fmadd_ps(two, b.z, v.z)};
+        };
+
+        vec3x8 p = rotate(load3(data.position, i));
+        p.x = _mm256_add_ps(p.x, t.x);
+        p.y = _mm256_add_ps(p.y, t.y);
+        p.z = _mm256_add_ps(p.z, t.z);
+
+        store3(result.position, i, p);
+        store3(result.normal, i, normalize(rotate(load3(data.normal, i))));
+    }
+}
+
+#endif
+
+}
+
+skin_data load_skin_data(gltf_model const & model, gltf_model::primitive const & primitive)
+{
+    if (primitive.position.type != gl_float || primitive.normal.type != gl_float || primitive.weights.type != gl_float)
+        throw std::runtime_error("Skinning expects float positions, normals and weights");
+
+    skin_data result;
+    result.vertex_count = primitive.position.count;
+
+    std::size_t const padded = (result.vertex_count + skinning_batch - 1) / skinning_batch * skinning_batch;
+
+    for (auto & v : result.position) v.assign(padded, 0.f);
+    for (auto & v : result.normal) v.assign(padded, 0.f);
+    for (auto & v : result.joints) v.assign(padded, 0);
+    for (auto & v : result.weights) v.assign(padded, 0.f);
+
+    auto const * positions = reinterpret_cast<float const *>(model.buffer.data() + primitive.position.view.offset);
+    auto const * normals = reinterpret_cast<float const *>(model.buffer.data() + primitive.normal.view.offset);
+    auto const * weights = reinterpret_cast<float const *>(model.buffer.data() + primitive.weights.view.offset);
+    auto const * joints = model.buffer.data() + primitive.joints.view.offset;
+
+    auto joint = [&](std::size_t i) -> std::uint32_t
+    {
+        if (primitive.joints.type == gl_unsigned_byte)
+            return reinterpret_cast<std::uint8_t const *>(joints)[i];
+        if (primitive.joints.type == gl_unsigned_short)
+            return reinterpret_cast<std::uint16_t const *>(joints)[i];
+        throw std::runtime_error("Unsupported JOINTS_0 component type: " + std::to_string(primitive.joints.type));
+    };
+
+    for (std::size_t i = 0; i < result.vertex_count; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            result.position[c][i] = positions[3 * i + c];
+            result.normal[c][i] = normals[3 * i + c];
+        }
+        for (int k = 0; k < 4; ++k)
+        {
+            result.joints[k][i] = joint(4 * i + k);
+            result.weights[k][i] = weights[4 * i + k];
+        }
+    }
+
+    for (std::size_t i = result.vertex_count; i < padded; ++i)
+    {
+        result.normal[2][i] = 1.f;
+        result.weights[0][i] = 1.f;
+    }
+
+    return result;
+}
+
+void skin(skin_data const & data, std::vector<glm::mat4x3> const & bones, skinning_mode mode,
+    skinned_vertices & result, thread_pool * pool)
+{
+    resize(result, data.padded_count());
+
+    std::vector<std::array<float, 8>> dual_quaternions;
+    if (mode == skinning_mode::dual_quaternion)
+        dual_quaternions = to_dual_quaternions(bones);
+
+    auto kernel = [&](std::size_t begin, std::size_t end)
+    {
+#ifdef __AVX2__
+        if (mode == skinning_mode::linear_blend)
+            skin_linear_avx2(data, bones.data(), result, begin, end);
+        else
+            skin_dual_quaternion_avx2(data, dual_quaternions.data(), result, begin, end);
+#else
+        if (mode == skinning_mode::linear_blend)
+            skin_linear_scalar(data, bones.data(), result, begin, end);
+        else
+            skin_dual_quaternion_scalar(data, dual_quaternions.data(), result, begin, end);
+#endif
+    };
+
+    // Chunk sizes stay multiples of the batch, the padded tail is always whole
+    std::size_t const grain = 128 * skinning_batch;
+    if (pool)
+        pool->parallel_for(data.padded_count(), grain, kernel);
+    else
+        kernel(0, data.padded_count());
+}
+
+void skin_reference(skin_data const & data, std::vector<glm::mat4x3> const & bones, skinning_mode mode,
+    skinned_vertices & result)
+{
+    resize(result, data.padded_count());
+
+    if (mode == skinning_mode::linear_blend)
+        skin_linear_scalar(data, bones.data(), result, 0, data.padded_count());
+    else
+    {
+        auto dual_quaternions = to_dual_quaternions(bones);
+        skin_dual_quaternion_scalar(data, dual_quaternions.data(), result, 0, data.padded_count());
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/mat4x3.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+enum class skinning_mode
+{
+    linear_blend,
+    dual_quaternion,
+};
+
+// Vertex counts are padded up to a multiple of this, padding vertices are
+// bound to bone 0 with weight 1 so kernels never need a scalar tail
+constexpr std::size_t skinning_batch = 8;
+
+// Structure-of-arrays copy of the skinning attributes of one primitive
+struct skin_data
+{
+    std::size_t vertex_count = 0;
+
+    std::array<std::vector<float>, 3> position;
+    std::array<std::vector<float>, 3> normal;
+    std::array<std::vector<std::uint32_t>, 4> joints;
+    std::array<std::vector<float>, 4> weights;
+
+    std::size_t padded_count() const { return position[0].size(); }
+};
+
+struct skinned_vertices
+{
+    std::array<std::vector<float>, 3> position;
+    std::array<std::vector<float>, 3> normal;
+
+    glm::vec3 get_position(std::size_t i) const { return {position[0][i], position[1][i], position[2][i]}; }
+    glm::vec3 get_normal(std::size_t i) const { return {normal[0][i], normal[1][i], normal[2][i]}; }
+};
+
+skin_data load_skin_data(gltf_model const & model, gltf_model::primitive const & primitive);
+
+// bones is the same palette that main.cpp uploads to the shader,
+// i.e. global bone transform times inverse bind matrix
+void skin(skin_data const & data, std::vector<glm::mat4x3> const & bones, skinning_mode mode,
+    skinned_vertices & result, thread_pool * pool = nullptr);
+
+// Straightforward per-vertex glm version, used to validate the SIMD kernels
+void skin_reference(skin_data const & data, std::vector<glm::mat4x3> const & bones, skinning_mode mode,
+    skinned_vertices & result);
@@ -0,0 +1,278 @@
+#include "skinning_benchmark.hpp"
+
+#include "animation_graph.hpp"
+#include "gltf_loader.hpp"
+#include "pose_transform.hpp"
+#include "skinning.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+struct benchmark_model
+{
+    char const * path;
+    char const * animation;
+};
+
+benchmark_model const models[] = {
+    {"dancing/dancing.gltf", "hip-hop"},
+    {"wolf/Wolf-Blender-2.82a.gltf", "02_walk"},
+};
+
+struct mode_result
+{
+    std::string model;
+    char const * mode;
+    // Largest position difference relative to the bind pose's bounding box
+    // diagonal, and largest length of a normal difference
+    float position_error = 0.f;
+    float normal_error = 0.f;
+    double reference = 0.0;
+    double single_thread = 0.0;
+    double threaded = 0.0;
+};
+
+struct palette_result
+{
+    std::string model;
+    std::size_t bones = 0;
+    // Largest difference of a palette column from compute_palette_reference(),
+    // translations relative to the bind pose's bounding box diagonal
+    float error = 0.f;
+    double reference_microseconds = 0.0;
+    double microseconds = 0.0;
+};
+
+template <typename F>
+double seconds(F && f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+skinning_benchmark_options parse_skinning_benchmark_options(int argc, char ** argv)
+{
+    skinning_benchmark_options result;
+    if (argc < 2 || std::string(argv[1]) != "--skinning-bench")
+        return result;
+    result.enabled = true;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error("Missing value after " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--output")
+            result.output = value();
+        else if (arg == "--frames")
+            result.frames = std::stoi(value());
+        else if (arg == "--threads")
+            result.threads = std::stoul(value());
+        else
+            throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (result.frames <= 0)
+        throw std::runtime_error("--frames must be positive");
+
+    return result;
+}
+
+bool run_skinning_benchmark(skinning_benchmark_options const & options)
+{
+    // Far above the float rounding of either kernel, far below a wrong bone or weight
+    float const position_tolerance = 1e-4f;
+    float const normal_tolerance = 1e-3f;
+    float const palette_tolerance = 1e-4f;
+
+    thread_pool pool(options.threads ? options.threads : std::thread::hardware_concurrency());
+    std::vector<mode_result> results;
+    std::vector<palette_result> palette_results;
+    bool passed = true;
+
+    std::cout << std::fixed;
+    for (auto const & m : models)
+    {
+        std::filesystem::path const path = std::filesystem::path(PROJECT_ROOT) / m.path;
+        gltf_model const model = load_gltf(path);
+        auto const animation = model.animations.find(m.animation);
+        if (animation == model.animations.end())
+            throw std::runtime_error(std::string("Unknown animation ") + m.animation + " in " + path.string());
+
+        std::vector<skin_data> skins;
+        std::size_t vertices = 0;
+        glm::vec3 min(1e30f), max(-1e30f);
+        for (auto const & mesh : model.meshes)
+            for (auto const & primitive : mesh.primitives)
+            {
+                auto const & skin = skins.emplace_back(load_skin_data(model, primitive));
+                vertices += skin.vertex_count;
+                for (std::size_t i = 0; i < skin.vertex_count; ++i)
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        min[c] = std::min(min[c], skin.position[c][i]);
+                        max[c] = std::max(max[c], skin.position[c][i]);
+                    }
+            }
+        float const size = glm::length(max - min);
+
+        std::vector<pose> poses(options.frames);
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            poses[frame].resize(model.bones.size());
+            sample_animation(animation->second, animation->second.max_time * frame / options.frames, poses[frame]);
+        }
+
+        // The palettes are made up front so that only the skinning is timed
+        auto & p = palette_results.emplace_back();
+        p.model = path.filename().string();
+        p.bones = model.bones.size();
+        std::vector<std::vector<glm::mat4x3>> palettes(options.frames);
+        std::vector<glm::mat4x3> reference_palette;
+        pose_transform transform(model);
+        double const palette_time = seconds([&]
+        {
+            for (int frame = 0; frame < options.frames; ++frame)
+                transform.compute(poses[frame], palettes[frame]);
+        });
+        double const reference_palette_time = seconds([&]
+        {
+            for (int frame = 0; frame < options.frames; ++frame)
+                compute_palette_reference(model, poses[frame], reference_palette);
+        });
+        p.microseconds = palette_time / options.frames * 1e6;
+        p.reference_microseconds = reference_palette_time / options.frames * 1e6;
+
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            compute_palette_reference(model, poses[frame], reference_palette);
+            for (std::size_t bone = 0; bone < reference_palette.size(); ++bone)
+                for (int column = 0; column < 4; ++column)
+                {
+                    // The translation scales with the model, the rest is unitless
+                    float const scale = column == 3 ? size : 1.f;
+                    p.error = std::max(p.error,
+                        glm::length(palettes[frame][bone][column] - reference_palette[bone][column]) / scale);
+                }
+        }
+        bool const palette_accurate = p.error <= palette_tolerance;
+        passed = passed && palette_accurate;
+
+        std::cout << path.filename().string() << ": " << vertices << " vertices in " << skins.size()
+            << " primitives, " << model.bones.size() << " bones, " << options.frames << " frames of "
+            << m.animation << ", " << pool.size() << " threads\n";
+        std::cout << "palette\terror " << std::scientific << std::setprecision(2) << p.error << std::fixed
+            << std::setprecision(2) << "\tus per-bone glm " << p.reference_microseconds << "\tus pose_transform "
+            << p.microseconds << (palette_accurate ? "" : "\tFAILED") << '\n';
+        std::cout << "mode\tposition error\tnormal error\tMverts/s reference\tMverts/s 1 thread\tMverts/s "
+            << pool.size() << " threads\n";
+
+        skinned_vertices kernel, reference;
+        for (auto mode : {skinning_mode::linear_blend, skinning_mode::dual_quaternion})
+        {
+            auto & r = results.emplace_back();
+            r.model = path.filename().string();
+            r.mode = mode == skinning_mode::linear_blend ? "linear blend" : "dual quaternion";
+
+            for (auto const & palette : palettes)
+                for (auto const & data : skins)
+                {
+                    skin(data, palette, mode, kernel);
+                    skin_reference(data, palette, mode, reference);
+                    for (std::size_t i = 0; i < data.vertex_count; ++i)
+                    {
+                        r.position_error = std::max(r.position_error,
+                            glm::length(kernel.get_position(i) - reference.get_position(i)) / size);
+                        r.normal_error = std::max(r.normal_error,
+                            glm::length(kernel.get_normal(i) - reference.get_normal(i)));
+                    }
+                }
+
+            auto pass = [&](auto && f)
+            {
+                double const time = seconds([&]
+                {
+                    for (auto const & palette : palettes)
+                        for (auto const & data : skins)
+                            f(data, palette);
+                });
+                return double(vertices) * options.frames / time * 1e-6;
+            };
+            r.reference = pass([&](skin_data const & data, std::vector<glm::mat4x3> const & palette)
+            {
+                skin_reference(data, palette, mode, reference);
+            });
+            r.single_thread = pass([&](skin_data const & data, std::vector<glm::mat4x3> const & palette)
+            {
+                skin(data, palette, mode, kernel);
+            });
+            r.threaded = pass([&](skin_data const & data, std::vector<glm::mat4x3> const & palette)
+            {
+                skin(data, palette, mode, kernel, &pool);
+            });
+
+            bool const accurate = r.position_error <= position_tolerance && r.normal_error <= normal_tolerance;
+            passed = passed && accurate;
+
+            std::cout << r.mode << "\t" << std::scientific << std::setprecision(2) << r.position_error << "\t"
+                << r.normal_error << std::fixed << std::setprecision(1) << "\t" << r.reference << "\t"
+                << r.single_thread << "\t" << r.threaded << (accurate ? "" : "\tFAILED") << '\n';
+        }
+    }
+    std::cout << (passed ? "passed" : "FAILED") << '\n';
+    std::cout << std::defaultfloat;
+    std::cout.flush();
+
+    if (options.output)
+    {
+        std::ofstream out(*options.output);
+        out << std::setprecision(6);
+        out << "{\n";
+        out << "\"frames\": " << options.frames << ",\n";
+        out << "\"threads\": " << pool.size() << ",\n";
+        out << "\"passed\": " << (passed ? "true" : "false") << ",\n";
+        out << "\"palettes\": [";
+        for (std::size_t i = 0; i < palette_results.size(); ++i)
+        {
+            auto const & p = palette_results[i];
+            out << (i ? ",\n" : "\n") << "{\"model\": \"" << p.model << "\", \"bones\": " << p.bones
+                << ", \"error\": " << p.error << ", \"reference_us\": " << p.reference_microseconds
+                << ", \"pose_transform_us\": " << p.microseconds << "}";
+        }
+        out << "\n],\n";
+        out << "\"skinning\": [";
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            auto const & r = results[i];
+            out << (i ? ",\n" : "\n") << "{\"model\": \"" << r.model << "\", \"mode\": \"" << r.mode
+                << "\", \"position_error\": " << r.position_error << ", \"normal_error\": " << r.normal_error
+                << ", \"reference_mverts_per_second\": " << r.reference
+                << ", \"mverts_per_second\": " << r.single_thread
+                << ", \"threaded_mverts_per_second\": " << r.threaded << "}";
+        }
+        out << "\n]\n}\n";
+    }
+
+    return passed;
+}
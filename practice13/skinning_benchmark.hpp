@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+struct skinning_benchmark_options
+{
+    // Set by --skinning-bench, which has to be the first argument
+    bool enabled = false;
+    std::optional<std::filesystem::path> output;
+
+    // Poses sampled evenly over one clip of every model, each one skinned once per pass
+    int frames = 200;
+    // All hardware threads by default
+    std::size_t threads = 0;
+};
+
+// --skinning-bench [--frames <n>] [--threads <n>] [--output <json>]
+// Anything else leaves the options disabled without looking at the arguments.
+skinning_benchmark_options parse_skinning_benchmark_options(int argc, char ** argv);
+
+// Skins the dancer and the wolf without a window, in both modes. The palettes
+// from pose_transform are checked against compute_palette_reference() and the
+// kernels' output against skin_reference(), and the times of all four are
+// printed. Returns false if anything is off by more than the tolerance.
+bool run_skinning_benchmark(skinning_benchmark_options const & options);
@@ -0,0 +1,116 @@
+#include "vertex_animation.hpp"
+#include "pose_transform.hpp"
+#include "skinning.hpp"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+glm::vec2 octahedral_encode(glm::vec3 n)
+{
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (n.z < 0.f)
+    {
+        float x = (1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f);
+        float y = (1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f);
+        return {x, y};
+    }
+    return {n.x, n.y};
+}
+
+std::int16_t to_snorm16(float value)
+{
+    return static_cast<std::int16_t>(std::round(glm::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+std::uint16_t to_unorm16(float value)
+{
+    return static_cast<std::uint16_t>(std::round(glm::clamp(value, 0.f, 1.f) * 65535.f));
+}
+
+}
+
+vertex_animation_texture bake_vertex_animation(gltf_model const & model, std::string const & animation_name,
+    float frame_rate, vertex_animation_encoding encoding, thread_pool * pool, std::size_t width)
+{
+    auto const & animation = model.animations.at(animation_name);
+
+    vertex_animation_texture result;
+    result.encoding = encoding;
+
+    std::vector<skin_data> primitives;
+    for (auto const & mesh : model.meshes)
+    {
+        for (auto const & primitive : mesh.primitives)
+        {
+            result.primitive_offsets.push_back(result.vertex_count);
+            primitives.push_back(load_skin_data(model, primitive));
+            result.vertex_count += primitives.back().vertex_count;
+        }
+    }
+
+    result.frame_count = std::max<std::size_t>(1, std::lround(animation.max_time * frame_rate));
+    result.frame_rate = animation.max_time > 0.f ? result.frame_count / animation.max_time : frame_rate;
+    result.width = std::min(width, result.vertex_count);
+    result.rows_per_frame = (result.vertex_count + result.width - 1) / result.width;
+
+    std::size_t const texels = result.width * result.height();
+    std::vector<glm::vec3> positions(texels, glm::vec3(0.f));
+    result.normals.assign(texels * 2, 0);
+
+    result.bounds_min = glm::vec3(std::numeric_limits<float>::infinity());
+    result.bounds_max = -result.bounds_min;
+
+    pose_transform transform(model);
+    pose local;
+    local.resize(model.bones.size());
+    std::vector<glm::mat4x3> bones;
+
+    skinned_vertices skinned;
+    for (std::size_t frame = 0; frame < result.frame_count; ++frame)
+    {
+        float const time = frame / result.frame_rate;
+        sample_animation(animation, time, local);
+        transform.compute(local, bones);
+
+        std::size_t texel = frame * result.rows_per_frame * result.width;
+        for (auto const & data : primitives)
+        {
+            skin(data, bones, skinning_mode::linear_blend, skinned, pool);
+
+            for (std::size_t i = 0; i < data.vertex_count; ++i, ++texel)
+            {
+                glm::vec3 const p = skinned.get_position(i);
+                positions[texel] = p;
+                result.bounds_min = glm::min(result.bounds_min, p);
+                result.bounds_max = glm::max(result.bounds_max, p);
+
+                glm::vec2 const n = octahedral_encode(skinned.get_normal(i));
+                result.normals[2 * texel + 0] = to_snorm16(n.x);
+                result.normals[2 * texel + 1] = to_snorm16(n.y);
+            }
+        }
+    }
+
+    result.positions.resize(texels * 3);
+
+    glm::vec3 const extent = glm::max(result.bounds_max - result.bounds_min, glm::vec3(1e-6f));
+    for (std::size_t texel = 0; texel < texels; ++texel)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            if (encoding == vertex_animation_encoding::half_float)
+                result.positions[3 * texel + c] = glm::packHalf1x16(positions[texel][c]);
+            else
+                result.positions[3 * texel + c] = to_unorm16((positions[texel][c] - result.bounds_min[c]) / extent[c]);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+#include "thread_pool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class vertex_animation_encoding
+{
+    // RGB16F positions in model space
+    half_float,
+    // RGB16 unsigned normalized positions inside [bounds_min, bounds_max]
+    quantized,
+};
+
+// Skinned positions and normals of every vertex of a model for every frame of a clip.
+// Vertices of all primitives are concatenated in mesh order; texel of vertex v in
+// frame f is (v % width, f * rows_per_frame + v / width). Normals are stored
+// octahedral-encoded as RG16 signed normalized in both encodings.
+struct vertex_animation_texture
+{
+    vertex_animation_encoding encoding;
+
+    std::size_t vertex_count = 0;
+    std::size_t frame_count = 0;
+    float frame_rate = 0.f;
+
+    std::size_t width = 0;
+    std::size_t rows_per_frame = 0;
+
+    glm::vec3 bounds_min{0.f};
+    glm::vec3 bounds_max{0.f};
+
+    // First vertex of each primitive, in the order of gltf_model::meshes[].primitives[]
+    std::vector<std::size_t> primitive_offsets;
+
+    std::vector<std::uint16_t> positions;
+    std::vector<std::int16_t> normals;
+
+    std::size_t height() const { return frame_count * rows_per_frame; }
+};
+
+// Frame rate is adjusted slightly so that a whole number of frames fits the clip
+// and the texture loops seamlessly
+vertex_animation_texture bake_vertex_animation(gltf_model const & model, std::string const & animation,
+    float frame_rate, vertex_animation_encoding encoding, thread_pool * pool = nullptr, std::size_t width = 2048);
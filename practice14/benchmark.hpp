@@ -0,0 +1,109 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Camera state over time as named channels, linearly interpolated between keys.
+// Stored as text: the channel names on the first line, then one key per line,
+// its time followed by one value per channel.
+struct camera_track
+{
+	std::vector<std::string> channels;
+	std::vector<float> times;
+	std::vector<std::vector<float>> keys;
+
+	static camera_track load(std::filesystem::path const & path);
+	void save(std::filesystem::path const & path) const;
+
+	void add(float time, std::vector<float> values);
+	float duration() const;
+	std::vector<float> sample(float time) const;
+};
+
+struct benchmark_options
+{
+	// Replays this track instead of reading the keyboard
+	std::optional<std::filesystem::path> track;
+	// Records the interactive camera to this track
+	std::optional<std::filesystem::path> record;
+	std::optional<std::filesystem::path> output;
+	// Writes the frame profiler's Chrome trace here on exit
+	std::optional<std::filesystem::path> trace;
+	float timestep = 1.f / 60.f;
+	int width = 1280;
+	int height = 720;
+};
+
+// [--benchmark <track> [--output <json>] [--timestep <s>] [--size <w>x<h>] | --record <track>] [--trace <json>]
+benchmark_options parse_benchmark_options(int argc, char ** argv);
+
+// Before SDL_Init: a replay needs no display, so SDL's offscreen (EGL) video
+// driver is chosen unless SDL_VIDEODRIVER says otherwise
+void prepare_headless(benchmark_options const & options);
+
+// Replays a camera track with a fixed timestep into an offscreen framebuffer and
+// times every frame, on the CPU with steady_clock and on the GPU with
+// GL_TIME_ELAPSED queries that are read back a few frames later
+struct benchmark
+{
+	static constexpr int latency = 4;
+
+	benchmark(benchmark_options const & options, std::string program);
+	~benchmark();
+
+	benchmark(benchmark const &) = delete;
+	benchmark & operator = (benchmark const &) = delete;
+
+	benchmark_options options;
+	std::string program;
+	camera_track track;
+
+	// Color and depth of options.width x options.height, to be rendered to
+	// instead of the default framebuffer
+	GLuint framebuffer = 0;
+
+	// Advances to the next frame and returns false once the track is over
+	bool next_frame();
+	float time() const;
+	std::vector<float> camera() const;
+
+	void begin_frame();
+	void end_frame();
+
+	// Waits for the outstanding GPU results, then prints the statistics and
+	// writes them to options.output if given
+	void finish();
+
+private:
+	GLuint color = 0;
+	GLuint depth = 0;
+
+	int frame = -1;
+	std::chrono::steady_clock::time_point frame_start;
+	std::array<GLuint, latency> queries{};
+
+	std::vector<double> cpu_ms;
+	std::vector<double> gpu_ms;
+
+	void resolve(int index);
+};
+
+// Collects an interactive camera path when --record was given
+struct track_recorder
+{
+	track_recorder(benchmark_options const & options, std::vector<std::string> channels);
+	~track_recorder();
+
+	void add(float time, std::vector<float> values);
+
+private:
+	std::optional<std::filesystem::path> path;
+	camera_track track;
+};
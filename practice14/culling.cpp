@@ -0,0 +1,415 @@
+#include "culling.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+constexpr std::size_t batch = 8;
+constexpr unsigned int all_planes = 0x3f;
+
+// distance + radius of a box against a plane, negative when the box is entirely
+// outside. Evaluated in the same order (and with the same fused operations) as
+// the vector path, so that every path classifies a box identically.
+float plane_sum(glm::vec4 const & p, glm::vec3 const & c, glm::vec3 const & e)
+{
+#ifdef __FMA__
+	float distance = std::fma(p.x, c.x, std::fma(p.y, c.y, std::fma(p.z, c.z, p.w)));
+	return std::fma(std::abs(p.x), e.x, std::fma(std::abs(p.y), e.y, std::fma(std::abs(p.z), e.z, distance)));
+#else
+	float distance = p.x * c.x + (p.y * c.y + (p.z * c.z + p.w));
+	return std::abs(p.x) * e.x + (std::abs(p.y) * e.y + (std::abs(p.z) * e.z + distance));
+#endif
+}
+
+bool box_visible(std::array<glm::vec4, 6> const & planes, unsigned int plane_mask, glm::vec3 const & c, glm::vec3 const & e)
+{
+	for (int p = 0; p < 6; ++p)
+		if ((plane_mask & (1u << p)) && plane_sum(planes[p], c, e) < 0.f)
+			return false;
+	return true;
+}
+
+#ifdef __AVX2__
+
+// For every 8-bit visibility mask, the lanes to move to the front
+struct compaction_table
+{
+	alignas(32) std::array<std::array<std::int32_t, batch>, 256> lanes;
+
+	compaction_table()
+	{
+		for (std::size_t mask = 0; mask < 256; ++mask)
+		{
+			std::size_t count = 0;
+			for (std::size_t lane = 0; lane < batch; ++lane)
+				if (mask & (1 << lane))
+					lanes[mask][count++] = lane;
+			while (count < batch)
+				lanes[mask][count++] = 0;
+		}
+	}
+};
+
+const compaction_table compaction;
+
+// Frustum planes broadcast to all lanes
+struct plane_batch
+{
+	__m256 nx[6], ny[6], nz[6], d[6], ax[6], ay[6], az[6];
+
+	explicit plane_batch(frustum_planes const & frustum)
+	{
+		for (int p = 0; p < 6; ++p)
+		{
+			glm::vec4 const & plane = frustum.planes[p];
+			nx[p] = _mm256_set1_ps(plane.x);
+			ny[p] = _mm256_set1_ps(plane.y);
+			nz[p] = _mm256_set1_ps(plane.z);
+			d[p] = _mm256_set1_ps(plane.w);
+			ax[p] = _mm256_set1_ps(std::abs(plane.x));
+			ay[p] = _mm256_set1_ps(std::abs(plane.y));
+			az[p] = _mm256_set1_ps(std::abs(plane.z));
+		}
+	}
+};
+
+// Bit per box of boxes [i, i + 8) that passes all planes in plane_mask
+int visible_mask(plane_batch const & planes, aabb_soa const & boxes, std::size_t i, unsigned int plane_mask = all_planes)
+{
+	__m256 cx = _mm256_loadu_ps(boxes.center[0].data() + i);
+	__m256 cy = _mm256_loadu_ps(boxes.center[1].data() + i);
+	__m256 cz = _mm256_loadu_ps(boxes.center[2].data() + i);
+	__m256 ex = _mm256_loadu_ps(boxes.extent[0].data() + i);
+	__m256 ey = _mm256_loadu_ps(boxes.extent[1].data() + i);
+	__m256 ez = _mm256_loadu_ps(boxes.extent[2].data() + i);
+
+	// A box is outside when distance + radius < 0 for any of the planes
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 outside = zero;
+	for (int p = 0; p < 6; ++p)
+	{
+		if (!(plane_mask & (1u << p)))
+			continue;
+
+		__m256 distance = _mm256_fmadd_ps(planes.nx[p], cx, _mm256_fmadd_ps(planes.ny[p], cy, _mm256_fmadd_ps(planes.nz[p], cz, planes.d[p])));
+		__m256 sum = _mm256_fmadd_ps(planes.ax[p], ex, _mm256_fmadd_ps(planes.ay[p], ey, _mm256_fmadd_ps(planes.az[p], ez, distance)));
+		outside = _mm256_or_ps(outside, _mm256_cmp_ps(sum, zero, _CMP_LT_OQ));
+	}
+
+	return ~_mm256_movemask_ps(outside) & 0xff;
+}
+
+// Appends the lanes of indices selected by mask to out, may write up to 8 elements
+std::size_t compact(__m256i indices, int mask, std::uint32_t * out)
+{
+	__m256i const lanes = _mm256_load_si256(reinterpret_cast<__m256i const *>(compaction.lanes[mask].data()));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permutevar8x32_epi32(indices, lanes));
+	return std::popcount(static_cast<unsigned int>(mask));
+}
+
+#endif
+
+}
+
+frustum_planes::frustum_planes(glm::mat4 const & view_projection)
+{
+	// Rows of the matrix, combined as in Gribb & Hartmann
+	glm::vec4 r[4];
+	for (int i = 0; i < 4; ++i)
+		r[i] = glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+
+	planes = {
+		r[3] + r[0],
+		r[3] - r[0],
+		r[3] + r[1],
+		r[3] - r[1],
+		r[3] + r[2],
+		r[3] - r[2],
+	};
+}
+
+std::size_t aabb_soa::size() const
+{
+	return center[0].size();
+}
+
+void aabb_soa::reserve(std::size_t count)
+{
+	for (int c = 0; c < 3; ++c)
+	{
+		center[c].reserve(count);
+		extent[c].reserve(count);
+	}
+}
+
+void aabb_soa::clear()
+{
+	for (int c = 0; c < 3; ++c)
+	{
+		center[c].clear();
+		extent[c].clear();
+	}
+}
+
+void aabb_soa::push_back(glm::vec3 const & min, glm::vec3 const & max)
+{
+	for (int c = 0; c < 3; ++c)
+	{
+		center[c].push_back((min[c] + max[c]) * 0.5f);
+		extent[c].push_back((max[c] - min[c]) * 0.5f);
+	}
+}
+
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible)
+{
+	std::size_t const count = boxes.size();
+	// The vector path stores whole batches, so leave room for one past the end
+	if (visible.size() < count + batch)
+		visible.resize(count + batch);
+
+	std::size_t result = 0;
+	std::size_t i = 0;
+
+#ifdef __AVX2__
+	plane_batch const planes(frustum);
+
+	__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i const step = _mm256_set1_epi32(batch);
+
+	for (; i + batch <= count; i += batch, index = _mm256_add_epi32(index, step))
+		result += compact(index, visible_mask(planes, boxes, i), visible.data() + result);
+#endif
+
+	for (; i < count; ++i)
+	{
+		glm::vec3 c(boxes.center[0][i], boxes.center[1][i], boxes.center[2][i]);
+		glm::vec3 e(boxes.extent[0][i], boxes.extent[1][i], boxes.extent[2][i]);
+		if (box_visible(frustum.planes, all_planes, c, e))
+			visible[result++] = i;
+	}
+
+	return result;
+}
+
+aabb_bvh::aabb_bvh(aabb_soa const & boxes)
+{
+	build(boxes);
+}
+
+void aabb_bvh::build(aabb_soa const & source)
+{
+	std::size_t const count = source.size();
+
+	order.resize(count);
+	std::iota(order.begin(), order.end(), 0);
+
+	// Top-down median split along the longest axis of the box centers
+	nodes.clear();
+	nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), 0, static_cast<std::uint32_t>(count), 0});
+
+	std::vector<std::uint32_t> stack = {0};
+	while (!stack.empty())
+	{
+		std::uint32_t const index = stack.back();
+		stack.pop_back();
+
+		std::uint32_t const begin = nodes[index].begin;
+		std::uint32_t const end = nodes[index].end;
+		if (end - begin <= batch)
+			continue;
+
+		glm::vec3 lo(std::numeric_limits<float>::infinity());
+		glm::vec3 hi = -lo;
+		for (std::uint32_t i = begin; i < end; ++i)
+		{
+			glm::vec3 c(source.center[0][order[i]], source.center[1][order[i]], source.center[2][order[i]]);
+			lo = glm::min(lo, c);
+			hi = glm::max(hi, c);
+		}
+
+		glm::vec3 const size = hi - lo;
+		int const axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+
+		std::uint32_t const middle = begin + (end - begin) / 2;
+		auto const & key = source.center[axis];
+		std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+			[&](std::uint32_t a, std::uint32_t b){ return key[a] < key[b]; });
+
+		std::uint32_t const child = nodes.size();
+		nodes[index].child = child;
+		nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), begin, middle, 0});
+		nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), middle, end, 0});
+		stack.push_back(child);
+		stack.push_back(child + 1);
+	}
+
+	std::size_t const padded = (count + batch - 1) / batch * batch + batch;
+
+	slots.resize(count);
+	boxes.clear();
+	boxes.reserve(padded);
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		slots[order[i]] = i;
+		for (int c = 0; c < 3; ++c)
+		{
+			boxes.center[c].push_back(source.center[c][order[i]]);
+			boxes.extent[c].push_back(source.extent[c][order[i]]);
+		}
+	}
+	for (int c = 0; c < 3; ++c)
+	{
+		boxes.center[c].resize(padded, 0.f);
+		boxes.extent[c].resize(padded, 0.f);
+	}
+	order.resize(padded, 0);
+
+	refit();
+}
+
+void aabb_bvh::update(std::uint32_t index, glm::vec3 const & min, glm::vec3 const & max)
+{
+	std::uint32_t const slot = slots[index];
+	for (int c = 0; c < 3; ++c)
+	{
+		boxes.center[c][slot] = (min[c] + max[c]) * 0.5f;
+		boxes.extent[c][slot] = (max[c] - min[c]) * 0.5f;
+	}
+}
+
+void aabb_bvh::refit_node(node & n) const
+{
+	n.min = glm::vec3(std::numeric_limits<float>::infinity());
+	n.max = -n.min;
+
+	if (n.child == 0)
+	{
+		for (std::uint32_t i = n.begin; i < n.end; ++i)
+		{
+			glm::vec3 c(boxes.center[0][i], boxes.center[1][i], boxes.center[2][i]);
+			glm::vec3 e(boxes.extent[0][i], boxes.extent[1][i], boxes.extent[2][i]);
+			n.min = glm::min(n.min, c - e);
+			n.max = glm::max(n.max, c + e);
+		}
+	}
+	else
+	{
+		for (std::uint32_t k = 0; k < 2; ++k)
+		{
+			n.min = glm::min(n.min, nodes[n.child + k].min);
+			n.max = glm::max(n.max, nodes[n.child + k].max);
+		}
+	}
+}
+
+void aabb_bvh::refit()
+{
+	// Children are always stored after their parent
+	for (std::size_t i = nodes.size(); i-- > 0;)
+		refit_node(nodes[i]);
+}
+
+std::size_t aabb_bvh::size() const
+{
+	return slots.size();
+}
+
+std::size_t aabb_bvh::cull(frustum_planes const & frustum, std::vector<std::uint32_t> & visible) const
+{
+	std::size_t const count = size();
+	if (visible.size() < count + batch)
+		visible.resize(count + batch);
+
+	std::size_t result = 0;
+	if (count == 0)
+		return result;
+
+#ifdef __AVX2__
+	plane_batch const planes(frustum);
+#endif
+
+	std::array<glm::vec4, 6> abs_planes;
+	for (int p = 0; p < 6; ++p)
+		abs_planes[p] = glm::abs(frustum.planes[p]);
+
+	struct entry
+	{
+		std::uint32_t node;
+		unsigned int plane_mask;
+	};
+
+	// A median-split tree over 2^32 boxes is at most 32 levels deep
+	std::array<entry, 64> stack;
+	std::size_t top = 0;
+	stack[top++] = {0, all_planes};
+
+	while (top > 0)
+	{
+		auto [index, plane_mask] = stack[--top];
+		node const & n = nodes[index];
+
+		glm::vec3 const c = (n.min + n.max) * 0.5f;
+		glm::vec3 const e = (n.max - n.min) * 0.5f;
+
+		// Node bounds are rounded differently from the boxes they contain, so a node is
+		// only classified when it is clearly on one side of a plane; otherwise the
+		// boxes decide, with the same arithmetic as cull()
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			if (!(plane_mask & (1u << p)))
+				continue;
+
+			glm::vec4 const & plane = frustum.planes[p];
+			float const distance = glm::dot(glm::vec3(plane), c) + plane.w;
+			float const radius = glm::dot(glm::vec3(abs_planes[p]), e);
+			float const tolerance = 1e-5f * (glm::dot(glm::vec3(abs_planes[p]), glm::abs(c)) + abs_planes[p].w + radius);
+
+			if (distance + radius < -tolerance)
+				outside = true;
+			else if (distance - radius > tolerance)
+				plane_mask &= ~(1u << p);
+		}
+
+		if (outside)
+			continue;
+
+		if (plane_mask == 0)
+		{
+			std::copy(order.begin() + n.begin, order.begin() + n.end, visible.begin() + result);
+			result += n.end - n.begin;
+		}
+		else if (n.child == 0)
+		{
+#ifdef __AVX2__
+			int const leaf_mask = (1 << (n.end - n.begin)) - 1;
+			__m256i const indices = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(order.data() + n.begin));
+			result += compact(indices, visible_mask(planes, boxes, n.begin, plane_mask) & leaf_mask, visible.data() + result);
+#else
+			for (std::uint32_t i = n.begin; i < n.end; ++i)
+			{
+				glm::vec3 bc(boxes.center[0][i], boxes.center[1][i], boxes.center[2][i]);
+				glm::vec3 be(boxes.extent[0][i], boxes.extent[1][i], boxes.extent[2][i]);
+				if (box_visible(frustum.planes, plane_mask, bc, be))
+					visible[result++] = order[i];
+			}
+#endif
+		}
+		else
+		{
+			stack[top++] = {n.child + 1, plane_mask};
+			stack[top++] = {n.child, plane_mask};
+		}
+	}
+
+	return result;
+}
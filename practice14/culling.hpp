@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Frustum as six planes (n, d), a point p is inside when dot(n, p) + d >= 0 for all of them.
+// The planes are not normalized, which does not matter for a sign test.
+struct frustum_planes
+{
+	std::array<glm::vec4, 6> planes;
+
+	frustum_planes(glm::mat4 const & view_projection);
+};
+
+// Boxes stored as separate arrays of centers and half-extents, so that
+// eight of them can be loaded into AVX registers at once
+struct aabb_soa
+{
+	std::array<std::vector<float>, 3> center;
+	std::array<std::vector<float>, 3> extent;
+
+	std::size_t size() const;
+	void reserve(std::size_t count);
+	void clear();
+	void push_back(glm::vec3 const & min, glm::vec3 const & max);
+};
+
+// Writes the indices of the boxes that are not entirely behind one of the planes
+// to the front of visible and returns their number. Conservative: a box near a
+// frustum corner may be reported visible even though it is not.
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible);
+
+// Bounding volume hierarchy over a set of boxes. Culling descends it with a mask
+// of the planes a node still straddles: subtrees entirely inside the frustum are
+// accepted without further tests and subtrees outside one plane are skipped as a
+// whole. The result is exactly the set cull() returns for the same boxes, though
+// not in the same order.
+struct aabb_bvh
+{
+	aabb_bvh() = default;
+	explicit aabb_bvh(aabb_soa const & boxes);
+
+	void build(aabb_soa const & boxes);
+
+	// Moves a box without changing the tree; the node bounds catch up on the
+	// next refit(). Trees that were refitted a lot cull slower, so rebuild them
+	// once the boxes have moved far.
+	void update(std::uint32_t index, glm::vec3 const & min, glm::vec3 const & max);
+	void refit();
+
+	std::size_t size() const;
+
+	std::size_t cull(frustum_planes const & frustum, std::vector<std::uint32_t> & visible) const;
+
+private:
+	struct node
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		// Range of leaf slots covered by the node
+		std::uint32_t begin;
+		std::uint32_t end;
+		// Index of the first child, the second one follows it; zero for leaves
+		std::uint32_t child;
+	};
+
+	std::vector<node> nodes;
+
+	// Boxes in leaf order, padded so that a leaf can always be loaded as a whole batch
+	aabb_soa boxes;
+	// Original index of every leaf slot, padded the same way, and its inverse
+	std::vector<std::uint32_t> order;
+	std::vector<std::uint32_t> slots;
+
+	void refit_node(node & n) const;
+};
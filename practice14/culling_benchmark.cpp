@@ -0,0 +1,275 @@
+#include "culling_benchmark.hpp"
+
+#include "aabb.hpp"
+#include "culling.hpp"
+#include "frustum.hpp"
+#include "intersect.hpp"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+#ifdef __AVX2__
+constexpr bool avx2 = true;
+#else
+constexpr bool avx2 = false;
+#endif
+
+std::size_t const instance_counts[] = {10'000, 100'000, 1'000'000};
+
+// The viewer's projection at 16:9
+constexpr float fov_y = glm::pi<float>() / 2.f;
+constexpr float aspect = 16.f / 9.f;
+constexpr float z_near = 0.1f;
+constexpr float z_far = 100.f;
+
+struct count_result
+{
+	std::size_t instances = 0;
+	double build_ms = 0.0;
+	double visible = 0.0;
+	double cull_us = 0.0;
+	double bvh_us = 0.0;
+	double intersect_us = 0.0;
+	double only_cull = 0.0;
+	double only_intersect = 0.0;
+	// Of the boxes the two disagree on, the furthest on the wrong side of a plane
+	double plane_error = 0.0;
+};
+
+template <typename Function>
+double average_us(int repeats, Function && function)
+{
+	auto const start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; ++r)
+		function();
+	auto const end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::micro>(end - start).count() / repeats;
+}
+
+// Distance + radius of the box against the frustum of a double precision
+// view-projection, smallest over the planes: negative when the box is entirely
+// outside one of them
+double box_margin(glm::dmat4 const & view_projection, glm::vec3 const & min, glm::vec3 const & max)
+{
+	glm::dvec3 const c = (glm::dvec3(min) + glm::dvec3(max)) * 0.5;
+	glm::dvec3 const e = (glm::dvec3(max) - glm::dvec3(min)) * 0.5;
+
+	double result = std::numeric_limits<double>::infinity();
+	for (int i = 0; i < 3; ++i)
+		for (double sign : {1.0, -1.0})
+		{
+			glm::dvec4 const p = glm::row(view_projection, 3) + sign * glm::row(view_projection, i);
+			glm::dvec3 const n{p};
+			result = std::min(result, (glm::dot(n, c) + glm::dot(glm::abs(n), e) + p.w) / glm::length(n));
+		}
+	return result;
+}
+
+}
+
+culling_benchmark_options parse_culling_benchmark_options(int argc, char ** argv)
+{
+	culling_benchmark_options result;
+	if (argc < 2 || std::string(argv[1]) != "--culling-bench")
+		return result;
+	result.enabled = true;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string const arg = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 == argc)
+				throw std::runtime_error("Missing value after " + arg);
+			return argv[++i];
+		};
+
+		if (arg == "--output")
+			result.output = value();
+		else if (arg == "--views")
+			result.views = std::stoi(value());
+		else if (arg == "--repeats")
+			result.repeats = std::stoi(value());
+		else
+			throw std::runtime_error("Unknown argument " + arg);
+	}
+
+	if (result.views <= 0)
+		throw std::runtime_error("--views must be positive");
+	if (result.repeats <= 0)
+		throw std::runtime_error("--repeats must be positive");
+
+	return result;
+}
+
+bool run_culling_benchmark(culling_benchmark_options const & options)
+{
+	bool passed = true;
+
+	auto check = [&](bool condition, std::string const & what)
+	{
+		if (!condition)
+		{
+			std::cout << "FAILED: " << what << '\n';
+			passed = false;
+		}
+	};
+
+	glm::mat4 const projection = glm::perspective(fov_y, aspect, z_near, z_far);
+	glm::dmat4 const exact_projection = glm::perspective<double>(fov_y, aspect, z_near, z_far);
+
+	std::vector<count_result> results;
+	std::vector<std::uint32_t> visible, bvh_visible, intersect_visible, only_cull, only_intersect;
+	for (std::size_t count : instance_counts)
+	{
+		auto & result = results.emplace_back();
+		result.instances = count;
+
+		std::mt19937 random(count);
+		float const side = std::sqrt(float(count));
+		std::uniform_real_distribution<float> position(0.f, side);
+		std::uniform_real_distribution<float> extent(0.1f, 0.5f);
+		std::uniform_real_distribution<float> height(0.3f, 2.f);
+		std::uniform_real_distribution<float> angle(0.f, 2.f * glm::pi<float>());
+
+		aabb_soa boxes;
+		boxes.reserve(count);
+		std::vector<glm::vec3> min(count), max(count);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			glm::vec3 const center{position(random), extent(random), position(random)};
+			glm::vec3 const half{extent(random), extent(random), extent(random)};
+			min[i] = center - half;
+			max[i] = center + half;
+			boxes.push_back(min[i], max[i]);
+		}
+
+		auto const start = std::chrono::steady_clock::now();
+		aabb_bvh const bvh(boxes);
+		auto const built = std::chrono::steady_clock::now();
+		result.build_ms = std::chrono::duration<double, std::milli>(built - start).count();
+
+		std::size_t mismatches = 0, beyond_rounding = 0;
+		for (int v = 0; v < options.views; ++v)
+		{
+			glm::vec3 const eye{position(random), height(random), position(random)};
+			float const rotation = angle(random);
+			glm::mat4 view(1.f);
+			view = glm::rotate(view, rotation, {0.f, 1.f, 0.f});
+			view = glm::translate(view, -eye);
+			frustum_planes const planes{projection * view};
+
+			std::size_t visible_count = 0, bvh_count = 0;
+			result.cull_us += average_us(options.repeats, [&]{ visible_count = cull(planes, boxes, visible); });
+			result.bvh_us += average_us(options.repeats, [&]{ bvh_count = bvh.cull(planes, bvh_visible); });
+			result.visible += visible_count;
+
+			std::sort(visible.begin(), visible.begin() + visible_count);
+			std::sort(bvh_visible.begin(), bvh_visible.begin() + bvh_count);
+			if (visible_count != bvh_count || !std::equal(visible.begin(), visible.begin() + visible_count, bvh_visible.begin()))
+				++mismatches;
+
+			// The separating axis test the viewer used before, too slow to repeat
+			intersect_visible.clear();
+			result.intersect_us += average_us(1, [&]
+			{
+				frustum const body{projection * view};
+				for (std::uint32_t i = 0; i < count; ++i)
+					if (intersect(body, aabb{min[i], max[i]}))
+						intersect_visible.push_back(i);
+			});
+
+			// cull() keeps boxes near the frustum's corners that are outside it
+			// but not outside any single plane. Otherwise the two only differ by
+			// rounding: cull()'s far plane is the difference of two rows that agree
+			// to near / far, and intersect()'s corners come from the inverse matrix.
+			only_cull.clear();
+			only_intersect.clear();
+			std::set_difference(visible.begin(), visible.begin() + visible_count,
+				intersect_visible.begin(), intersect_visible.end(), std::back_inserter(only_cull));
+			std::set_difference(intersect_visible.begin(), intersect_visible.end(),
+				visible.begin(), visible.begin() + visible_count, std::back_inserter(only_intersect));
+			result.only_cull += only_cull.size();
+			result.only_intersect += only_intersect.size();
+
+			glm::dmat4 exact_view(1.0);
+			exact_view = glm::rotate(exact_view, double(rotation), {0.0, 1.0, 0.0});
+			exact_view = glm::translate(exact_view, -glm::dvec3(eye));
+			glm::dmat4 const exact = exact_projection * exact_view;
+			double const tolerance = 2.0 * std::numeric_limits<float>::epsilon() * (z_far / z_near)
+				* (glm::length(eye) + z_far);
+
+			double plane_error = 0.0;
+			for (auto i : only_cull)
+				plane_error = std::max(plane_error, -box_margin(exact, min[i], max[i]));
+			for (auto i : only_intersect)
+				plane_error = std::max(plane_error, std::abs(box_margin(exact, min[i], max[i])));
+			result.plane_error = std::max(result.plane_error, plane_error);
+			if (plane_error > tolerance)
+				++beyond_rounding;
+		}
+		result.visible /= options.views;
+		result.cull_us /= options.views;
+		result.bvh_us /= options.views;
+		result.intersect_us /= options.views;
+		result.only_cull /= options.views;
+		result.only_intersect /= options.views;
+
+		check(mismatches == 0, std::to_string(count) + " instances: the tree returns a different set than cull() in "
+			+ std::to_string(mismatches) + " of " + std::to_string(options.views) + " views");
+		check(beyond_rounding == 0, std::to_string(count) + " instances: cull() and intersect() disagree beyond rounding in "
+			+ std::to_string(beyond_rounding) + " of " + std::to_string(options.views) + " views");
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << options.views << " views, " << options.repeats << " repeats each, " << (avx2 ? "AVX2" : "scalar") << '\n';
+	std::cout << "instances\tms build\tvisible (mean)\tus cull()\tus bvh\tus intersect()"
+		"\tonly in cull() (mean)\tonly in intersect() (mean)\tlargest plane error\n";
+	for (auto const & r : results)
+		std::cout << r.instances << "\t" << r.build_ms << "\t" << std::setprecision(0) << r.visible << std::setprecision(3)
+			<< "\t" << r.cull_us << "\t" << r.bvh_us << "\t" << r.intersect_us << "\t" << r.only_cull << "\t" << r.only_intersect
+			<< "\t" << r.plane_error << '\n';
+	std::cout << (passed ? "passed" : "FAILED") << '\n';
+	std::cout << std::defaultfloat;
+	std::cout.flush();
+
+	if (options.output)
+	{
+		std::ofstream out(*options.output);
+		out << "{\n";
+		out << "\"avx2\": " << (avx2 ? "true" : "false") << ",\n";
+		out << "\"views\": " << options.views << ",\n";
+		out << "\"passed\": " << (passed ? "true" : "false") << ",\n";
+		out << "\"counts\": [";
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			auto const & r = results[i];
+			out << (i ? ",\n" : "\n") << "{\"instances\": " << r.instances << ", \"build_ms\": " << r.build_ms
+				<< ", \"visible\": " << r.visible << ", \"cull_us\": " << r.cull_us << ", \"bvh_us\": " << r.bvh_us
+				<< ", \"intersect_us\": " << r.intersect_us << ", \"only_in_cull\": " << r.only_cull
+				<< ", \"only_in_intersect\": " << r.only_intersect << ", \"plane_error\": " << r.plane_error << "}";
+		}
+		out << "\n]\n}\n";
+	}
+
+	return passed;
+}
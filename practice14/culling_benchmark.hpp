@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+struct culling_benchmark_options
+{
+	// Set by --culling-bench, which has to be the first argument
+	bool enabled = false;
+	std::optional<std::filesystem::path> output;
+	int views = 16;
+	int repeats = 20;
+};
+
+// --culling-bench [--views <n>] [--repeats <n>] [--output <json>]
+// Anything else leaves the options disabled without looking at the arguments.
+culling_benchmark_options parse_culling_benchmark_options(int argc, char ** argv);
+
+// Scatters 10^4, 10^5 and 10^6 boxes over a square with one per square unit and
+// culls them from random views inside it, with the viewer's projection. Checks
+// that aabb_bvh::cull() returns exactly the boxes cull() does, and that cull()
+// and the separating axis intersect() only disagree on corner boxes cull() keeps
+// and within rounding of the frustum's planes. Reports the time to build the tree
+// and to cull with each. Returns false if a check failed.
+bool run_culling_benchmark(culling_benchmark_options const & options);
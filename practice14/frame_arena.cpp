@@ -0,0 +1,70 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <new>
+
+frame_arena::frame_arena(std::size_t capacity, int buffers)
+	: blocks(buffers)
+{
+	for (auto & b : blocks)
+	{
+		b.memory = std::make_unique<std::byte[]>(capacity);
+		b.capacity = capacity;
+	}
+}
+
+frame_arena::~frame_arena()
+{
+	for (auto & b : blocks)
+		for (auto [p, alignment] : b.overflow)
+			::operator delete(p, alignment);
+}
+
+void * frame_arena::allocate(std::size_t size, std::size_t alignment)
+{
+	block & b = blocks[current];
+
+	++stats.allocations;
+	stats.bytes += size;
+	b.requested += size + alignment - 1;
+
+	std::size_t const begin = (b.used + alignment - 1) / alignment * alignment;
+	if (begin + size <= b.capacity)
+	{
+		b.used = begin + size;
+		return b.memory.get() + begin;
+	}
+
+	++stats.heap_allocations;
+	stats.heap_bytes += size;
+	auto const heap_alignment = static_cast<std::align_val_t>(alignment);
+	void * p = ::operator new(size, heap_alignment);
+	b.overflow.emplace_back(p, heap_alignment);
+	return p;
+}
+
+void frame_arena::reset(block & b)
+{
+	for (auto [p, alignment] : b.overflow)
+		::operator delete(p, alignment);
+	b.overflow.clear();
+
+	if (b.requested > b.capacity)
+	{
+		// Room for the largest frame so far plus some growth
+		b.capacity = b.requested + b.requested / 2;
+		b.memory = std::make_unique<std::byte[]>(b.capacity);
+	}
+
+	b.used = 0;
+	b.requested = 0;
+}
+
+void frame_arena::next_frame()
+{
+	last_frame = stats;
+	stats = {};
+
+	current = (current + 1) % blocks.size();
+	reset(blocks[current]);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Bump allocator for data that lives for a frame or two. Every frame allocates
+// from one of `buffers` blocks, which is reset when its turn comes again, so
+// whatever the previous frames wrote stays valid while the GPU may still read
+// it. Allocations that do not fit go to the heap and the block is enlarged the
+// next time it is reset, so steady-state frames never touch the heap.
+struct frame_arena
+{
+	struct statistics
+	{
+		std::size_t allocations = 0;
+		std::size_t bytes = 0;
+		// Allocations that did not fit in the block
+		std::size_t heap_allocations = 0;
+		std::size_t heap_bytes = 0;
+	};
+
+	explicit frame_arena(std::size_t capacity = 1 << 20, int buffers = 2);
+	~frame_arena();
+
+	frame_arena(frame_arena const &) = delete;
+	frame_arena & operator = (frame_arena const &) = delete;
+
+	void * allocate(std::size_t size, std::size_t alignment);
+
+	// Moves on to the next block, invalidating what was allocated from it
+	// `buffers` frames ago
+	void next_frame();
+
+	// The current frame so far, and the whole previous one
+	statistics stats;
+	statistics last_frame;
+
+private:
+	struct block
+	{
+		std::unique_ptr<std::byte[]> memory;
+		std::size_t capacity = 0;
+		std::size_t used = 0;
+		std::vector<std::pair<void *, std::align_val_t>> overflow;
+		// Bytes requested last time the block was used, to size it on reset
+		std::size_t requested = 0;
+	};
+
+	std::vector<block> blocks;
+	std::size_t current = 0;
+
+	void reset(block & b);
+};
+
+// Standard allocator on top of a frame_arena, deallocation is a no-op
+template <typename T>
+struct arena_allocator
+{
+	using value_type = T;
+
+	explicit arena_allocator(frame_arena & arena)
+		: arena(&arena)
+	{}
+
+	template <typename U>
+	arena_allocator(arena_allocator<U> const & other)
+		: arena(other.arena)
+	{}
+
+	T * allocate(std::size_t count)
+	{
+		return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *, std::size_t)
+	{}
+
+	template <typename U>
+	bool operator == (arena_allocator<U> const & other) const
+	{
+		return arena == other.arena;
+	}
+
+	frame_arena * arena;
+};
+
+template <typename T>
+using frame_vector = std::vector<T, arena_allocator<T>>;
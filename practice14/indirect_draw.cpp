@@ -0,0 +1,118 @@
+#include "indirect_draw.hpp"
+#include "occlusion.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+packed_model::packed_model(gltf_model const & model, GLuint instance_buffer)
+	: instance_buffer(instance_buffer)
+{
+	std::vector<occluder_mesh> geometry;
+	std::size_t vertex_count = 0;
+	std::size_t index_count = 0;
+	for (auto const & mesh : model.meshes)
+	{
+		if (mesh.position.type != GL_FLOAT || mesh.normal.type != GL_FLOAT || mesh.texcoord.type != GL_FLOAT
+			|| mesh.position.size != 3 || mesh.normal.size != 3 || mesh.texcoord.size != 2)
+			throw std::runtime_error("Unsupported vertex format for " + mesh.name);
+
+		geometry.push_back(load_occluder_mesh(model, mesh));
+		meshes.push_back({static_cast<std::uint32_t>(mesh.indices.count), 1,
+			static_cast<std::uint32_t>(index_count), static_cast<std::int32_t>(vertex_count), 0});
+		vertex_count += mesh.position.count;
+		index_count += mesh.indices.count;
+	}
+
+	// Positions, normals and texcoords of all meshes, each attribute in its own block
+	std::size_t const normals = vertex_count * sizeof(glm::vec3);
+	std::size_t const texcoords = normals * 2;
+	std::vector<char> vertices(texcoords + vertex_count * 2 * sizeof(float));
+	std::vector<std::uint32_t> indices;
+	indices.reserve(index_count);
+
+	for (std::size_t i = 0; i < model.meshes.size(); ++i)
+	{
+		auto const & mesh = model.meshes[i];
+		std::size_t const first = meshes[i].base_vertex;
+		std::memcpy(vertices.data() + first * sizeof(glm::vec3), geometry[i].positions.data(), mesh.position.count * sizeof(glm::vec3));
+		std::memcpy(vertices.data() + normals + first * sizeof(glm::vec3), model.buffer.data() + mesh.normal.view.offset, mesh.normal.count * sizeof(glm::vec3));
+		std::memcpy(vertices.data() + texcoords + first * 2 * sizeof(float), model.buffer.data() + mesh.texcoord.view.offset, mesh.texcoord.count * 2 * sizeof(float));
+		indices.insert(indices.end(), geometry[i].indices.begin(), geometry[i].indices.end());
+	}
+
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glGenBuffers(1, &vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &index_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void *>(normals));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void *>(texcoords));
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	glEnableVertexAttribArray(instance_attribute);
+	glVertexAttribPointer(instance_attribute, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+	glVertexAttribDivisor(instance_attribute, 1);
+}
+
+packed_model::~packed_model()
+{
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &vertex_buffer);
+	glDeleteBuffers(1, &index_buffer);
+}
+
+indirect_draw::indirect_draw(std::size_t max_commands)
+	: base_instance(GLEW_VERSION_4_2 || GLEW_ARB_base_instance)
+	, command_buffer(max_commands * sizeof(draw_command))
+{
+	// Without base instance support the field has to be zero in indirect commands
+	multi_draw = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && base_instance);
+	commands.reserve(max_commands);
+}
+
+void indirect_draw::submit(packed_model const & model)
+{
+	if (commands.empty())
+		return;
+
+	glBindVertexArray(model.vao);
+
+	if (multi_draw)
+	{
+		std::memcpy(command_buffer.begin_frame(), commands.data(), commands.size() * sizeof(draw_command));
+		command_buffer.end_frame();
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer.buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<void *>(command_buffer.offset()),
+			commands.size(), 0);
+		return;
+	}
+
+	for (auto const & command : commands)
+	{
+		void const * indices = reinterpret_cast<void const *>(command.first_index * sizeof(std::uint32_t));
+		if (base_instance)
+		{
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, indices,
+				command.instance_count, command.base_vertex, command.base_instance);
+			continue;
+		}
+
+		// GL 3.3: the instance attribute is moved to the first instance instead
+		glBindBuffer(GL_ARRAY_BUFFER, model.instance_buffer);
+		glVertexAttribPointer(packed_model::instance_attribute, 3, GL_FLOAT, GL_FALSE, 0,
+			reinterpret_cast<void *>(command.base_instance * sizeof(glm::vec3)));
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, indices,
+			command.instance_count, command.base_vertex);
+	}
+}
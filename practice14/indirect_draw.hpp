@@ -0,0 +1,59 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+#include "instance_ring.hpp"
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+// Same layout as DrawElementsIndirectCommand
+struct draw_command
+{
+	std::uint32_t count;
+	std::uint32_t instance_count;
+	std::uint32_t first_index;
+	std::int32_t base_vertex;
+	std::uint32_t base_instance;
+};
+
+// All meshes of a model packed into one vertex buffer and one 32-bit index
+// buffer behind a single VAO, so that any of them can be drawn without
+// rebinding. Attributes 0, 1 and 2 are position, normal and texcoord,
+// attribute 3 is a per-instance vec3 read from instance_buffer.
+struct packed_model
+{
+	static constexpr GLuint instance_attribute = 3;
+
+	packed_model(gltf_model const & model, GLuint instance_buffer);
+	~packed_model();
+
+	packed_model(packed_model const &) = delete;
+	packed_model & operator = (packed_model const &) = delete;
+
+	GLuint vao = 0;
+	GLuint vertex_buffer = 0;
+	GLuint index_buffer = 0;
+	GLuint instance_buffer;
+
+	// Command drawing one instance of every mesh
+	std::vector<draw_command> meshes;
+};
+
+// Draw commands of one pass, submitted with a single glMultiDrawElementsIndirect
+// on GL 4.3 and with one call per command otherwise
+struct indirect_draw
+{
+	explicit indirect_draw(std::size_t max_commands);
+
+	std::vector<draw_command> commands;
+
+	void submit(packed_model const & model);
+
+	bool multi_draw;
+	bool base_instance;
+
+private:
+	instance_ring command_buffer;
+};
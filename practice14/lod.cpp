@@ -0,0 +1,179 @@
+#include "lod.hpp"
+#include "occluder_mesh.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+// Ericson, Real-Time Collision Detection, 5.1.5
+glm::vec3 closest_point(glm::vec3 const & p, glm::vec3 const & a, glm::vec3 const & b, glm::vec3 const & c)
+{
+	glm::vec3 const ab = b - a;
+	glm::vec3 const ac = c - a;
+	glm::vec3 const ap = p - a;
+	float const d1 = glm::dot(ab, ap);
+	float const d2 = glm::dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f)
+		return a;
+
+	glm::vec3 const bp = p - b;
+	float const d3 = glm::dot(ab, bp);
+	float const d4 = glm::dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3)
+		return b;
+
+	float const vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+		return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 const cp = p - c;
+	float const d5 = glm::dot(ab, cp);
+	float const d6 = glm::dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6)
+		return c;
+
+	float const vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float const va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float const denominator = 1.f / (va + vb + vc);
+	return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Largest distance from a vertex of `from` to the surface of `to`
+float one_sided_distance(occluder_mesh const & from, occluder_mesh const & to)
+{
+	float result = 0.f;
+	for (auto const & p : from.positions)
+	{
+		float nearest = std::numeric_limits<float>::infinity();
+		for (std::size_t i = 0; i + 2 < to.indices.size() && nearest > result; i += 3)
+		{
+			glm::vec3 const q = closest_point(p, to.positions[to.indices[i]], to.positions[to.indices[i + 1]], to.positions[to.indices[i + 2]]);
+			nearest = std::min(nearest, glm::dot(p - q, p - q));
+		}
+		// A vertex already closer than the current maximum cannot raise it
+		result = std::max(result, nearest);
+	}
+	return std::sqrt(result);
+}
+
+}
+
+lod_selector::lod_selector(gltf_model const & model, std::size_t instance_count)
+{
+	std::vector<occluder_mesh> meshes;
+	for (auto const & mesh : model.meshes)
+	{
+		meshes.push_back(load_occluder_mesh(model, mesh));
+		triangles.push_back(mesh.indices.count / 3);
+	}
+
+	errors.push_back(0.f);
+	for (std::size_t level = 1; level < meshes.size(); ++level)
+	{
+		float const error = std::max(one_sided_distance(meshes[0], meshes[level]), one_sided_distance(meshes[level], meshes[0]));
+		// A coarser level is never treated as more accurate than a finer one
+		errors.push_back(std::max(error, errors.back()));
+	}
+
+	glm::vec3 const min = model.meshes[0].min;
+	glm::vec3 const max = model.meshes[0].max;
+	center = (min + max) * 0.5f;
+	radius = glm::length(max - min) * 0.5f;
+
+	levels.assign(instance_count, meshes.size() - 1);
+}
+
+std::size_t lod_selector::select(std::span<std::uint32_t const> instances, std::vector<glm::vec3> const & positions,
+	glm::vec3 const & camera_position, float fov_y, float viewport_height, lod_settings const & settings)
+{
+	std::uint8_t const coarsest = errors.size() - 1;
+	float const projection = viewport_height / (2.f * std::tan(fov_y * 0.5f));
+	float const coarsen_threshold = settings.pixel_threshold * (1.f - settings.hysteresis);
+
+	pixel_scale.resize(instances.size());
+	desired.resize(instances.size());
+
+	std::size_t total = 0;
+	for (std::size_t i = 0; i < instances.size(); ++i)
+	{
+		std::uint32_t const instance = instances[i];
+
+		// Nearest point of the bounding sphere, errors are projected as if they were there
+		float const distance = std::max(glm::distance(camera_position, positions[instance] + center) - radius, 1e-3f);
+		float const scale = projection / distance;
+		pixel_scale[i] = scale;
+
+		auto coarsest_within = [&](float threshold)
+		{
+			std::uint8_t level = 0;
+			while (level < coarsest && errors[level + 1] * scale <= threshold)
+				++level;
+			return level;
+		};
+
+		std::uint8_t level = levels[instance];
+		if (std::uint8_t const coarser = coarsest_within(coarsen_threshold); coarser > level)
+			level = coarser;
+		else if (errors[level] * scale > settings.pixel_threshold)
+			level = coarsest_within(settings.pixel_threshold);
+
+		desired[i] = level;
+		total += triangles[level];
+	}
+
+	if (settings.triangle_budget == 0 || total <= settings.triangle_budget)
+	{
+		for (std::size_t i = 0; i < instances.size(); ++i)
+			levels[instances[i]] = desired[i];
+		return selected_triangles = total;
+	}
+
+	// Over budget: start everyone at the coarsest level and keep refining the
+	// instance with the largest projected error until the budget runs out
+	auto less_important = [](candidate const & a, candidate const & b){ return a.error < b.error; };
+
+	heap.clear();
+	total = 0;
+	for (std::size_t i = 0; i < instances.size(); ++i)
+	{
+		levels[instances[i]] = coarsest;
+		total += triangles[coarsest];
+		if (desired[i] < coarsest)
+			heap.push_back({errors[coarsest] * pixel_scale[i], static_cast<std::uint32_t>(i), coarsest});
+	}
+	std::make_heap(heap.begin(), heap.end(), less_important);
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), less_important);
+		candidate const top = heap.back();
+		heap.pop_back();
+
+		std::uint8_t const finer = top.level - 1;
+		std::size_t const cost = triangles[finer] - triangles[top.level];
+		if (total + cost > settings.triangle_budget)
+			continue;
+
+		total += cost;
+		levels[instances[top.index]] = finer;
+
+		if (finer > desired[top.index])
+		{
+			heap.push_back({errors[finer] * pixel_scale[top.index], top.index, finer});
+			std::push_heap(heap.begin(), heap.end(), less_important);
+		}
+	}
+
+	return selected_triangles = total;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct lod_settings
+{
+	// Largest acceptable projected geometric error, in pixels
+	float pixel_threshold = 1.f;
+	// A coarser level is only taken once its error drops below threshold * (1 - hysteresis),
+	// so instances near a switching distance do not flip every frame
+	float hysteresis = 0.25f;
+	// Total triangles over all selected instances, 0 for no limit
+	std::size_t triangle_budget = 0;
+};
+
+// Chooses a level of detail for every instance of a mesh whose levels are the
+// meshes of a glTF model, finest first
+struct lod_selector
+{
+	lod_selector(gltf_model const & model, std::size_t instance_count);
+
+	// Geometric error of every level in model units: the symmetric distance
+	// between its vertices and the surface of level 0
+	std::vector<float> errors;
+	std::vector<std::size_t> triangles;
+
+	// Bounding sphere of level 0
+	glm::vec3 center;
+	float radius;
+
+	// Current level of every instance, kept between frames for the hysteresis
+	std::vector<std::uint8_t> levels;
+	// Triangles of the last selection
+	std::size_t selected_triangles = 0;
+
+	// Updates levels for the listed instances and returns their triangle count
+	std::size_t select(std::span<std::uint32_t const> instances, std::vector<glm::vec3> const & positions,
+		glm::vec3 const & camera_position, float fov_y, float viewport_height, lod_settings const & settings);
+
+private:
+	struct candidate
+	{
+		float error;
+		// Position in the instance list passed to select()
+		std::uint32_t index;
+		std::uint8_t level;
+	};
+
+	std::vector<float> pixel_scale;
+	std::vector<std::uint8_t> desired;
+	std::vector<candidate> heap;
+};
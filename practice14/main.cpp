@@ -7,8 +7,10 @@
 
 #include <GL/glew.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
@@ -25,11 +27,19 @@
 #include <string_view>
 #include <vector>
 
-#include "aabb.hpp"
-#include "frustum.hpp"
+#include "benchmark.hpp"
+#include "culling.hpp"
+#include "culling_benchmark.hpp"
+#include "frame_arena.hpp"
 #include "gltf_loader.hpp"
-#include "intersect.hpp"
+#include "indirect_draw.hpp"
+#include "instance_ring.hpp"
+#include "lod.hpp"
+#include "occlusion.hpp"
+#include "occlusion_test.hpp"
+#include "profiler.hpp"
 #include "stb_image.h"
+#include "thread_pool.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -131,53 +141,20 @@ template <typename... Shaders> GLuint create_program(Shaders... shaders)
   return result;
 }
 
-struct Query
-{
-  explicit Query(GLuint newId) : id(newId) {}
-  GLuint id = -1;
-  bool available = true;
-};
-
-Query &firstAvailableQuery(std::vector<Query> &queries)
+int main(int argc, char **argv)
+try
 {
-  for (auto &query : queries)
-    if (query.available)
-    {
-      query.available = false;
-      return query;
-    }
+  auto const occlusion_options = parse_occlusion_test_options(argc, argv);
+  if (occlusion_options.enabled)
+    return run_occlusion_test(occlusion_options) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-  GLuint query_id;
-  glGenQueries(1, &query_id);
-  queries.emplace_back(Query{query_id});
-  queries.back().available = false;
-  return queries.back();
-}
-
-void logQueries(std::vector<Query> &queries)
-{
-  std::cout << "----------------------" << '\n';
-  GLint result = GL_FALSE;
-  for (auto &query : queries)
-  {
-    glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &result);
-    if (result == GL_TRUE)
-    {
-      GLint ns;
-      glGetQueryObjectiv(query.id, GL_QUERY_RESULT, &ns);
-      auto sec = (float)ns * 1e-9;
-      std::cout << query.id << "\tspf " << sec << "\tfps " << 1 / sec << '\n';
+  auto const culling_options = parse_culling_benchmark_options(argc, argv);
+  if (culling_options.enabled)
+    return run_culling_benchmark(culling_options) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-      query.available = true;
-    }
-  }
-  std::cout << "delay = " << queries.size() << '\n';
-  std::flush(std::cout);
-}
+  auto const options = parse_benchmark_options(argc, argv);
+  prepare_headless(options);
 
-int main()
-try
-{
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     sdl2_fail("SDL_Init: ");
 
@@ -195,7 +172,9 @@ try
   SDL_Window *window = SDL_CreateWindow(
       "Graphics course practice 11", SDL_WINDOWPOS_CENTERED,
       SDL_WINDOWPOS_CENTERED, 800, 600,
-      SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
+      SDL_WINDOW_OPENGL | (options.track ? SDL_WINDOW_HIDDEN
+                                         : SDL_WINDOW_RESIZABLE |
+                                               SDL_WINDOW_MAXIMIZED));
 
   if (!window)
     sdl2_fail("SDL_CreateWindow: ");
@@ -232,46 +211,6 @@ try
   const std::string model_path = project_root + "/bunny/bunny.gltf";
 
   auto const input_model = load_gltf(model_path);
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(),
-               input_model.buffer.data(), GL_STATIC_DRAW);
-
-  std::vector<GLuint> vbos;
-  std::vector<GLuint> vaos;
-  for (int i = 0; i < input_model.meshes.size(); ++i)
-  {
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
-
-    auto setup_attribute = [](int index, gltf_model::accessor const &accessor)
-    {
-      glEnableVertexAttribArray(index);
-      glVertexAttribPointer(index, accessor.size, accessor.type, GL_FALSE, 0,
-                            reinterpret_cast<void *>(accessor.view.offset));
-    };
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    setup_attribute(0, input_model.meshes[i].position);
-    setup_attribute(1, input_model.meshes[i].normal);
-    setup_attribute(2, input_model.meshes[i].texcoord);
-
-    GLuint vbo_offset;
-    glGenBuffers(1, &vbo_offset);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_offset);
-    auto index = 3;
-    glEnableVertexAttribArray(index);
-    glVertexAttribPointer(index, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glVertexAttribDivisor(index, 1);
-
-    vbos.push_back(vbo_offset);
-    vaos.push_back(vao);
-  }
-
   GLuint texture;
   {
     auto const &mesh = input_model.meshes[0];
@@ -304,13 +243,64 @@ try
   glm::vec3 camera_position{0.f, 1.5f, 3.f};
   float camera_rotation = 0.f;
 
-  auto queries = std::vector<Query>{};
+  const int num = 128;
+  auto instance_offsets = std::vector<glm::vec3>{};
+  auto instance_boxes = aabb_soa{};
+  instance_boxes.reserve(4 * num * num);
+  for (int i = -num; i < num; i++)
+    for (int j = -num; j < num; j++)
+    {
+      glm::vec3 current_offset = {i, 0, j};
+      instance_offsets.push_back(current_offset);
+      instance_boxes.push_back(input_model.meshes[0].min + current_offset,
+                               input_model.meshes[0].max + current_offset);
+    }
+  auto const instance_bvh = aabb_bvh{instance_boxes};
+  // The arrow keys turn the camera, under which the coherent cull is slower
+  // than culling from scratch
+  auto visible_instances = std::vector<std::uint32_t>{};
+
+  // The nearest visible instances hide the rest. Coarser LODs stick out of the
+  // bunny and would hide instances that are visible, so the finest one is used.
+  thread_pool pool;
+  auto const occluder =
+      load_occluder_mesh(input_model, input_model.meshes.front());
+  auto occlusion = occlusion_buffer{320, 192, &pool};
+  const std::size_t max_occluders = 64;
+  bool occlusion_culling = true;
+
+  // Every frame writes the offsets of the visible instances grouped by LOD into
+  // the next region of the ring, and one indirect command per LOD draws its group
+  auto instances = instance_ring{instance_offsets.size() * sizeof(glm::vec3)};
+  auto const packed = packed_model{input_model, instances.buffer};
+  auto draws = indirect_draw{input_model.meshes.size()};
+
+  auto lods = lod_selector{input_model, instance_offsets.size()};
+  auto lod_config = lod_settings{};
+  lod_config.triangle_budget = 2'000'000;
+
+  auto profiler = frame_profiler{};
+  // Lists rebuilt every frame, allocated without touching the heap
+  auto arena = frame_arena{};
+  std::size_t frame_count = 0;
+
+  // With --benchmark the camera follows the track into an offscreen
+  // framebuffer, with --record the interactive camera is saved as a track
+  auto bench = benchmark{options, "practice14"};
+  if (options.track)
+  {
+    width = options.width;
+    height = options.height;
+  }
+  auto recorder = track_recorder{options, {"x", "y", "z", "rotation"}};
+  float recorded_time = 0.f;
+
   bool paused = false;
 
   bool running = true;
   while (running)
   {
-    auto &firstFreeQuery = firstAvailableQuery(queries);
+    profiler.begin_frame();
 
     for (SDL_Event event; SDL_PollEvent(&event);)
       switch (event.type)
@@ -332,6 +322,8 @@ try
         button_down[event.key.keysym.sym] = true;
         if (event.key.keysym.sym == SDLK_SPACE)
           paused = !paused;
+        if (event.key.keysym.sym == SDLK_o)
+          occlusion_culling = !occlusion_culling;
         break;
       case SDL_KEYUP:
         button_down[event.key.keysym.sym] = false;
@@ -346,6 +338,15 @@ try
                    now - last_frame_start)
                    .count();
     last_frame_start = now;
+
+    if (options.track)
+    {
+      if (!bench.next_frame())
+        break;
+      bench.begin_frame();
+      dt = options.timestep;
+    }
+
     if (!paused)
       time += dt;
 
@@ -377,7 +378,22 @@ try
     camera_position +=
         camera_move_sideways *
         glm::vec3(std::cos(camera_rotation), 0.f, std::sin(camera_rotation));
-    glBeginQuery(GL_TIME_ELAPSED, firstFreeQuery.id);
+
+    if (options.track)
+    {
+      auto const camera = bench.camera();
+      camera_position = {camera[0], camera[1], camera[2]};
+      camera_rotation = camera[3];
+      time = bench.time();
+    }
+    else
+    {
+      recorded_time += dt;
+      recorder.add(recorded_time,
+                   {camera_position.x, camera_position.y, camera_position.z,
+                    camera_rotation});
+    }
+
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -387,6 +403,7 @@ try
 
     float near = 0.1f;
     float far = 100.f;
+    float fov_y = glm::pi<float>() / 2.f;
 
     glm::mat4 model(1.f);
 
@@ -394,45 +411,80 @@ try
     view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
     view = glm::translate(view, -camera_position);
 
-    glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f,
-                                            (1.f * width) / height, near, far);
+    glm::mat4 projection =
+        glm::perspective(fov_y, (1.f * width) / height, near, far);
 
     glm::vec3 camera_position =
         (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
     glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
 
-    auto proj_view_frustum = frustum{projection * view};
-    auto frustum_offsets = std::vector<glm::vec3>{};
-    const int num = 32;
-    for (int i = -num; i < num; i++)
-      for (int j = -num; j < num; j++)
-      {
-        glm::vec3 current_offset = {i, 0, j};
-        aabb current_aabb = aabb(input_model.meshes[0].min + current_offset,
-                                 input_model.meshes[0].max + current_offset);
-        if (intersect(proj_view_frustum, current_aabb))
-          frustum_offsets.push_back(current_offset);
-      }
+    profiler.push("culling");
+    auto const visible_count = instance_bvh.cull(
+        frustum_planes{projection * view}, visible_instances);
+    auto frustum_instances = frame_vector<std::uint32_t>(
+        visible_instances.begin(), visible_instances.begin() + visible_count,
+        arena_allocator<std::uint32_t>{arena});
 
-    auto lod_offsets = std::vector<std::vector<glm::vec3>>{vbos.size()};
-    for (int offset = 0; offset < frustum_offsets.size(); offset++)
+    if (occlusion_culling)
     {
-      float distance = glm::distance(camera_position, frustum_offsets[offset]);
-      int lod = distance / 5;
-      if (lod >= lod_offsets.size())
-        lod = lod_offsets.size() - 1;
-      lod_offsets[lod].push_back(frustum_offsets[offset]);
+      profiler.push("occlusion");
+      auto const occluder_count =
+          std::min(max_occluders, frustum_instances.size());
+      std::nth_element(frustum_instances.begin(),
+                       frustum_instances.begin() + occluder_count,
+                       frustum_instances.end(),
+                       [&](std::uint32_t a, std::uint32_t b)
+                       {
+                         return glm::distance(camera_position,
+                                              instance_offsets[a]) <
+                                glm::distance(camera_position,
+                                              instance_offsets[b]);
+                       });
+
+      occlusion.begin(projection * view);
+      for (std::size_t i = 0; i < occluder_count; i++)
+        occlusion.add_occluder(
+            occluder, glm::translate(glm::mat4(1.f),
+                                     instance_offsets[frustum_instances[i]]));
+      occlusion.rasterize();
+
+      std::erase_if(frustum_instances,
+                    [&](std::uint32_t instance)
+                    {
+                      auto const &offset = instance_offsets[instance];
+                      return !occlusion.visible(
+                          input_model.meshes[0].min + offset,
+                          input_model.meshes[0].max + offset);
+                    });
+      profiler.pop();
     }
+    profiler.pop();
+
+    profiler.push("lod");
+    lods.select(frustum_instances, instance_offsets, camera_position, fov_y,
+                height, lod_config);
+    profiler.pop();
+
+    profiler.push("upload");
+    auto const lod_count = input_model.meshes.size();
+    auto lod_first = frame_vector<std::size_t>(
+        lod_count + 1, 0, arena_allocator<std::size_t>{arena});
+    for (auto instance : frustum_instances)
+      lod_first[lods.levels[instance] + 1]++;
+    for (std::size_t lod = 0; lod < lod_count; lod++)
+      lod_first[lod + 1] += lod_first[lod];
 
-    for (int lod = 0; lod < lod_offsets.size(); lod++)
     {
-      glBindBuffer(GL_ARRAY_BUFFER, vbos[lod]);
-      glBufferData(GL_ARRAY_BUFFER,
-                   lod_offsets[lod].size() * sizeof(lod_offsets[lod][0]),
-                   lod_offsets[lod].data(), GL_STATIC_DRAW);
+      auto const mapped = static_cast<glm::vec3 *>(instances.begin_frame());
+      auto next = lod_first;
+      for (auto instance : frustum_instances)
+        mapped[next[lods.levels[instance]]++] = instance_offsets[instance];
+      instances.end_frame();
     }
+    profiler.pop();
 
+    profiler.push("draw");
     glUseProgram(program);
     glUniformMatrix4fv(model_location, 1, GL_FALSE,
                        reinterpret_cast<float *>(&model));
@@ -445,24 +497,43 @@ try
 
     glBindTexture(GL_TEXTURE_2D, texture);
 
-    for (int lod = 0; lod < lod_offsets.size(); lod++)
+    auto const region_first = instances.offset() / sizeof(glm::vec3);
+    draws.commands.clear();
+    for (std::size_t lod = 0; lod < lod_count; lod++)
     {
-      auto const &mesh = input_model.meshes[lod];
-      glBindVertexArray(vaos[lod]);
-      glDrawElementsInstanced(
-          GL_TRIANGLES, mesh.indices.count, mesh.indices.type,
-          reinterpret_cast<void *>(mesh.indices.view.offset),
-          lod_offsets[lod].size());
+      auto command = packed.meshes[lod];
+      command.instance_count = lod_first[lod + 1] - lod_first[lod];
+      command.base_instance = region_first + lod_first[lod];
+      if (command.instance_count > 0)
+        draws.commands.push_back(command);
     }
-    glEndQuery(GL_TIME_ELAPSED);
-    SDL_GL_SwapWindow(window);
-    logQueries(queries);
-    int sum = 0;
-    for (const auto &lod_offset : lod_offsets)
-      sum += lod_offset.size();
-    std::cout << "visible items:\t" << sum << std::endl;
+    draws.submit(packed);
+    profiler.pop();
+
+    if (options.track)
+      bench.end_frame();
+    else
+      SDL_GL_SwapWindow(window);
+    profiler.end_frame();
+    arena.next_frame();
+
+    if (options.track || ++frame_count % 60 != 0)
+      continue;
+
+    profiler.print(std::cout);
+    std::cout << "visible items:\t" << lod_first.back()
+              << "\ttriangles:\t" << lods.selected_triangles
+              << "\tarena allocations:\t" << arena.last_frame.allocations
+              << " (" << arena.last_frame.bytes << " bytes), on the heap:\t"
+              << arena.last_frame.heap_allocations << " ("
+              << arena.last_frame.heap_bytes << " bytes)" << std::endl;
   }
 
+  if (options.track)
+    bench.finish();
+  if (options.trace)
+    profiler.write_trace(*options.trace);
+
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
 }
@@ -0,0 +1,33 @@
+#include "occluder_mesh.hpp"
+
+#include <GL/glew.h>
+
+#include <cstring>
+
+occluder_mesh load_occluder_mesh(gltf_model const & model, gltf_model::mesh const & mesh)
+{
+	occluder_mesh result;
+
+	result.positions.resize(mesh.position.count);
+	std::memcpy(result.positions.data(), model.buffer.data() + mesh.position.view.offset, mesh.position.count * sizeof(glm::vec3));
+
+	result.indices.resize(mesh.indices.count);
+	char const * indices = model.buffer.data() + mesh.indices.view.offset;
+	for (std::size_t i = 0; i < mesh.indices.count; ++i)
+	{
+		switch (mesh.indices.type)
+		{
+		case GL_UNSIGNED_BYTE:
+			result.indices[i] = reinterpret_cast<std::uint8_t const *>(indices)[i];
+			break;
+		case GL_UNSIGNED_SHORT:
+			result.indices[i] = reinterpret_cast<std::uint16_t const *>(indices)[i];
+			break;
+		default:
+			result.indices[i] = reinterpret_cast<std::uint32_t const *>(indices)[i];
+			break;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Triangle mesh kept on the CPU, for occluder rasterization and LOD error metrics
+struct occluder_mesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<std::uint32_t> indices;
+};
+
+occluder_mesh load_occluder_mesh(gltf_model const & model, gltf_model::mesh const & mesh);
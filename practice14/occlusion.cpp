@@ -0,0 +1,283 @@
+#include "occlusion.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// Vertices closer than this to the eye plane are not projected
+constexpr float min_w = 1e-3f;
+
+}
+
+occlusion_buffer::occlusion_buffer(int width, int height, thread_pool * pool)
+	: width(width)
+	, height(height)
+	, depth(width * height, 0.f)
+	, tiles_x(width / tile_width)
+	, tiles_y(height / tile_height)
+	, pool(pool)
+	, view_projection(1.f)
+	, bins(tiles_x * tiles_y)
+	, tile_min_depth(tiles_x * tiles_y, 0.f)
+{}
+
+void occlusion_buffer::begin(glm::mat4 const & view_projection)
+{
+	this->view_projection = view_projection;
+	triangles.clear();
+	for (auto & bin : bins)
+		bin.clear();
+	stats = {};
+}
+
+void occlusion_buffer::add_occluder(occluder_mesh const & mesh, glm::mat4 const & model)
+{
+	glm::mat4 const transform = view_projection * model;
+
+	// Every vertex is shared by several triangles, so it is projected once: screen
+	// x and y, 1/w, and w itself to drop the triangles crossing the eye plane
+	projected.resize(mesh.positions.size());
+	for (std::size_t i = 0; i < mesh.positions.size(); ++i)
+	{
+		glm::vec3 const & p = mesh.positions[i];
+		glm::vec4 const v = transform[0] * p.x + transform[1] * p.y + transform[2] * p.z + transform[3];
+		float const d = 1.f / v.w;
+		projected[i] = {(v.x * d * 0.5f + 0.5f) * width, (v.y * d * 0.5f + 0.5f) * height, d, v.w};
+	}
+
+	stats.submitted_triangles += mesh.indices.size() / 3;
+
+	for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		glm::vec4 const * v[3] = {&projected[mesh.indices[i]], &projected[mesh.indices[i + 1]], &projected[mesh.indices[i + 2]]};
+
+		// Clipping is not worth it for occluders: a triangle crossing the eye plane is dropped
+		if (v[0]->w < min_w || v[1]->w < min_w || v[2]->w < min_w)
+			continue;
+
+		float x[3], y[3], d[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			x[k] = v[k]->x;
+			y[k] = v[k]->y;
+			d[k] = v[k]->z;
+		}
+
+		// Back faces and degenerate triangles
+		float const area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (!(area > 0.f))
+			continue;
+
+		// The pixels whose centers are within the bounds. Far occluders have many
+		// triangles between the centers, which are dropped here.
+		triangle t;
+		t.min_x = std::max(0, static_cast<int>(std::ceil(std::min({x[0], x[1], x[2]}) - 0.5f)));
+		t.min_y = std::max(0, static_cast<int>(std::ceil(std::min({y[0], y[1], y[2]}) - 0.5f)));
+		t.max_x = std::min(width - 1, static_cast<int>(std::floor(std::max({x[0], x[1], x[2]}) - 0.5f)));
+		t.max_y = std::min(height - 1, static_cast<int>(std::floor(std::max({y[0], y[1], y[2]}) - 0.5f)));
+		if (t.min_x > t.max_x || t.min_y > t.max_y)
+			continue;
+
+		// Edge k runs from vertex k + 1 to vertex k + 2, so it is zero on the side
+		// opposite to vertex k and divided by the area gives its barycentric weight.
+		// The depth plane is set up in double: in float its constant, a difference
+		// of large terms, could put pixels of thin triangles visibly nearer.
+		double const exact_area = (double(x[1]) - x[0]) * (double(y[2]) - y[0]) - (double(y[1]) - y[0]) * (double(x[2]) - x[0]);
+		double depth_a = 0.0, depth_b = 0.0, depth_c = 0.0;
+		for (int k = 0; k < 3; ++k)
+		{
+			int const i0 = (k + 1) % 3;
+			int const i1 = (k + 2) % 3;
+			t.edge_a[k] = y[i0] - y[i1];
+			t.edge_b[k] = x[i1] - x[i0];
+			t.edge_c[k] = -(t.edge_a[k] * x[i0] + t.edge_b[k] * y[i0]);
+
+			double const a = double(y[i0]) - y[i1];
+			double const b = double(x[i1]) - x[i0];
+			depth_a += a * d[k];
+			depth_b += b * d[k];
+			depth_c -= (a * x[i0] + b * y[i0]) * d[k];
+		}
+		t.depth_a = depth_a / exact_area;
+		t.depth_b = depth_b / exact_area;
+		t.depth_c = depth_c / exact_area;
+
+		// Evaluating the plane in float can still round a pixel nearer than the
+		// triangle is. Moving the plane back by a bound on that error, and never
+		// nearer than the nearest corner, keeps occluders from hiding what is just
+		// in front of them.
+		t.depth_c -= 8.f * std::numeric_limits<float>::epsilon()
+			* (std::abs(t.depth_a) * width + std::abs(t.depth_b) * height + std::abs(t.depth_c));
+		t.depth_max = std::max({d[0], d[1], d[2]});
+
+		std::uint32_t const index = triangles.size();
+		triangles.push_back(t);
+
+		for (int ty = t.min_y / tile_height; ty <= t.max_y / tile_height; ++ty)
+			for (int tx = t.min_x / tile_width; tx <= t.max_x / tile_width; ++tx)
+				bins[ty * tiles_x + tx].push_back(index);
+	}
+
+	stats.binned_triangles = triangles.size();
+}
+
+void occlusion_buffer::rasterize()
+{
+	std::size_t const tile_count = bins.size();
+	if (pool)
+		pool->parallel_for(tile_count, 1, [this](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t tile = begin; tile < end; ++tile)
+				rasterize_tile(tile);
+		});
+	else
+		for (std::size_t tile = 0; tile < tile_count; ++tile)
+			rasterize_tile(tile);
+}
+
+void occlusion_buffer::rasterize_tile(std::size_t tile)
+{
+	int const x0 = (tile % tiles_x) * tile_width;
+	int const y0 = (tile / tiles_x) * tile_height;
+	int const x1 = x0 + tile_width - 1;
+	int const y1 = y0 + tile_height - 1;
+
+	for (int y = y0; y <= y1; ++y)
+		std::fill_n(depth.data() + y * width + x0, tile_width, 0.f);
+
+	for (auto index : bins[tile])
+	{
+		triangle const & t = triangles[index];
+
+		int const min_y = std::max(y0, t.min_y);
+		int const max_y = std::min(y1, t.max_y);
+		// Whole groups of eight pixels, the tile width is a multiple of eight
+		int const min_x = std::max(x0, t.min_x) & ~7;
+		int const max_x = std::min(x1, t.max_x);
+
+#ifdef __AVX2__
+		__m256 const lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		__m256 const zero = _mm256_setzero_ps();
+		__m256 ea[3], eb[3], ec[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			ea[k] = _mm256_set1_ps(t.edge_a[k]);
+			eb[k] = _mm256_set1_ps(t.edge_b[k]);
+			ec[k] = _mm256_set1_ps(t.edge_c[k]);
+		}
+		__m256 const da = _mm256_set1_ps(t.depth_a);
+		__m256 const db = _mm256_set1_ps(t.depth_b);
+		__m256 const dc = _mm256_set1_ps(t.depth_c);
+		__m256 const dmax = _mm256_set1_ps(t.depth_max);
+
+		for (int y = min_y; y <= max_y; ++y)
+		{
+			__m256 const py = _mm256_set1_ps(y + 0.5f);
+			float * row = depth.data() + y * width;
+
+			for (int x = min_x; x <= max_x; x += 8)
+			{
+				__m256 const px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane);
+
+				__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (int k = 0; k < 3; ++k)
+				{
+					__m256 e = _mm256_fmadd_ps(ea[k], px, _mm256_fmadd_ps(eb[k], py, ec[k]));
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(e, zero, _CMP_GE_OQ));
+				}
+
+				if (_mm256_testz_ps(inside, inside))
+					continue;
+
+				__m256 const d = _mm256_min_ps(dmax, _mm256_fmadd_ps(da, px, _mm256_fmadd_ps(db, py, dc)));
+				__m256 const old = _mm256_loadu_ps(row + x);
+				_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_max_ps(old, d), inside));
+			}
+		}
+#else
+		for (int y = min_y; y <= max_y; ++y)
+		{
+			float const py = y + 0.5f;
+			float * row = depth.data() + y * width;
+
+			for (int x = min_x; x <= max_x; ++x)
+			{
+				float const px = x + 0.5f;
+				bool inside = true;
+				for (int k = 0; k < 3; ++k)
+					inside = inside && (t.edge_a[k] * px + t.edge_b[k] * py + t.edge_c[k] >= 0.f);
+
+				if (inside)
+					row[x] = std::max(row[x], std::min(t.depth_max, t.depth_a * px + t.depth_b * py + t.depth_c));
+			}
+		}
+#endif
+	}
+
+	float farthest = depth[y0 * width + x0];
+	for (int y = y0; y <= y1; ++y)
+		for (int x = x0; x <= x1; ++x)
+			farthest = std::min(farthest, depth[y * width + x]);
+	tile_min_depth[tile] = farthest;
+}
+
+bool occlusion_buffer::visible(glm::vec3 const & min, glm::vec3 const & max) const
+{
+	float min_x = width, min_y = height, max_x = 0.f, max_y = 0.f;
+	float nearest = 0.f;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec4 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+		corner = view_projection * corner;
+
+		// The box reaches behind the eye, nothing can cover it
+		if (corner.w < min_w)
+			return true;
+
+		float const d = 1.f / corner.w;
+		float const x = (corner.x * d * 0.5f + 0.5f) * width;
+		float const y = (corner.y * d * 0.5f + 0.5f) * height;
+		min_x = std::min(min_x, x);
+		min_y = std::min(min_y, y);
+		max_x = std::max(max_x, x);
+		max_y = std::max(max_y, y);
+		nearest = std::max(nearest, d);
+	}
+
+	// Pixels whose centers the projected rectangle covers, at least one of them
+	int const x0 = std::max(0, static_cast<int>(std::floor(min_x)));
+	int const y0 = std::max(0, static_cast<int>(std::floor(min_y)));
+	int const x1 = std::min(width - 1, static_cast<int>(std::floor(max_x)));
+	int const y1 = std::min(height - 1, static_cast<int>(std::floor(max_y)));
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int ty = y0 / tile_height; ty <= y1 / tile_height; ++ty)
+	{
+		for (int tx = x0 / tile_width; tx <= x1 / tile_width; ++tx)
+		{
+			if (tile_min_depth[ty * tiles_x + tx] > nearest)
+				continue;
+
+			int const px0 = std::max(x0, tx * tile_width);
+			int const px1 = std::min(x1, tx * tile_width + tile_width - 1);
+			int const py0 = std::max(y0, ty * tile_height);
+			int const py1 = std::min(y1, ty * tile_height + tile_height - 1);
+
+			for (int y = py0; y <= py1; ++y)
+				for (int x = px0; x <= px1; ++x)
+					if (depth[y * width + x] <= nearest)
+						return true;
+		}
+	}
+
+	return false;
+}
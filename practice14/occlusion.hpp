@@ -0,0 +1,73 @@
+#pragma once
+
+#include "occluder_mesh.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Low-resolution software depth buffer. Occluders are transformed and binned into
+// screen tiles by add_occluder(), then rasterize() fills the tiles in parallel,
+// eight pixels at a time. The buffer stores 1/w, so larger values are nearer and
+// an empty pixel is 0.
+//
+// A pixel counts as covered when its center is inside a triangle, its depth is
+// never nearer than the triangle, and a box is reported occluded when every
+// pixel its screen rectangle touches is covered nearer than the box. The test
+// is therefore conservative, down to the pixel centers, only for occluders
+// inside the objects they stand for. main.cpp uses the finest LOD: the coarsest
+// one sticks out of it and hides up to 110 visible boxes in the views of
+// --occlusion-test.
+struct occlusion_buffer
+{
+	static constexpr int tile_width = 32;
+	static constexpr int tile_height = 16;
+
+	// width must be a multiple of tile_width and height of tile_height
+	occlusion_buffer(int width, int height, thread_pool * pool = nullptr);
+
+	void begin(glm::mat4 const & view_projection);
+	void add_occluder(occluder_mesh const & mesh, glm::mat4 const & model);
+	void rasterize();
+
+	// False when every pixel the box covers is behind an occluder
+	bool visible(glm::vec3 const & min, glm::vec3 const & max) const;
+
+	struct statistics
+	{
+		std::size_t submitted_triangles = 0;
+		std::size_t binned_triangles = 0;
+	};
+
+	int width;
+	int height;
+	// Row-major, row 0 at the bottom of the screen
+	std::vector<float> depth;
+	statistics stats;
+
+private:
+	// Edge functions a * x + b * y + c, non-negative inside, and 1/w as a plane in screen space
+	struct triangle
+	{
+		float edge_a[3], edge_b[3], edge_c[3];
+		float depth_a, depth_b, depth_c;
+		float depth_max;
+		int min_x, min_y, max_x, max_y;
+	};
+
+	int tiles_x;
+	int tiles_y;
+	thread_pool * pool;
+
+	glm::mat4 view_projection;
+	std::vector<triangle> triangles;
+	std::vector<std::vector<std::uint32_t>> bins;
+	// Farthest depth of every tile after rasterize()
+	std::vector<float> tile_min_depth;
+	std::vector<glm::vec4> projected;
+
+	void rasterize_tile(std::size_t tile);
+};
@@ -0,0 +1,470 @@
+#include "occlusion_test.hpp"
+
+#include "culling.hpp"
+#include "gltf_loader.hpp"
+#include "occlusion.hpp"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// The same as the occlusion buffer's
+constexpr float min_w = 1e-3f;
+
+// The viewer's setting: a 256 x 256 grid of instances one unit apart, the
+// nearest 64 in the frustum occlude the rest
+constexpr int grid = 128;
+constexpr std::size_t max_occluders = 64;
+
+struct camera
+{
+	glm::vec3 position;
+	float rotation;
+};
+
+// The start position, which looks over the grid, then views low inside it and
+// from its corner, where the instances hide each other
+std::array<camera, 6> const cameras = {{
+	{{0.f, 1.5f, 3.f}, 0.f},
+	{{0.f, 0.3f, 0.f}, 0.7f},
+	{{10.f, 0.3f, -20.f}, 2.f},
+	{{-30.f, 0.2f, 40.f}, -1.f},
+	{{0.f, 0.5f, -50.f}, 3.f},
+	{{127.f, 0.3f, 127.f}, -0.8f},
+}};
+
+// As main.cpp builds it
+glm::mat4 view_projection(camera const & c, float aspect)
+{
+	glm::mat4 view(1.f);
+	view = glm::rotate(view, c.rotation, {0.f, 1.f, 0.f});
+	view = glm::translate(view, -c.position);
+	return glm::perspective(glm::pi<float>() / 2.f, aspect, 0.1f, 100.f) * view;
+}
+
+// Pixel centers closer than this to a triangle's edge may fall on either side in float
+constexpr double edge_distance = 1e-3;
+
+struct reference_buffer
+{
+	std::vector<float> depth;
+	// Pixels with a center within edge_distance of the edge of a triangle that
+	// covers it or nearly does
+	std::vector<bool> edge;
+};
+
+// Every triangle against every pixel center of its bounds in double precision,
+// keeping the nearest 1/w
+reference_buffer reference_depth(int width, int height, glm::mat4 const & view_projection,
+	occluder_mesh const & mesh, std::vector<glm::mat4> const & models)
+{
+	reference_buffer result;
+	result.depth.assign(std::size_t(width) * height, 0.f);
+	result.edge.assign(std::size_t(width) * height, false);
+
+	for (auto const & model : models)
+	{
+		glm::mat4 const transform = view_projection * model;
+		for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			double x[3], y[3], d[3];
+			bool behind = false;
+			for (int k = 0; k < 3; ++k)
+			{
+				glm::vec4 const v = transform * glm::vec4(mesh.positions[mesh.indices[i + k]], 1.f);
+				behind = behind || v.w < min_w;
+				d[k] = 1.0 / v.w;
+				x[k] = (v.x * d[k] * 0.5 + 0.5) * width;
+				y[k] = (v.y * d[k] * 0.5 + 0.5) * height;
+			}
+
+			double const area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+			if (behind || !(area > 0.0))
+				continue;
+
+			int const min_x = std::max(0, int(std::floor(std::min({x[0], x[1], x[2]}))));
+			int const min_y = std::max(0, int(std::floor(std::min({y[0], y[1], y[2]}))));
+			int const max_x = std::min(width - 1, int(std::ceil(std::max({x[0], x[1], x[2]}))));
+			int const max_y = std::min(height - 1, int(std::ceil(std::max({y[0], y[1], y[2]}))));
+
+			for (int py = min_y; py <= max_y; ++py)
+				for (int px = min_x; px <= max_x; ++px)
+				{
+					double const cx = px + 0.5;
+					double const cy = py + 0.5;
+					double depth = 0.0;
+					double nearest_edge = std::numeric_limits<double>::infinity();
+					for (int k = 0; k < 3; ++k)
+					{
+						int const i0 = (k + 1) % 3;
+						int const i1 = (k + 2) % 3;
+						double const e = (y[i0] - y[i1]) * (cx - x[i0]) + (x[i1] - x[i0]) * (cy - y[i0]);
+						nearest_edge = std::min(nearest_edge, e / std::hypot(y[i0] - y[i1], x[i1] - x[i0]));
+						depth += e / area * d[k];
+					}
+
+					std::size_t const pixel = std::size_t(py) * width + px;
+					if (nearest_edge > -edge_distance && nearest_edge < edge_distance)
+						result.edge[pixel] = true;
+					if (nearest_edge >= 0.0)
+						result.depth[pixel] = std::max(result.depth[pixel], float(depth));
+				}
+		}
+	}
+
+	return result;
+}
+
+// occlusion_buffer::visible() without the per-tile depths: the whole screen
+// rectangle of the box is scanned
+bool reference_visible(occlusion_buffer const & buffer, glm::mat4 const & view_projection,
+	glm::vec3 const & min, glm::vec3 const & max)
+{
+	float min_x = buffer.width, min_y = buffer.height, max_x = 0.f, max_y = 0.f;
+	float nearest = 0.f;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec4 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+		corner = view_projection * corner;
+		if (corner.w < min_w)
+			return true;
+
+		float const d = 1.f / corner.w;
+		float const x = (corner.x * d * 0.5f + 0.5f) * buffer.width;
+		float const y = (corner.y * d * 0.5f + 0.5f) * buffer.height;
+		min_x = std::min(min_x, x);
+		min_y = std::min(min_y, y);
+		max_x = std::max(max_x, x);
+		max_y = std::max(max_y, y);
+		nearest = std::max(nearest, d);
+	}
+
+	int const x0 = std::max(0, static_cast<int>(std::floor(min_x)));
+	int const y0 = std::max(0, static_cast<int>(std::floor(min_y)));
+	int const x1 = std::min(buffer.width - 1, static_cast<int>(std::floor(max_x)));
+	int const y1 = std::min(buffer.height - 1, static_cast<int>(std::floor(max_y)));
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int y = y0; y <= y1; ++y)
+		for (int x = x0; x <= x1; ++x)
+			if (buffer.depth[y * buffer.width + x] <= nearest)
+				return true;
+	return false;
+}
+
+// Pixels on an edge are only counted, the others have to agree
+struct depth_difference
+{
+	std::size_t edge = 0;
+	// Pixels covered in one buffer only
+	std::size_t coverage = 0;
+	std::size_t covered = 0;
+	// Covered pixels nearer than the reference, where an occluder could hide a box in front of it
+	std::size_t nearer = 0;
+	// Largest relative difference where both are covered
+	float depth = 0.f;
+};
+
+depth_difference compare_depth(std::vector<float> const & a, reference_buffer const & b)
+{
+	depth_difference result;
+	for (std::size_t i = 0; i < a.size(); ++i)
+	{
+		if (b.edge[i])
+			++result.edge;
+		else if ((a[i] > 0.f) != (b.depth[i] > 0.f))
+			++result.coverage;
+		else if (a[i] > 0.f)
+		{
+			++result.covered;
+			result.nearer += a[i] > b.depth[i];
+			result.depth = std::max(result.depth, std::abs(a[i] - b.depth[i]) / b.depth[i]);
+		}
+	}
+	return result;
+}
+
+struct view_result
+{
+	std::size_t frustum = 0;
+	std::size_t occluded = 0;
+	std::size_t occluded_coarse = 0;
+	// Hidden by the coarsest LOD but visible past the finest
+	std::size_t false_culls = 0;
+	double rasterize_ms = 0.0;
+	double rasterize_coarse_ms = 0.0;
+	double test_ms = 0.0;
+};
+
+}
+
+occlusion_test_options parse_occlusion_test_options(int argc, char ** argv)
+{
+	occlusion_test_options result;
+	if (argc < 2 || std::string(argv[1]) != "--occlusion-test")
+		return result;
+	result.enabled = true;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string const arg = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 == argc)
+				throw std::runtime_error("Missing value after " + arg);
+			return argv[++i];
+		};
+
+		if (arg == "--output")
+			result.output = value();
+		else if (arg == "--size")
+		{
+			std::string const size = value();
+			auto const x = size.find('x');
+			if (x == std::string::npos)
+				throw std::runtime_error("Expected --size <width>x<height>");
+			result.width = std::stoi(size.substr(0, x));
+			result.height = std::stoi(size.substr(x + 1));
+		}
+		else if (arg == "--repeats")
+			result.repeats = std::stoi(value());
+		else if (arg == "--threads")
+			result.threads = std::stoul(value());
+		else
+			throw std::runtime_error("Unknown argument " + arg);
+	}
+
+	if (result.width <= 0 || result.width % occlusion_buffer::tile_width != 0
+		|| result.height <= 0 || result.height % occlusion_buffer::tile_height != 0)
+		throw std::runtime_error("--size must be a multiple of the "
+			+ std::to_string(occlusion_buffer::tile_width) + "x" + std::to_string(occlusion_buffer::tile_height) + " tiles");
+	if (result.repeats <= 0)
+		throw std::runtime_error("--repeats must be positive");
+
+	return result;
+}
+
+bool run_occlusion_test(occlusion_test_options const & options)
+{
+	thread_pool pool(options.threads ? options.threads : std::thread::hardware_concurrency());
+	float const aspect = float(options.width) / options.height;
+	bool passed = true;
+
+	auto check = [&](bool condition, std::string const & what)
+	{
+		if (!condition)
+		{
+			std::cout << "FAILED: " << what << '\n';
+			passed = false;
+		}
+	};
+
+	// A square wall 5 units ahead, 4 units wide, and boxes around it
+	{
+		occluder_mesh wall;
+		wall.positions = {{-2.f, -2.f, -5.f}, {2.f, -2.f, -5.f}, {2.f, 2.f, -5.f}, {-2.f, 2.f, -5.f}};
+		wall.indices = {0, 1, 2, 0, 2, 3};
+
+		glm::mat4 const transform = view_projection({glm::vec3(0.f), 0.f}, aspect);
+		occlusion_buffer buffer(options.width, options.height, &pool);
+		buffer.begin(transform);
+		buffer.add_occluder(wall, glm::mat4(1.f));
+		buffer.rasterize();
+
+		struct expectation
+		{
+			char const * name;
+			glm::vec3 min, max;
+			bool visible;
+		};
+		expectation const boxes[] = {
+			{"box behind the wall", {-0.5f, -0.5f, -8.f}, {0.5f, 0.5f, -7.f}, false},
+			{"box filling the wall from behind", {-1.9f, -1.9f, -5.5f}, {1.9f, 1.9f, -5.1f}, false},
+			{"box in front of the wall", {-0.5f, -0.5f, -4.f}, {0.5f, 0.5f, -3.f}, true},
+			{"box through the wall", {-0.5f, -0.5f, -6.f}, {0.5f, 0.5f, -4.5f}, true},
+			{"box behind the wall reaching past its edge", {1.5f, -0.5f, -8.f}, {3.f, 0.5f, -7.f}, true},
+			{"box beside the wall", {5.f, -0.5f, -8.f}, {6.f, 0.5f, -7.f}, true},
+			{"box around the eye", {-0.5f, -0.5f, -1.f}, {0.5f, 0.5f, 1.f}, true},
+		};
+		for (auto const & box : boxes)
+			check(buffer.visible(box.min, box.max) == box.visible, box.name);
+
+		auto const difference = compare_depth(buffer.depth,
+			reference_depth(options.width, options.height, transform, wall, {glm::mat4(1.f)}));
+		check(difference.coverage == 0 && difference.nearer == 0 && difference.depth < 1e-3f,
+			"wall depth differs from the reference");
+	}
+
+	std::filesystem::path const model_path = std::filesystem::path(PROJECT_ROOT) / "bunny" / "bunny.gltf";
+	auto const model = load_gltf(model_path);
+	// The viewer's occluder, and the coarsest LOD it used before for comparison
+	auto const occluder = load_occluder_mesh(model, model.meshes.front());
+	auto const coarse = load_occluder_mesh(model, model.meshes.back());
+
+	std::vector<glm::vec3> offsets;
+	aabb_soa boxes;
+	boxes.reserve(4 * grid * grid);
+	for (int i = -grid; i < grid; i++)
+		for (int j = -grid; j < grid; j++)
+		{
+			glm::vec3 const offset(i, 0, j);
+			offsets.push_back(offset);
+			boxes.push_back(model.meshes[0].min + offset, model.meshes[0].max + offset);
+		}
+	aabb_bvh const bvh(boxes);
+
+	occlusion_buffer buffer(options.width, options.height, &pool);
+	occlusion_buffer serial_buffer(options.width, options.height);
+	occlusion_buffer coarse_buffer(options.width, options.height, &pool);
+
+	std::vector<view_result> results;
+	std::vector<std::uint32_t> visible;
+	std::size_t edge_pixels = 0, coverage_differences = 0, covered_pixels = 0, nearer_pixels = 0;
+	float depth_difference = 0.f;
+	for (auto const & c : cameras)
+	{
+		glm::mat4 const transform = view_projection(c, aspect);
+		auto & result = results.emplace_back();
+
+		visible.clear();
+		result.frustum = bvh.cull(frustum_planes{transform}, visible);
+		visible.resize(result.frustum);
+
+		std::size_t const occluder_count = std::min(max_occluders, visible.size());
+		std::nth_element(visible.begin(), visible.begin() + occluder_count, visible.end(),
+			[&](std::uint32_t a, std::uint32_t b)
+			{
+				return glm::distance(c.position, offsets[a]) < glm::distance(c.position, offsets[b]);
+			});
+		std::vector<glm::mat4> models;
+		for (std::size_t i = 0; i < occluder_count; ++i)
+			models.push_back(glm::translate(glm::mat4(1.f), offsets[visible[i]]));
+
+		auto fill = [&](occlusion_buffer & buffer, occluder_mesh const & mesh)
+		{
+			buffer.begin(transform);
+			for (auto const & m : models)
+				buffer.add_occluder(mesh, m);
+			buffer.rasterize();
+		};
+
+		auto const start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeats; ++r)
+			fill(buffer, occluder);
+		auto const rasterized = std::chrono::steady_clock::now();
+
+		std::vector<bool> box_visible(visible.size());
+		for (int r = 0; r < options.repeats; ++r)
+			for (std::size_t i = 0; i < visible.size(); ++i)
+			{
+				glm::vec3 const & offset = offsets[visible[i]];
+				box_visible[i] = buffer.visible(model.meshes[0].min + offset, model.meshes[0].max + offset);
+			}
+		auto const tested = std::chrono::steady_clock::now();
+
+		for (int r = 0; r < options.repeats; ++r)
+			fill(coarse_buffer, coarse);
+		auto const coarse_rasterized = std::chrono::steady_clock::now();
+
+		result.rasterize_ms = std::chrono::duration<double, std::milli>(rasterized - start).count() / options.repeats;
+		result.test_ms = std::chrono::duration<double, std::milli>(tested - rasterized).count() / options.repeats;
+		result.rasterize_coarse_ms = std::chrono::duration<double, std::milli>(coarse_rasterized - tested).count()
+			/ options.repeats;
+
+		// The tiles give the same depth whether they are filled in parallel or not
+		fill(serial_buffer, occluder);
+		check(serial_buffer.depth == buffer.depth, "threaded rasterization differs from serial");
+
+		auto const difference = compare_depth(buffer.depth,
+			reference_depth(options.width, options.height, transform, occluder, models));
+		edge_pixels += difference.edge;
+		coverage_differences += difference.coverage;
+		nearer_pixels += difference.nearer;
+		covered_pixels += difference.covered;
+		depth_difference = std::max(depth_difference, difference.depth);
+
+		std::size_t reference_mismatches = 0;
+		for (std::size_t i = 0; i < visible.size(); ++i)
+		{
+			glm::vec3 const min = model.meshes[0].min + offsets[visible[i]];
+			glm::vec3 const max = model.meshes[0].max + offsets[visible[i]];
+			if (reference_visible(buffer, transform, min, max) != box_visible[i])
+				++reference_mismatches;
+
+			bool const coarse_visible = coarse_buffer.visible(min, max);
+			result.occluded += !box_visible[i];
+			result.occluded_coarse += !coarse_visible;
+			result.false_culls += !coarse_visible && box_visible[i];
+		}
+		check(reference_mismatches == 0, std::to_string(reference_mismatches)
+			+ " boxes where visible() differs from scanning the whole depth buffer");
+	}
+
+	check(coverage_differences == 0, "coverage differs from the reference in "
+		+ std::to_string(coverage_differences) + " of " + std::to_string(covered_pixels) + " pixels");
+	// The depth planes are moved back by a bound on their rounding, which is
+	// far larger than the rounding usually is
+	check(nearer_pixels == 0, std::to_string(nearer_pixels) + " pixels nearer than the reference");
+	check(depth_difference < 4e-3f, "depth differs from the reference by " + std::to_string(depth_difference));
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << options.width << "x" << options.height << " occlusion buffer, " << occluder.indices.size() / 3
+		<< " triangles per occluder (coarsest LOD " << coarse.indices.size() / 3 << "), " << pool.size() << " threads\n";
+	std::cout << "pixels off the reference\t" << coverage_differences << " of " << covered_pixels << " (" << edge_pixels
+		<< " on edges not compared)\tlargest relative depth difference\t" << std::setprecision(7) << depth_difference << std::setprecision(3) << '\n';
+	std::cout << "view\tin frustum\toccluded\toccluded (coarsest)\tonly by coarsest\tms rasterize\tms rasterize (coarsest)"
+		"\tms test\n";
+	std::size_t false_culls = 0;
+	for (std::size_t v = 0; v < results.size(); ++v)
+	{
+		auto const & r = results[v];
+		std::cout << v << "\t" << r.frustum << "\t" << r.occluded << "\t" << r.occluded_coarse << "\t"
+			<< r.false_culls << "\t" << r.rasterize_ms << "\t" << r.rasterize_coarse_ms << "\t" << r.test_ms << '\n';
+		false_culls += r.false_culls;
+	}
+	std::cout << (passed ? "passed" : "FAILED") << '\n';
+	std::cout << std::defaultfloat;
+	std::cout.flush();
+
+	if (options.output)
+	{
+		std::ofstream out(*options.output);
+		out << "{\n";
+		out << "\"width\": " << options.width << ",\n";
+		out << "\"height\": " << options.height << ",\n";
+		out << "\"threads\": " << pool.size() << ",\n";
+		out << "\"passed\": " << (passed ? "true" : "false") << ",\n";
+		out << "\"only_by_coarsest\": " << false_culls << ",\n";
+		out << "\"views\": [";
+		for (std::size_t v = 0; v < results.size(); ++v)
+		{
+			auto const & r = results[v];
+			out << (v ? ",\n" : "\n") << "{\"frustum\": " << r.frustum << ", \"occluded\": " << r.occluded
+				<< ", \"occluded_coarsest\": " << r.occluded_coarse << ", \"only_by_coarsest\": " << r.false_culls
+				<< ", \"rasterize_ms\": " << r.rasterize_ms << ", \"rasterize_coarsest_ms\": " << r.rasterize_coarse_ms
+				<< ", \"test_ms\": " << r.test_ms << "}";
+		}
+		out << "\n]\n}\n";
+	}
+
+	return passed;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+struct occlusion_test_options
+{
+	// Set by --occlusion-test, which has to be the first argument
+	bool enabled = false;
+	std::optional<std::filesystem::path> output;
+	// The viewer's occlusion buffer size by default
+	int width = 320;
+	int height = 192;
+	int repeats = 20;
+	// All hardware threads by default
+	std::size_t threads = 0;
+};
+
+// --occlusion-test [--size <w>x<h>] [--repeats <n>] [--threads <n>] [--output <json>]
+// Anything else leaves the options disabled without looking at the arguments.
+occlusion_test_options parse_occlusion_test_options(int argc, char ** argv);
+
+// Checks the occlusion buffer without a window with the viewer's finest-LOD
+// occluders: the rasterized depth against a brute-force rasterizer, which it may
+// never be nearer than, visible() against a scan of the whole depth buffer that
+// ignores the tile depths, and a wall in front of known boxes. Then reports how
+// many visible boxes the coarsest LOD would hide, and the time to rasterize
+// either. Returns false if a check failed.
+bool run_occlusion_test(occlusion_test_options const & options);
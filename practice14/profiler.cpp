@@ -0,0 +1,219 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+frame_profiler::frame_profiler(std::size_t max_scopes, std::size_t history)
+	: max_scopes(max_scopes)
+	, history(history)
+	, start(clock::now())
+{
+	for (auto & slot_queries : queries)
+	{
+		slot_queries.resize(max_scopes * 2);
+		glGenQueries(slot_queries.size(), slot_queries.data());
+	}
+
+	GLint64 gpu_now;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+	gpu_offset = gpu_now - now();
+}
+
+frame_profiler::~frame_profiler()
+{
+	for (auto & slot_queries : queries)
+		glDeleteQueries(slot_queries.size(), slot_queries.data());
+}
+
+std::int64_t frame_profiler::now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+}
+
+void frame_profiler::begin_frame()
+{
+	std::size_t const slot = frame_index % latency;
+	if (frame_index >= latency)
+		resolve(slots[slot], queries[slot]);
+
+	slots[slot].records.clear();
+	slots[slot].used_queries = 0;
+	stack.clear();
+	push("frame");
+}
+
+void frame_profiler::end_frame()
+{
+	while (!stack.empty())
+		pop();
+	++frame_index;
+}
+
+void frame_profiler::push(char const * name)
+{
+	std::size_t const slot = frame_index % latency;
+	frame & current = slots[slot];
+
+	record r;
+	r.name = name;
+	r.depth = stack.size();
+	r.parent = stack.empty() ? -1 : stack.back();
+	r.cpu_begin = now();
+	r.cpu_end = r.cpu_begin;
+
+	if (current.used_queries + 2 <= queries[slot].size())
+	{
+		r.query = current.used_queries;
+		current.used_queries += 2;
+		glQueryCounter(queries[slot][r.query], GL_TIMESTAMP);
+	}
+
+	stack.push_back(current.records.size());
+	current.records.push_back(r);
+}
+
+void frame_profiler::pop()
+{
+	std::size_t const slot = frame_index % latency;
+	record & r = slots[slot].records[stack.back()];
+	stack.pop_back();
+
+	if (r.query >= 0)
+		glQueryCounter(queries[slot][r.query + 1], GL_TIMESTAMP);
+	r.cpu_end = now();
+}
+
+void frame_profiler::resolve(frame & slot, std::vector<GLuint> const & slot_queries)
+{
+	// Blocks only if the GPU is more than `latency` frames behind
+	for (auto & r : slot.records)
+	{
+		if (r.query < 0)
+			continue;
+
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(slot_queries[r.query], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(slot_queries[r.query + 1], GL_QUERY_RESULT, &end);
+		r.gpu_begin = static_cast<std::int64_t>(begin) - gpu_offset;
+		r.gpu_end = static_cast<std::int64_t>(end) - gpu_offset;
+	}
+
+	// The oldest frame's storage is reused, begin_frame() keeps the slot's
+	std::vector<record> records;
+	if (resolved.size() >= history)
+	{
+		records = std::move(resolved.front());
+		resolved.pop_front();
+	}
+	records.assign(slot.records.begin(), slot.records.end());
+	resolved.push_back(std::move(records));
+}
+
+std::string frame_profiler::path(std::vector<record> const & records, int index) const
+{
+	std::string result = records[index].name;
+	for (int i = records[index].parent; i >= 0; i = records[i].parent)
+		result = std::string(records[i].name) + "/" + result;
+	return result;
+}
+
+std::vector<frame_profiler::statistics> frame_profiler::summary() const
+{
+	struct accumulator
+	{
+		int depth;
+		// Order of first appearance, so that the summary follows the frame
+		std::size_t order;
+		double cpu_sum = 0.0, cpu_max = 0.0;
+		double gpu_sum = 0.0, gpu_max = 0.0;
+		std::size_t cpu_count = 0, gpu_count = 0;
+	};
+
+	std::map<std::string, accumulator> scopes;
+	for (auto const & records : resolved)
+	{
+		for (std::size_t i = 0; i < records.size(); ++i)
+		{
+			record const & r = records[i];
+			auto [it, inserted] = scopes.try_emplace(path(records, i), accumulator{r.depth, scopes.size()});
+			accumulator & a = it->second;
+
+			double const cpu = (r.cpu_end - r.cpu_begin) * 1e-6;
+			a.cpu_sum += cpu;
+			a.cpu_max = std::max(a.cpu_max, cpu);
+			++a.cpu_count;
+
+			if (r.query >= 0)
+			{
+				double const gpu = (r.gpu_end - r.gpu_begin) * 1e-6;
+				a.gpu_sum += gpu;
+				a.gpu_max = std::max(a.gpu_max, gpu);
+				++a.gpu_count;
+			}
+		}
+	}
+
+	std::vector<std::pair<std::size_t, statistics>> ordered;
+	for (auto const & [name, a] : scopes)
+	{
+		statistics s;
+		s.path = name;
+		s.depth = a.depth;
+		s.cpu_mean = a.cpu_sum / a.cpu_count;
+		s.cpu_max = a.cpu_max;
+		s.gpu_mean = a.gpu_count ? a.gpu_sum / a.gpu_count : -1.f;
+		s.gpu_max = a.gpu_count ? a.gpu_max : -1.f;
+		ordered.emplace_back(a.order, s);
+	}
+	std::sort(ordered.begin(), ordered.end(), [](auto const & a, auto const & b){ return a.first < b.first; });
+
+	std::vector<statistics> result;
+	for (auto & entry : ordered)
+		result.push_back(std::move(entry.second));
+	return result;
+}
+
+void frame_profiler::print(std::ostream & out) const
+{
+	out << "scope (last " << resolved.size() << " frames)\tcpu mean / max ms\tgpu mean / max ms\n";
+	out << std::fixed << std::setprecision(3);
+	for (auto const & s : summary())
+	{
+		std::string const name = s.path.substr(s.path.find_last_of('/') + 1);
+		out << std::string(s.depth * 2, ' ') << name << "\t" << s.cpu_mean << " / " << s.cpu_max << "\t";
+		if (s.gpu_mean >= 0.f)
+			out << s.gpu_mean << " / " << s.gpu_max;
+		else
+			out << "-";
+		out << '\n';
+	}
+	out << std::defaultfloat;
+	out.flush();
+}
+
+void frame_profiler::write_trace(std::filesystem::path const & path) const
+{
+	std::ofstream out(path);
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+
+	out << std::fixed << std::setprecision(3);
+	auto event = [&](char const * name, int thread, std::int64_t begin, std::int64_t end)
+	{
+		// Timestamps and durations are in microseconds
+		out << ",\n{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread
+			<< ",\"ts\":" << begin * 1e-3 << ",\"dur\":" << (end - begin) * 1e-3 << "}";
+	};
+
+	for (auto const & records : resolved)
+		for (auto const & r : records)
+		{
+			event(r.name, 0, r.cpu_begin, r.cpu_end);
+			if (r.query >= 0)
+				event(r.name, 1, r.gpu_begin, r.gpu_end);
+		}
+
+	out << "\n]}\n";
+}
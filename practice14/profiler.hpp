@@ -0,0 +1,109 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Nested named scopes timed on the CPU with steady_clock and on the GPU with
+// GL_TIMESTAMP queries. Queries come from a fixed ring of frames and a frame's
+// results are read back only when its slot is reused `latency` frames later,
+// by which time the GPU has normally finished it.
+struct frame_profiler
+{
+	static constexpr int latency = 4;
+
+	// Scopes beyond max_scopes in one frame are timed on the CPU only
+	explicit frame_profiler(std::size_t max_scopes = 64, std::size_t history = 300);
+	~frame_profiler();
+
+	frame_profiler(frame_profiler const &) = delete;
+	frame_profiler & operator = (frame_profiler const &) = delete;
+
+	// Everything between the two is one frame, itself the outermost scope
+	void begin_frame();
+	void end_frame();
+
+	// name must outlive the profiler, usually a string literal
+	void push(char const * name);
+	void pop();
+
+	struct scope
+	{
+		scope(frame_profiler & profiler, char const * name)
+			: profiler(profiler)
+		{
+			profiler.push(name);
+		}
+
+		~scope()
+		{
+			profiler.pop();
+		}
+
+		frame_profiler & profiler;
+	};
+
+	// Mean and maximum over the last `history` resolved frames, in milliseconds.
+	// GPU values are negative for scopes that had no queries.
+	struct statistics
+	{
+		std::string path;
+		int depth;
+		float cpu_mean, cpu_max;
+		float gpu_mean, gpu_max;
+	};
+
+	std::vector<statistics> summary() const;
+	void print(std::ostream & out) const;
+
+	// Chrome trace event format, loads in chrome://tracing and Perfetto. The CPU
+	// and the GPU are separate threads, GPU times are shifted onto the CPU clock.
+	void write_trace(std::filesystem::path const & path) const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct record
+	{
+		char const * name;
+		int depth;
+		// Index of the enclosing record, -1 for the frame itself
+		int parent;
+		std::int64_t cpu_begin, cpu_end;
+		std::int64_t gpu_begin = -1, gpu_end = -1;
+		// Index of the first of the two queries, -1 when there were none left
+		int query = -1;
+	};
+
+	struct frame
+	{
+		std::vector<record> records;
+		std::size_t used_queries = 0;
+	};
+
+	std::size_t max_scopes;
+	std::size_t history;
+
+	clock::time_point start;
+	// GPU timestamp minus CPU time, both in ns since start
+	std::int64_t gpu_offset = 0;
+
+	std::array<frame, latency> slots;
+	std::array<std::vector<GLuint>, latency> queries;
+	std::size_t frame_index = 0;
+	std::vector<int> stack;
+
+	std::deque<std::vector<record>> resolved;
+
+	std::int64_t now() const;
+	void resolve(frame & slot, std::vector<GLuint> const & slot_queries);
+	std::string path(std::vector<record> const & records, int index) const;
+};
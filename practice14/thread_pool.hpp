@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct thread_pool
+{
+    using task = std::function<void(std::size_t begin, std::size_t end)>;
+
+    // thread_count includes the calling thread, so 1 means no workers at all
+    explicit thread_pool(std::size_t thread_count = std::thread::hardware_concurrency());
+    ~thread_pool();
+
+    thread_pool(thread_pool const &) = delete;
+    thread_pool & operator = (thread_pool const &) = delete;
+
+    std::size_t size() const { return workers.size() + 1; }
+
+    // Splits [0, count) into chunks of `grain` elements and calls f(begin, end)
+    // for each of them on all threads, returns when every chunk is done
+    void parallel_for(std::size_t count, std::size_t grain, task const & f);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    task const * job = nullptr;
+    std::size_t job_count = 0;
+    std::size_t job_grain = 0;
+    std::size_t job_generation = 0;
+    std::size_t busy_workers = 0;
+    std::atomic<std::size_t> next_chunk{0};
+    bool stopping = false;
+
+    void run_chunks();
+    void worker_loop();
+};
@@ -24,6 +24,7 @@
 #include <string_view>
 #include <vector>
 
+#include "frame_arena.hpp"
 #include "msdf_loader.hpp"
 #include "stb_image.h"
 
@@ -245,6 +246,8 @@ int main() try {
   const float fadeTime = 1113.f;
   bool running = true;
   auto transform = glm::mat4(1.f);
+  // Glyph quads are rebuilt on every edit, without touching the heap
+  frame_arena arena;
   while (running) {
     for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type) {
         case SDL_QUIT:
@@ -302,7 +305,8 @@ int main() try {
     if (text_changed) {
       auto pen = glm::vec2{0.0};
       const auto factor = 5.f;
-      auto vertices = std::vector<vertex>{6 * text.size()};
+      auto vertices = frame_vector<vertex>(6 * text.size(),
+                                           arena_allocator<vertex>{arena});
       auto chars_since_last_space = 0;
       auto line_len_since_space = 0.f;
       auto add_line = [&]() {
@@ -413,6 +417,13 @@ int main() try {
     glUseProgram(msdf_program);
     glDrawArrays(GL_TRIANGLES, 0, 6 * text.size());
     SDL_GL_SwapWindow(window);
+    arena.next_frame();
+    // The arena grows on its own, this shows up only while it does
+    if (arena.last_frame.heap_allocations > 0)
+      std::cout << "arena allocations:\t" << arena.last_frame.allocations
+                << " (" << arena.last_frame.bytes << " bytes), on the heap:\t"
+                << arena.last_frame.heap_allocations << " ("
+                << arena.last_frame.heap_bytes << " bytes)" << std::endl;
   }
 
   SDL_GL_DeleteContext(gl_context);